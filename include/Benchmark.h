@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Voxelizer.h"
+#include "WorkCounters.h"
+
+struct BenchmarkConfig
+{
+    uint32_t         resolution;
+    VoxelizationType type;
+    int              large_triangle_threshold; // -1 for the geometry shader voxelizer, which has none
+    bool             ambient_occlusion;
+};
+
+struct BenchmarkTiming
+{
+    double   total_ms;
+    double   min_ms;
+    double   max_ms;
+    uint32_t count;
+};
+
+struct BenchmarkResult
+{
+    BenchmarkConfig              config;
+    BenchmarkTiming              frame;
+    std::vector<BenchmarkTiming> passes; // Indexed like Benchmark::kPasses
+
+    // Read back from a warm-up frame, the counters are off while measuring.
+    WorkCounterValues           counters;
+    bool                        counters_valid[WORK_COUNTER_GROUP_COUNT];
+    std::vector<PassStatistics> statistics;
+};
+
+// Sweeps voxelizer configurations from the command line. Every configuration runs a number of warm-up frames
+// followed by measured frames, whose per-pass GPU times are taken from the GpuProfiler and written to CSV and JSON
+// together with the WorkCounters of the warm-up.
+class Benchmark
+{
+public:
+    static const uint32_t    kPassCount = 6;
+    static const char* const kPasses[kPassCount];
+
+    // Consumes the benchmark flags and leaves every other argument, program name excluded, in remaining.
+    bool parse_arguments(int argc, const char* argv[], std::vector<std::string>& remaining);
+
+    // Advances the current configuration by one frame, ready is false while the renderer is still switching
+    // to it. Returns true once the last configuration has been measured.
+    bool update(double delta, bool ready);
+    bool write_results() const;
+    void gui() const;
+
+    inline bool                   enabled() const { return m_enabled; }
+    inline bool                   finished() const { return m_config_idx == m_configs.size(); }
+    inline const BenchmarkConfig& config() const { return m_configs[m_config_idx]; }
+
+private:
+    std::vector<BenchmarkConfig> m_configs;
+    std::vector<BenchmarkResult> m_results;
+    BenchmarkResult              m_current;
+    std::string                  m_output          = "benchmark";
+    uint32_t                     m_warmup_frames   = 60;
+    uint32_t                     m_measured_frames = 240;
+    uint32_t                     m_config_idx      = 0;
+    uint32_t                     m_frame           = 0;
+    bool                         m_enabled         = false;
+};
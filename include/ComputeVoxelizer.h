@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Voxelizer.h"
+#include "Scene.h"
 
 enum ComputeVoxelizationType
 {
@@ -14,11 +15,34 @@ struct LargeTriangle
 	uint32_t inner_triangle_index;
 };
 
+// One triangle of one instance after the setup pass, see TriangleRecord in compute_voxelizer_common.h.
+struct TriangleRecord
+{
+	glm::vec4  positions[3];
+	glm::vec4  plane;
+	glm::ivec4 voxel_min;
+	glm::ivec4 voxel_max;
+	glm::uvec4 texcoords;
+};
+
 struct ComputeVoxelizerPushConstants
 {
-	glm::mat4 model;
-	int triangle_count;
+	uint32_t first_instance;
+	uint32_t first_meshlet;
+	uint32_t meshlet_count;
 	int large_triangel_threshold;
+	uint32_t first_cluster;
+};
+
+// Layout of the std140 IndirectBuffer in compute_voxelizer_common.h, each command starts on a 16 byte boundary.
+struct ComputeVoxelizerIndirectCommands
+{
+	VkDispatchIndirectCommand large_triangles;
+	uint32_t                  padding0;
+	VkDispatchIndirectCommand clusters;
+	uint32_t                  padding1;
+	uint32_t                  cluster_count;
+	uint32_t                  large_triangle_count;
 };
 
 class ComputeVoxelizer : public Voxelizer
@@ -26,15 +50,17 @@ class ComputeVoxelizer : public Voxelizer
 public:
 	ComputeVoxelizerPushConstants m_push_constants;
 
-	ComputeVoxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3 AABB_max, uint32_t voxels_per_side, const dw::vk::VertexInputStateDesc& vertex_input_state, uint32_t m_viewport_width, uint32_t m_viewport_height, std::vector<RenderObject>& objects);
+	ComputeVoxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3 AABB_max, uint32_t voxels_per_side, const dw::vk::VertexInputStateDesc& vertex_input_state, uint32_t m_viewport_width, uint32_t m_viewport_height, Scene& scene);
 	void create_voxelizer_pipeline_state(dw::vk::Backend::Ptr backend);
 	void create_large_triangle_pipeline_state(dw::vk::Backend::Ptr backend);
 
 	void begin_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend) override;
 	void begin_large_triangle_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend);
-	void voxelize(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, std::vector<RenderObject>& objects);
+	void voxelize(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Scene& scene);
 	void end_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf) override;
 
+	void report_memory(GpuMemoryReport& report) const override;
+
 	inline void set_compute_voxelization_type(ComputeVoxelizationType type) { m_compute_voxelization_type = type; }
 
 private:
@@ -42,14 +68,22 @@ private:
 	dw::vk::ComputePipeline::Ptr m_pipeline_correct_texcoords;
 	dw::vk::ComputePipeline::Ptr m_pipeline_incorrect_texcoords;
 	dw::vk::ComputePipeline::Ptr m_pipeline_large_triangle;
+	dw::vk::ComputePipeline::Ptr m_pipeline_triangle_setup;
+	dw::vk::ComputePipeline::Ptr m_pipeline_meshlet_cull;
+	dw::vk::ComputePipeline::Ptr m_pipeline_cluster_batch_prepare;
+	dw::vk::ComputePipeline::Ptr m_pipeline_large_triangles_finalize;
 	ComputeVoxelizationType m_compute_voxelization_type;
 
-	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_bindless;
-	dw::vk::DescriptorSet::Ptr	     m_ds_bindless;
-	uint32_t bindless_ds_size;
-	dw::vk::Buffer::Ptr m_bindless_buffer;
-	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_bindless_buffer;
-	dw::vk::DescriptorSet::Ptr	     m_ds_bindless_buffer;
+	// Setup, small and large triangles run once per batch of surviving clusters, so the triangle records only
+	// need to hold one batch however many instances the scene has.
+	static const uint32_t kClusterBatchSize = 8192;
+
+	// Meshlet and instance of every cluster that survived culling, the count is in the indirect buffer.
+	dw::vk::Buffer::Ptr m_cluster_buffer;
+	size_t m_cluster_buffer_size;
+	uint32_t m_cluster_batch_count;
+	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_clusters;
+	dw::vk::DescriptorSet::Ptr	     m_ds_clusters;
 
 	dw::vk::Buffer::Ptr m_indirect_compute_buffer;
 	size_t m_indirect_compute_buffer_size;
@@ -61,12 +95,20 @@ private:
 	dw::vk::DescriptorSet::Ptr m_ds_large_triangle_buffer;
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_large_triangle_buffer;
 
+	// Scene::kMeshletTriangles records per cluster of a batch, written by the setup pass and bound next to the large
+	// triangles.
+	dw::vk::Buffer::Ptr m_triangle_record_buffer;
+	size_t m_triangle_record_buffer_size;
+
 	dw::vk::PipelineLayout::Ptr m_pipeline_layout_indirect_reset;
 	dw::vk::ComputePipeline::Ptr m_pipeline_indirect_reset;
 
-	void create_descriptor_sets(dw::vk::Backend::Ptr backend, std::vector<RenderObject>& objects);
+	void create_descriptor_sets(dw::vk::Backend::Ptr backend, Scene& scene);
 	void create_indirect_reset_pipeline_state(dw::vk::Backend::Ptr backend);
 	void reset_indirect_buffer(dw::vk::CommandBuffer::Ptr cmd_buf);
 	void reset_compute_indirect_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
 	void large_triangle_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
+	void triangle_record_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
+	void cluster_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
+	void indirect_compute_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
 };
\ No newline at end of file
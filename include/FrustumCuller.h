@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <glm.hpp>
+#include <vk.h>
+#include "Scene.h"
+#include "GpuMemoryReport.h"
+
+struct FrustumCullPushConstants
+{
+    glm::vec4 planes[6];
+    uint32_t  draw_count;
+};
+
+struct FrustumCullStats
+{
+    uint32_t drawn_instances;
+    uint32_t culled_instances;
+    uint32_t drawn_triangles;
+};
+
+// Culls every instance of every draw against a view frustum on the GPU and writes a compacted
+// indirect draw list per view and frame in flight.
+class FrustumCuller
+{
+public:
+    // Allocates the descriptor sets, the pipeline comes from create_pipeline_state(), which may run on another thread.
+    FrustumCuller(dw::vk::Backend::Ptr backend, Scene& scene, uint32_t view_count);
+    void create_pipeline_state(dw::vk::Backend::Ptr backend);
+
+    void cull(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, uint32_t view, const glm::mat4& view_projection);
+    void draw(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, dw::vk::PipelineLayout::Ptr pipeline_layout, uint32_t instance_set, uint32_t view);
+    void gui(const char* const* view_names, uint32_t view_count);
+    void report_memory(GpuMemoryReport& report) const;
+
+    // Counts of the last completed frame that culled the given view.
+    inline const FrustumCullStats& stats(uint32_t view) { return m_stats[view]; }
+
+private:
+    Scene&   m_scene;
+    uint32_t m_view_count;
+    uint32_t m_draw_count;
+    uint32_t m_max_instance_count;
+
+    dw::vk::PipelineLayout::Ptr  m_pipeline_layout;
+    dw::vk::ComputePipeline::Ptr m_pipeline;
+
+    dw::vk::DescriptorSetLayout::Ptr m_ds_layout_draws;
+    dw::vk::DescriptorSetLayout::Ptr m_ds_layout_output;
+    dw::vk::DescriptorSet::Ptr       m_ds_draws;
+
+    // Draw commands with zero instances, copied over the output before every cull.
+    dw::vk::Buffer::Ptr m_cleared_draw_buffer;
+
+    // Indexed with view * kMaxFramesInFlight + frame.
+    std::vector<dw::vk::Buffer::Ptr>        m_draw_buffers;
+    std::vector<dw::vk::Buffer::Ptr>        m_draw_instance_buffers;
+    std::vector<dw::vk::Buffer::Ptr>        m_stats_buffers;
+    std::vector<dw::vk::DescriptorSet::Ptr> m_ds_output;
+    std::vector<dw::vk::DescriptorSet::Ptr> m_ds_instances;
+    std::vector<FrustumCullStats>           m_stats;
+
+    void create_buffers(dw::vk::Backend::Ptr backend);
+    void create_descriptor_sets(dw::vk::Backend::Ptr backend);
+};
@@ -1,4 +1,5 @@
 #include "Voxelizer.h"
+#include "Scene.h"
 
 class GeometryVoxelizer : public Voxelizer
 {
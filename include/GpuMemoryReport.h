@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vk.h>
+
+struct GpuMemoryEntry
+{
+    std::string  subsystem;
+    std::string  name;
+    VkDeviceSize size; // Memory requirements of the resource, including alignment padding
+};
+
+struct GpuMemorySubsystem
+{
+    std::string  name;
+    VkDeviceSize size;
+    uint32_t     resource_count;
+};
+
+// Snapshot of the device memory held by every subsystem. Subsystems add their resources between begin() and end(),
+// end() then takes the totals from VMA so that whatever nobody claimed shows up as unattributed. Resources are
+// sized with their memory requirements, the same number VMA allocates for them.
+class GpuMemoryReport
+{
+public:
+    void begin(dw::vk::Backend::Ptr backend);
+    void end();
+
+    // Null resources are skipped, so that optional buffers can be passed unconditionally.
+    void add(const std::string& subsystem, const std::string& name, dw::vk::Buffer::Ptr buffer);
+    void add(const std::string& subsystem, const std::string& name, dw::vk::Image::Ptr image);
+    void add(const std::string& subsystem, const std::string& name, VkDeviceSize size);
+
+    // Subsystems in the order they were first added.
+    std::vector<GpuMemorySubsystem> subsystems() const;
+
+    bool write_json(const std::string& path) const;
+    void gui();
+
+    inline const std::vector<GpuMemoryEntry>& entries() const { return m_entries; }
+    inline VkDeviceSize                       attributed_bytes() const { return m_attributed_bytes; }
+    inline VkDeviceSize                       used_bytes() const { return m_used_bytes; }
+    inline VkDeviceSize                       unused_bytes() const { return m_unused_bytes; }
+    inline uint32_t                           allocation_count() const { return m_allocation_count; }
+
+    // Used bytes VMA knows about that no subsystem claimed, such as the framework's swapchain and depth buffers.
+    inline VkDeviceSize unattributed_bytes() const { return m_used_bytes > m_attributed_bytes ? m_used_bytes - m_attributed_bytes : 0; }
+
+private:
+    dw::vk::Backend::Ptr        m_backend;
+    std::vector<GpuMemoryEntry> m_entries;
+    VkDeviceSize                m_attributed_bytes = 0;
+    VkDeviceSize                m_used_bytes       = 0;
+    VkDeviceSize                m_unused_bytes     = 0; // Free space inside blocks VMA has allocated
+    uint32_t                    m_allocation_count = 0;
+    uint32_t                    m_block_count      = 0;
+};
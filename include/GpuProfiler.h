@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vk.h>
+#include <profiler.h>
+#include "TraceRecorder.h"
+
+enum GpuQueue
+{
+    GPU_QUEUE_GRAPHICS,
+    GPU_QUEUE_COMPUTE,
+    GPU_QUEUE_COUNT
+};
+
+struct GpuSample
+{
+    std::string name;
+    uint32_t    queue;
+    uint32_t    depth;
+    double      start_ms;
+    double      end_ms;
+};
+
+// Timestamp queries around the same scopes the framework profiler shows, kept per frame in flight so the
+// results can be read back without stalling. Unlike dw::profiler the timings are accessible to the
+// application, which the benchmark mode needs. Samples are only recorded from the main thread.
+class GpuProfiler
+{
+public:
+    // Per queue and frame in flight, samples beyond it are dropped. The compute voxelizer takes three per batch.
+    static const uint32_t kMaxSamples = 256;
+
+    static GpuProfiler& get();
+
+    void initialize(dw::vk::Backend::Ptr backend);
+    void shutdown();
+
+    // Reads back the frame that last used the current frame slot and hands its samples to the TraceRecorder,
+    // call once per frame after TraceRecorder::begin_frame() and before recording.
+    void begin_frame();
+
+    // Directs the following samples to the queries of the given queue. The first call for a queue in a frame
+    // also resets them, so it has to be made outside of a render pass and before any other command buffer of
+    // that queue in submission order.
+    void begin_command_buffer(dw::vk::CommandBuffer::Ptr cmd_buf, GpuQueue queue);
+
+    void begin_sample(const std::string& name, dw::vk::CommandBuffer::Ptr cmd_buf);
+    void end_sample(dw::vk::CommandBuffer::Ptr cmd_buf);
+
+    // Samples of the last frame read back, in the order they were begun. Samples whose queries were not
+    // available yet, e.g. a voxelization still running on the compute queue, are left out.
+    inline const std::vector<GpuSample>& samples() const { return m_samples; }
+
+    // Total time of every sample with the given name in the last frame read back, negative if there is none.
+    double sample_ms(const std::string& name) const;
+
+    // Offset from GPU timestamps to TraceRecorder time, measured with a timestamp written by an otherwise idle
+    // graphics queue. Waits for the graphics queue to go idle.
+    double calibrate();
+
+private:
+    struct PendingSample
+    {
+        std::string name;
+        uint32_t    queue;
+        uint32_t    depth;
+        uint32_t    query;
+    };
+
+    struct Frame
+    {
+        VkQueryPool                query_pools[GPU_QUEUE_COUNT];
+        uint32_t                   query_counts[GPU_QUEUE_COUNT];
+        bool                       reset[GPU_QUEUE_COUNT];
+        uint64_t                   trace_frame;
+        std::vector<PendingSample> pending;
+    };
+
+    dw::vk::Backend::Ptr   m_backend;
+    std::vector<Frame>     m_frames;
+    VkQueryPool            m_calibration_query_pool = VK_NULL_HANDLE;
+    std::vector<GpuSample> m_samples;
+    std::vector<int32_t>   m_open_samples;
+    uint32_t               m_frame_idx                    = 0;
+    uint32_t               m_active_queue                 = GPU_QUEUE_COUNT;
+    bool                   m_queue_valid[GPU_QUEUE_COUNT] = {};
+    double                 m_timestamp_period_ms          = 0.0;
+};
+
+// Records the lifetime of the object as one GpuProfiler sample and, for the time spent recording it, as a
+// CPU trace event.
+class ScopedGpuSample
+{
+public:
+    inline ScopedGpuSample(const std::string& name, dw::vk::CommandBuffer::Ptr cmd_buf) :
+        m_trace_event(name), m_cmd_buf(cmd_buf) { GpuProfiler::get().begin_sample(name, cmd_buf); }
+
+    inline ~ScopedGpuSample() { GpuProfiler::get().end_sample(m_cmd_buf); }
+
+private:
+    ScopedTraceEvent           m_trace_event;
+    dw::vk::CommandBuffer::Ptr m_cmd_buf;
+};
+
+// DW_SCOPED_SAMPLE that also records the scope with the GpuProfiler and the TraceRecorder.
+#define VCT_SCOPED_SAMPLE(name, cmd_buf) \
+    DW_SCOPED_SAMPLE(name, cmd_buf);     \
+    ScopedGpuSample scoped_gpu_sample(name, cmd_buf)
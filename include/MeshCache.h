@@ -0,0 +1,116 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <glm.hpp>
+
+// Vertex layout of the raster passes, see Scene::vertex_input_state_desc(). The compute voxelizer reads a compact copy.
+struct MeshCacheVertex
+{
+    glm::vec4 position;
+    glm::vec4 texcoord;
+    glm::vec4 normal;
+    glm::vec4 tangent;
+    glm::vec4 bitangent;
+};
+
+// Range of triangles sharing a material, sorted along a Morton curve through their centroids.
+struct MeshCacheSubmesh
+{
+    uint32_t  first_index;
+    uint32_t  index_count;
+    uint32_t  material;
+    uint32_t  padding;
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// RGBA8 albedo of a material with its full mip chain stored contiguously, mip 0 first.
+// A width of 0 means the material has no albedo texture.
+struct MeshCacheTexture
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    uint32_t padding;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+struct MeshCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_size;
+    int64_t  source_time;
+
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t submesh_count;
+    uint32_t texture_count;
+
+    // Byte offsets from the start of the file, every section is 16 byte aligned.
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    uint64_t submesh_offset;
+    uint64_t texture_offset;
+    uint64_t file_size;
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    void close();
+
+    inline const uint8_t* data() const { return m_data; }
+    inline size_t         size() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* m_data = nullptr;
+    size_t         m_size = 0;
+#if defined(_WIN32)
+    void* m_file    = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
+
+// Preprocessed mesh laid out so that it can be mapped and copied into a staging buffer as is. Built from the
+// source model with Assimp on the first load and rebuilt whenever the source file changes.
+class MeshCache
+{
+public:
+    static const uint32_t kMagic   = 0x48435456; // "VTCH"
+    static const uint32_t kVersion = 3;
+
+    static std::shared_ptr<MeshCache> load(const std::string& source_path);
+    static std::string                cache_path(const std::string& source_path);
+
+    inline const MeshCacheHeader&  header() const { return *reinterpret_cast<const MeshCacheHeader*>(m_file.data()); }
+    inline const MeshCacheVertex*  vertices() const { return section<MeshCacheVertex>(header().vertex_offset); }
+    inline const uint32_t*         indices() const { return section<uint32_t>(header().index_offset); }
+    inline const MeshCacheSubmesh* submeshes() const { return section<MeshCacheSubmesh>(header().submesh_offset); }
+    inline const MeshCacheTexture* textures() const { return section<MeshCacheTexture>(header().texture_offset); }
+    inline const uint8_t*          texture_data(const MeshCacheTexture& texture) const { return m_file.data() + texture.data_offset; }
+
+    // True if the cache had to be rebuilt from the source model.
+    inline bool built() const { return m_built; }
+
+private:
+    template <typename T>
+    inline const T* section(uint64_t offset) const { return reinterpret_cast<const T*>(m_file.data() + offset); }
+
+    static bool build(const std::string& source_path, const std::string& cache_path, uint64_t source_size, int64_t source_time);
+    bool        validate(uint64_t source_size, int64_t source_time) const;
+
+    MappedFile m_file;
+    bool       m_built = false;
+};
@@ -15,6 +15,10 @@ public:
     float scale;
     dw::Mesh::Ptr mesh;
     dw::vk::DescriptorSet::Ptr m_ds_vertex_index;
+    uint32_t first_instance;
+    uint32_t instance_count;
+    uint32_t first_triangle;
+    uint32_t triangle_count;
 
     static void initialize_common_resources(dw::vk::Backend::Ptr backend);
     static dw::vk::DescriptorSetLayout::Ptr get_ds_layout_vertex_index();
@@ -24,7 +28,11 @@ public:
         position(glm::vec3(0.0f, 0.0f, 0.0f)),
         rotation(glm::angleAxis(0.0f, glm::vec3(0.0f, 1.0f, 0.0f))),
         scale(1.0f),
-        mesh(mesh) {
+        mesh(mesh),
+        first_instance(0),
+        instance_count(1),
+        first_triangle(0),
+        triangle_count(0) {
 
         m_ds_vertex_index = backend->allocate_descriptor_set(get_ds_layout_vertex_index());
 
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm.hpp>
+#include <vk.h>
+#include "RendererObject.h"
+#include "MeshCache.h"
+#include "GpuMemoryReport.h"
+
+// Per instance data
+struct SceneInstance
+{
+    DW_ALIGNED(16)
+        glm::mat4 model;
+};
+
+// One entry per instance of every draw, indexed with gl_InstanceIndex.
+struct SceneDrawInstance
+{
+    uint32_t instance;
+    uint32_t material;
+};
+
+// Object space bounds of a draw, used for culling.
+struct SceneDrawBounds
+{
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// Run of at most kMeshletTriangles consecutive triangles of one draw with its object space bounds, the unit the
+// compute voxelizer culls against the voxel grid. first_triangle addresses the merged index buffer.
+struct SceneMeshlet
+{
+    uint32_t  first_triangle;
+    uint32_t  triangle_count;
+    uint32_t  mesh;
+    uint32_t  material;
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// Compact vertex read by the compute voxelizer, 12 bytes instead of the 80 of MeshCacheVertex. The position is
+// unorm16 relative to the bounds of its mesh and the texcoord is half precision, normals and tangents are dropped.
+struct SceneVoxelVertex
+{
+    uint32_t position_xy;
+    uint32_t position_z;
+    uint32_t texcoord;
+};
+
+// Maps unorm16 positions of a mesh back to object space: position = offset + quantized * scale.
+struct SceneMeshQuantization
+{
+    glm::vec4 offset;
+    glm::vec4 scale;
+};
+
+// A unique mesh of the scene, the instances of a mesh are stored contiguously.
+struct SceneMesh
+{
+    std::string                path;
+    std::shared_ptr<MeshCache> cache;
+    uint32_t                   first_instance;
+    uint32_t                   instance_count;
+    uint32_t                   first_triangle;
+    uint32_t                   triangle_count;
+    uint32_t                   first_draw;
+    uint32_t                   draw_count;
+    uint32_t                   first_texture;
+    uint32_t                   first_meshlet;
+    uint32_t                   meshlet_count;
+};
+
+class Scene
+{
+public:
+    std::vector<SceneMesh>     meshes;
+    std::vector<SceneInstance> instances;
+
+    dw::vk::Buffer::Ptr        m_instance_buffer;
+    dw::vk::Buffer::Ptr        m_draw_instance_buffer;
+    dw::vk::DescriptorSet::Ptr m_ds_instances;
+
+    // Geometry of all unique meshes merged into one vertex and one index buffer, indices are global.
+    dw::vk::Buffer::Ptr m_vertex_buffer;
+    dw::vk::Buffer::Ptr m_index_buffer;
+
+    // Voxelization stream, parallel to m_vertex_buffer and addressed with the same indices. The set binds the
+    // compact vertices, the merged indices, the per mesh quantization and the meshlets.
+    dw::vk::Buffer::Ptr        m_voxel_vertex_buffer;
+    dw::vk::Buffer::Ptr        m_mesh_quantization_buffer;
+    dw::vk::DescriptorSet::Ptr m_ds_voxel_geometry;
+
+    // One indirect draw per submesh of every unique mesh.
+    std::vector<VkDrawIndexedIndirectCommand> m_draw_commands;
+    std::vector<SceneDrawBounds>              m_draw_bounds;
+    dw::vk::Buffer::Ptr                       m_indirect_buffer;
+    dw::vk::Buffer::Ptr                       m_draw_bounds_buffer;
+
+    // Bindless material table with one albedo texture per unique material, shared by the raster passes and the
+    // compute voxelizer. m_draw_materials holds the table index of every draw.
+    std::vector<VkDescriptorImageInfo> m_material_image_infos;
+    std::vector<uint32_t>              m_draw_materials;
+    dw::vk::DescriptorSet::Ptr         m_ds_materials;
+
+    // Meshlets of every mesh, a mesh's meshlets are SceneMesh::first_meshlet .. first_meshlet + meshlet_count.
+    static const uint32_t     kMeshletTriangles = 64;
+    std::vector<SceneMeshlet> m_meshlets;
+    dw::vk::Buffer::Ptr       m_meshlet_buffer;
+
+    static void initialize_common_resources(dw::vk::Backend::Ptr backend);
+    static dw::vk::DescriptorSetLayout::Ptr get_ds_layout_instances();
+    static dw::vk::DescriptorSetLayout::Ptr get_ds_layout_materials();
+    static dw::vk::DescriptorSetLayout::Ptr get_ds_layout_voxel_geometry();
+    static void reset_ds_layout_instances();
+
+    // Layout of MeshCacheVertex, shared by every pipeline that draws the scene.
+    static const dw::vk::VertexInputStateDesc& vertex_input_state_desc();
+
+    // Loading is split so that the CPU side can run on a worker while the renderer sets up everything else.
+    // read() parses the scene file and maps or builds the mesh caches, create_gpu_resources() uploads them.
+    static std::unique_ptr<Scene> read(const std::string& path);
+    void                          create_gpu_resources(dw::vk::Backend::Ptr backend);
+
+    // Draws with the given indirect buffer, or the unculled draw list if none is given.
+    void draw(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Buffer::Ptr indirect_buffer = nullptr);
+    void reset();
+
+    // Geometry and draw buffers go to "Meshes", the albedo textures to "Textures".
+    void report_memory(GpuMemoryReport& report) const;
+
+    inline bool multi_draw_indirect() const { return m_multi_draw_indirect; }
+
+private:
+    bool m_multi_draw_indirect = false;
+
+    // Albedo textures of every mesh, indexed with SceneMesh::first_texture + material. Null for materials without one.
+    std::vector<dw::vk::Image::Ptr>     m_textures;
+    std::vector<dw::vk::ImageView::Ptr> m_texture_views;
+    dw::vk::Image::Ptr                  m_default_texture;
+    dw::vk::ImageView::Ptr              m_default_texture_view;
+    dw::vk::Sampler::Ptr                m_sampler;
+
+    void upload_geometry_and_textures(dw::vk::Backend::Ptr backend);
+    void create_geometry_descriptor_set(dw::vk::Backend::Ptr backend);
+    void create_draw_buffers(dw::vk::Backend::Ptr backend);
+    void create_material_table(dw::vk::Backend::Ptr backend);
+    void create_meshlets(dw::vk::Backend::Ptr backend);
+    void create_instance_buffer(dw::vk::Backend::Ptr backend);
+};
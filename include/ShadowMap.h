@@ -1,11 +1,20 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <ogl.h>
 #include <glm.hpp>
 #include <vk.h>
 #include <material.h>
 #include "util.h"
+#include "Scene.h"
+#include "GpuMemoryReport.h"
+
+enum ShadowMapMode
+{
+    SHADOW_MAP_SINGLE,
+    SHADOW_MAP_CASCADED
+};
 
 struct TransformsShadow
 {
@@ -17,11 +26,16 @@ struct TransformsShadow
 
 class ShadowMap
 {
+public:
+    static const uint32_t kMaxCascades = 4;
+
 private:
-    dw::vk::Image::Ptr       m_image;
-    dw::vk::ImageView::Ptr   m_image_view;
-    dw::vk::Framebuffer::Ptr m_framebuffer;
-    dw::vk::RenderPass::Ptr  m_render_pass;
+    // One layer per cascade, the single map mode uses one layer.
+    dw::vk::Image::Ptr                    m_image;
+    dw::vk::ImageView::Ptr                m_image_view;
+    std::vector<dw::vk::ImageView::Ptr>   m_layer_image_views;
+    std::vector<dw::vk::Framebuffer::Ptr> m_framebuffers;
+    dw::vk::RenderPass::Ptr               m_render_pass;
 
     size_t m_ubo_size;
     TransformsShadow m_transforms;
@@ -36,6 +50,18 @@ private:
     float     m_far_plane = 1000.0f;
     float     m_backoff_distance = 200.0f;
     uint32_t  m_size = 1024;
+
+    // Cascades
+    ShadowMapMode m_mode                 = SHADOW_MAP_SINGLE;
+    uint32_t      m_cascade_count        = 1;
+    float         m_cascade_distance     = 3000.0f;
+    float         m_cascade_split_lambda = 0.75f;
+    glm::mat4     m_cascade_view_projections[kMaxCascades];
+    float         m_cascade_splits[kMaxCascades];
+
+    // Light transform each layer was last rendered with.
+    bool      m_cascade_valid[kMaxCascades] = {};
+    glm::mat4 m_rendered_view_projections[kMaxCascades];
     
     // Constant depth bias factor (always applied)
     float depthBiasConstant = 1.25f;
@@ -43,7 +69,6 @@ private:
     float depthBiasSlope = 1.75f;
 
     void create_descriptor_sets(dw::vk::Backend::Ptr backend);
-    void create_pipeline_state(dw::vk::Backend::Ptr backend, const dw::vk::VertexInputStateDesc& vertex_input_state);
 
 
 public:
@@ -60,12 +85,20 @@ public:
     void update();
     float     m_extents = 75.0f;
 
-    ShadowMap(dw::vk::Backend::Ptr backend, uint32_t m_size, const dw::vk::VertexInputStateDesc& vertex_input_state);
+    // Only re-render a layer when its light transform changed, the scene's casters never move.
+    bool m_cache_enabled = true;
+
+    // Allocates the descriptor sets, the pipeline comes from create_pipeline_state(), which may run on another thread.
+    ShadowMap(dw::vk::Backend::Ptr backend, uint32_t m_size, ShadowMapMode mode = SHADOW_MAP_SINGLE, uint32_t cascade_count = 1);
     ~ShadowMap();
-    void begin_render(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend);
+    void create_pipeline_state(dw::vk::Backend::Ptr backend, const dw::vk::VertexInputStateDesc& vertex_input_state);
+    void update_cascades(const glm::mat4& camera_view, float fov, float aspect_ratio, float near_plane, float far_plane);
+    bool needs_render(uint32_t cascade = 0);
+    void begin_render(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, uint32_t cascade = 0);
     void end_render(dw::vk::CommandBuffer::Ptr cmd_buf);
 
     void gui();
+    void report_memory(GpuMemoryReport& report) const;
     void set_direction(const glm::vec3& d);
     void set_target(const glm::vec3& t);
     void set_color(const glm::vec3& c);
@@ -79,7 +112,7 @@ public:
         return m_image;
     };
     inline dw::vk::ImageView::Ptr   image_view() { return m_image_view; }
-    inline dw::vk::Framebuffer::Ptr framebuffer() { return m_framebuffer; }
+    inline dw::vk::Framebuffer::Ptr framebuffer(uint32_t cascade = 0) { return m_framebuffers[cascade]; }
     inline dw::vk::RenderPass::Ptr  render_pass() { return m_render_pass; }
 
     inline glm::vec3 direction() { return m_light_direction; }
@@ -91,4 +124,10 @@ public:
     inline float     backoff_distance() { return m_backoff_distance; }
     inline glm::mat4 view() { return m_view; }
     inline glm::mat4 projection() { return m_projection; }
+
+    inline ShadowMapMode mode() { return m_mode; }
+    inline uint32_t      cascade_count() { return m_cascade_count; }
+    inline glm::mat4     cascade_view_projection(uint32_t cascade) { return m_cascade_view_projections[cascade]; }
+    // View space depth at which the cascade ends.
+    inline float         cascade_split(uint32_t cascade) { return m_cascade_splits[cascade]; }
 };
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TraceRecorder.h"
+
+struct StartupPhase
+{
+    std::string name;
+    uint32_t    thread;
+    double      start_ms;
+    double      end_ms;
+};
+
+// Start and end of every init phase relative to the start of VCTRenderer::init, recorded from any thread.
+class StartupTimeline
+{
+public:
+    static StartupTimeline& get();
+
+    // Phases are only recorded between begin() and end(), later voxelizer rebuilds don't show up.
+    void begin();
+    void end();
+    void record(const std::string& name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end);
+    void log();
+    void gui();
+
+private:
+    std::chrono::high_resolution_clock::time_point m_origin = std::chrono::high_resolution_clock::now();
+    std::vector<StartupPhase>                      m_phases;
+    std::vector<std::thread::id>                   m_threads;
+    std::mutex                                     m_mutex;
+    bool                                           m_recording = false;
+};
+
+// Records the lifetime of the object as one phase of the startup timeline and as a CPU trace event.
+class ScopedStartupPhase
+{
+public:
+    inline ScopedStartupPhase(const std::string& name) :
+        m_name(name), m_start(std::chrono::high_resolution_clock::now()) {}
+
+    inline ~ScopedStartupPhase()
+    {
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+        StartupTimeline::get().record(m_name, m_start, end);
+        TraceRecorder::get().record_cpu(m_name, m_start, end);
+    }
+
+private:
+    std::string                                    m_name;
+    std::chrono::high_resolution_clock::time_point m_start;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs from a shared queue. Threads waiting on a parallel_for help run
+// queued jobs, so jobs may start nested parallel_for calls without deadlocking the pool.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(uint32_t worker_count);
+    ~ThreadPool();
+
+    // Shared pool with one worker per hardware thread minus the main thread.
+    static ThreadPool& global();
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> submit(F job)
+    {
+        typedef typename std::result_of<F()>::type Result;
+
+        auto task   = std::make_shared<std::packaged_task<Result()>>(job);
+        auto future = task->get_future();
+
+        push([task]() { (*task)(); });
+
+        return future;
+    }
+
+    // Runs job(0) .. job(count - 1) on the pool and the calling thread, returns once all of them have finished.
+    void parallel_for(uint32_t count, const std::function<void(uint32_t)>& job);
+
+    inline uint32_t worker_count() const { return m_workers.size(); }
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void push(std::function<void()> job);
+    bool run_one();
+    void worker();
+
+    std::vector<std::thread>          m_workers;
+    std::deque<std::function<void()>> m_jobs;
+    std::mutex                        m_mutex;
+    std::condition_variable           m_condition;
+    bool                              m_stop = false;
+};
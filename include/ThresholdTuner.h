@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "ComputeVoxelizer.h"
+
+struct ThresholdCacheEntry
+{
+    std::string scene;
+    uint32_t    resolution;
+    int         threshold;
+    double      ms; // Mean "Small Triangles" + "Large Triangles" time at the threshold
+};
+
+struct ThresholdMeasurement
+{
+    int    threshold;
+    double ms; // Negative if no voxelization was timed
+};
+
+// Searches the compute voxelizer's large triangle threshold that minimizes the GPU time of the "Small Triangles"
+// and "Large Triangles" passes, and remembers the best one per scene and grid resolution in a JSON cache file. A
+// doubling sweep over kCoarseThresholds is followed by halving the gaps on either side of the best threshold
+// until they are closed.
+class ThresholdTuner
+{
+public:
+    static const uint32_t kCoarseThresholdCount = 10;
+    static const int      kCoarseThresholds[kCoarseThresholdCount];
+    static const uint32_t kMaxRefinements = 8;
+
+    // Reads the cache, a missing file is an empty cache. Later saves go to the same path.
+    bool load_cache(const std::string& path);
+    bool save_cache() const;
+
+    // Threshold tuned for the scene and resolution, false if there is none.
+    bool find(const std::string& scene, uint32_t resolution, int& threshold) const;
+
+    void start(const std::string& scene, uint32_t resolution, uint32_t samples = 30);
+    void cancel();
+
+    // Call once per frame while running with the voxelizer in use, whose resolution must be the tuned one. ready
+    // is false while the renderer is switching voxelizers, which restarts the current measurement. Returns true
+    // once the search is done, the best threshold is then set on the voxelizer and saved to the cache.
+    bool update(ComputeVoxelizer& voxelizer, bool ready);
+    void gui() const;
+
+    inline bool     running() const { return m_running; }
+    inline uint32_t resolution() const { return m_resolution; }
+
+private:
+    std::vector<ThresholdCacheEntry>  m_cache;
+    std::string                       m_cache_path;
+    std::vector<ThresholdMeasurement> m_measurements;
+    std::string                       m_scene;
+    uint32_t                          m_resolution  = 0;
+    uint32_t                          m_samples     = 30;
+    int                               m_threshold   = 0;
+    uint32_t                          m_refinements = 0;
+    uint32_t                          m_frame       = 0;
+    uint32_t                          m_count       = 0;
+    double                            m_total_ms    = 0.0;
+    bool                              m_running     = false;
+
+    const ThresholdMeasurement* best() const;
+    bool                        next_threshold();
+    void                        finish(ComputeVoxelizer& voxelizer);
+};
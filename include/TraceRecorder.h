@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TraceEvent
+{
+    std::string name;
+    uint32_t    thread; // CPU thread index, or GpuQueue for GPU events
+    double      start_ms;
+    double      end_ms;
+};
+
+struct TraceFrame
+{
+    uint64_t                index;
+    std::vector<TraceEvent> cpu_events;
+    std::vector<TraceEvent> gpu_events; // In GPU timestamp time, converted on export
+};
+
+// Ring buffer of the CPU and GPU timing scopes of the last kFrameCount frames, which can be written out as
+// Chrome trace event JSON (chrome://tracing, Perfetto). CPU events are recorded from any thread, events
+// recorded before the first frame are kept separately so that the startup shows up in every trace.
+class TraceRecorder
+{
+public:
+    static const uint32_t kFrameCount = 300;
+
+    static TraceRecorder& get();
+
+    // Milliseconds since the recorder was created, the time base of every CPU event.
+    double now_ms() const;
+
+    void     begin_frame();
+    uint64_t current_frame();
+    void     record_cpu(const std::string& name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end);
+    void     record_gpu(uint64_t frame, const std::string& name, uint32_t queue, double start_ms, double end_ms);
+
+    // gpu_offset_ms is added to GPU timestamps to move them onto the CPU time base, see GpuProfiler::calibrate().
+    bool write_chrome_trace(const std::string& path, double gpu_offset_ms);
+
+private:
+    std::chrono::high_resolution_clock::time_point m_origin = std::chrono::high_resolution_clock::now();
+    std::vector<TraceEvent>                        m_startup_events;
+    std::vector<TraceFrame>                        m_frames;
+    std::vector<std::thread::id>                   m_threads;
+    uint64_t                                       m_frame_index = 0;
+    std::mutex                                     m_mutex;
+
+    TraceFrame* find_frame(uint64_t frame);
+};
+
+// Records the lifetime of the object as a CPU trace event.
+class ScopedTraceEvent
+{
+public:
+    inline ScopedTraceEvent(const std::string& name) :
+        m_name(name), m_start(std::chrono::high_resolution_clock::now()) {}
+
+    inline ~ScopedTraceEvent() { TraceRecorder::get().record_cpu(m_name, m_start, std::chrono::high_resolution_clock::now()); }
+
+private:
+    std::string                                    m_name;
+    std::chrono::high_resolution_clock::time_point m_start;
+};
@@ -15,14 +15,50 @@
 #include "util.h"
 #include "GeometryVoxelizer.h"
 #include "ComputeVoxelizer.h"
+#include "Scene.h"
+#include "FrustumCuller.h"
+#include "StartupTimeline.h"
+#include "ThreadPool.h"
+#include "GpuProfiler.h"
+#include "WorkCounters.h"
+#include "Benchmark.h"
+#include "VoxelGridReadback.h"
+#include "VoxelGridExporter.h"
+#include "GpuMemoryReport.h"
+#include "ThresholdTuner.h"
+#include "VoxelRayMarcher.h"
+#include "VoxelSurfaceExtractor.h"
+#include <array>
+#include <future>
+#include <deque>
+#include <chrono>
+
+// Views that get their own culled draw list, one per shadow cascade.
+enum CullView
+{
+    CULL_VIEW_MAIN,
+    CULL_VIEW_SHADOW,
+    CULL_VIEW_COUNT = CULL_VIEW_SHADOW + ShadowMap::kMaxCascades,
+    CULL_VIEW_NONE  = CULL_VIEW_COUNT
+};
+
+// How the voxel grid is drawn while the voxelization visualization is enabled.
+enum VoxelVisualizationMode
+{
+    VOXEL_VISUALIZATION_CUBES,
+    VOXEL_VISUALIZATION_RAY_MARCH,
+    VOXEL_VISUALIZATION_SURFACE
+};
 
 // Uniform buffer data structures.
 struct TransformsMain
 {
         glm::mat4 view;
         glm::mat4 projection;
-        glm::mat4 lightSpaceMatrix;
+        glm::mat4 lightSpaceMatrix[ShadowMap::kMaxCascades];
         glm::vec4 camera_pos;
+        glm::vec4 cascade_splits;
+        uint32_t  cascade_count;
 };
 
 struct Light
@@ -39,10 +75,22 @@ struct Lights
 	Light lights[1];
 };
 
+// Voxelizer replaced by a background rebuild, kept alive until its last frame in flight has finished.
+struct RetiredVoxelizer
+{
+    std::shared_ptr<Voxelizer>    voxelizer;
+    dw::vk::PipelineLayout::Ptr   pipeline_layout_main;
+    dw::vk::GraphicsPipeline::Ptr graphics_pipeline_main;
+    uint64_t                      last_frame;
+};
+
 class VCTRenderer : public dw::Application
 {
 protected:
-    void create_voxelizer();
+    // Sets bound by the largest pipeline layouts, checked against the device at startup.
+    static const uint32_t kMaxBoundDescriptorSets = 8;
+
+    std::shared_ptr<Voxelizer> create_voxelizer(VoxelizationType type, uint32_t resolution);
     bool init(int argc, const char* argv[]) override;
     void update(double delta) override;
     void shutdown() override;
@@ -60,18 +108,39 @@ protected:
     void create_descriptor_set_layouts();
     inline void create_descriptor_sets();
     void write_descriptor_sets();
-    void create_main_pipeline_state();
+    void create_main_pipeline_state(std::shared_ptr<Voxelizer> voxelizer, dw::vk::PipelineLayout::Ptr& pipeline_layout, dw::vk::GraphicsPipeline::Ptr& pipeline);
 
-    bool load_object(std::string filename);
-    bool        load_objects();
+    bool        load_objects(std::future<std::unique_ptr<Scene>>& scene_read);
     bool load_cube();
     inline void create_camera();
 
-    void render_objects(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::PipelineLayout::Ptr pipeline_layout);
+    void render_objects(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::PipelineLayout::Ptr pipeline_layout, uint32_t instance_set, uint32_t cull_view);
+    bool frustum_culling_available();
+    void culling_ui();
     void begin_render_main(dw::vk::CommandBuffer::Ptr cmd_buf);
     void revoxelize(int resolution);
     void revoxelize(VoxelizationType type);
+    void request_voxelizer_rebuild();
+    void swap_pending_voxelizer();
+    void record_frame_time(double delta);
+    void update_benchmark(double delta);
+    void update_threshold_tuner();
+    bool apply_tuned_threshold(Voxelizer* voxelizer);
+    void export_trace();
+    void voxel_grid_comparison_ui();
+    bool read_back_current_grid(VoxelGrid& grid);
+    void compare_with_reference_grid();
+    void update_memory_report();
+    void memory_report_ui();
     void render(dw::vk::CommandBuffer::Ptr cmd_buf);
+    void render_shadow_map(dw::vk::CommandBuffer::Ptr cmd_buf);
+    void voxelize(dw::vk::CommandBuffer::Ptr cmd_buf, VkPipelineStageFlags grid_stage_mask);
+    void render_main(dw::vk::CommandBuffer::Ptr cmd_buf, bool grid_voxelized);
+    bool async_voxelization_available();
+    bool submit_async_voxelization(dw::vk::CommandBuffer::Ptr shadow_cmd_buf);
+    void flip_async_grid(uint32_t compute_frame_idx);
+    void drain_async_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf);
+    void submit_and_present_main(dw::vk::CommandBuffer::Ptr cmd_buf);
     void update_uniforms(dw::vk::CommandBuffer::Ptr cmd_buf);
     void update_camera();
 
@@ -110,11 +179,17 @@ protected:
     // Camera 
     float m_camera_x;
     float m_camera_y;
-    float m_far = 10000.0f;
+    float m_far         = 10000.0f;
+    float m_camera_fov  = 60.0f;
+    float m_camera_near = 0.1f;
 
     // Assets.
-    std::vector<dw::Mesh::Ptr> m_meshes;
-    std::vector<RenderObject>  objects;
+    std::unique_ptr<Scene> m_scene;
+    std::string            m_scene_path = "scenes/sponza.json";
+
+    // Frustum culling
+    std::unique_ptr<FrustumCuller> m_frustum_culler;
+    bool                           m_frustum_culling_enabled = true;
     
     // Uniforms.
     TransformsMain m_transforms_main;
@@ -123,6 +198,9 @@ protected:
     // Shadow map
     std::unique_ptr<ShadowMap> m_shadow_map;
     float m_shadow_map_size = 10000.0f;
+    ShadowMapMode m_shadow_map_mode      = SHADOW_MAP_CASCADED;
+    uint32_t      m_shadow_cascade_count = 4;
+    uint32_t      m_shadow_cascade_size  = 1536;
     VoxelizationType m_voxelization_type = VoxelizationType::COMPUTE_SHADER_VOXELIZATION;
 
     // Debug draw
@@ -135,5 +213,68 @@ protected:
     std::shared_ptr<Voxelizer> m_voxelizer;
     uint32_t m_voxelization_resolution = 64;
     std::vector<dw::vk::Fence::Ptr> m_compute_fences;
+
+    // Async compute voxelization. The compute queue writes one grid of the voxelizer while the main pass samples the
+    // other, the grids are flipped once the compute fence has signaled.
+    bool m_async_compute_enabled = true;
+    std::vector<dw::vk::Semaphore::Ptr> m_voxelization_finished_semaphores;
+    std::vector<dw::vk::Semaphore::Ptr> m_grid_consumed_semaphores;
+    dw::vk::Semaphore::Ptr              m_pending_grid_consumed_semaphore; // Signaled, not yet waited on by a voxelization
+    std::vector<dw::vk::Semaphore::Ptr> m_grid_semaphores;                 // Voxelizations the next graphics submission waits on
+    bool     m_compute_fence_pending   = false;
+    uint32_t m_last_compute_frame_idx  = 0;
+    bool     m_force_voxelization      = true;
+    int      m_grid_thresholds[Voxelizer::kGridCount] = {}; // Large triangle threshold each grid was voxelized with
+
+    // Background voxelizer rebuild
+    std::future<void>             m_voxelizer_build;
+    bool                          m_voxelizer_rebuild_requested = false;
+    std::shared_ptr<Voxelizer>    m_pending_voxelizer;
+    dw::vk::PipelineLayout::Ptr   m_pending_pipeline_layout_main;
+    dw::vk::GraphicsPipeline::Ptr m_pending_graphics_pipeline_main;
+    std::deque<RetiredVoxelizer>  m_retired_voxelizers;
+    uint64_t                      m_frame_count = 0;
+    std::chrono::high_resolution_clock::time_point m_voxelizer_build_start;
+
+    // Frame time trace
+    std::array<float, 256> m_frame_times    = {};
+    uint32_t               m_frame_time_idx = 0;
+    float                  m_longest_frame_during_switch = 0.0f;
+
     bool m_voxelization_visualization_enabled = false;
+
+    int m_voxel_visualization_mode = VOXEL_VISUALIZATION_CUBES;
+
+    // Ray marched voxel visualization
+    std::unique_ptr<VoxelRayMarcher> m_voxel_ray_marcher;
+    int                              m_voxel_ray_march_mip = 0;
+
+    // Voxel surface visualization, the faces are extracted again when the voxelizer or its threshold change.
+    std::unique_ptr<VoxelSurfaceExtractor> m_voxel_surface_extractor;
+    std::weak_ptr<Voxelizer>               m_voxel_surface_voxelizer;
+    int                                    m_voxel_surface_threshold = 0;
+
+    // Benchmark mode, the shadow map cache is off for the sweep so that every sample pays for the shadow pass.
+    Benchmark m_benchmark;
+    bool      m_benchmark_started            = false;
+    bool      m_benchmark_shadow_cache_saved = true;
+
+    // Chrome trace export
+    std::string m_trace_path = "trace.json";
+
+    // Voxel grid comparison
+    VoxelGrid                           m_reference_grid;
+    std::vector<VoxelGridMipComparison> m_grid_comparisons;
+    int                                 m_grid_slice_mip = 0;
+
+    // Voxel grid export
+    VoxelGridExporter m_grid_exporter;
+
+    // GPU memory report, refreshed after start up and whenever the voxelizer changes
+    GpuMemoryReport m_memory_report;
+    std::string     m_memory_report_path = "memory_report.json";
+
+    // Large triangle threshold tuning, the best threshold per scene and resolution is cached across runs
+    ThresholdTuner m_threshold_tuner;
+    std::string    m_threshold_cache_path = "threshold_cache.json";
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+#include <vk.h>
+#include "Voxelizer.h"
+
+enum VoxelGridExportFormat
+{
+    VOXEL_GRID_EXPORT_VOX    = 1 << 0, // MagicaVoxel .vox of the largest mip that fits its 256^3 limit
+    VOXEL_GRID_EXPORT_BRICKS = 1 << 1, // Occupied 8^3 bricks of mip 0, .bricks
+    VOXEL_GRID_EXPORT_SPARSE = 1 << 2  // VDB style tree of mip 0 holding only occupied voxels, .sparse
+};
+
+// Raw bricks file: this header, then brick_count times the brick coordinates as 4 uint32 (x, y, z, 0) followed
+// by brick_size^3 RGBA8 voxels with x varying fastest.
+struct VoxelBricksHeader
+{
+    char     magic[4]; // "VCTB"
+    uint32_t version;
+    uint32_t resolution;
+    uint32_t brick_size;
+    uint32_t brick_count;
+    uint32_t padding[3];
+    float    aabb_min[4];
+    float    aabb_max[4];
+};
+
+// Sparse file: this header, then for every internal node with an occupied leaf its origin in voxels as 3
+// int32, its leaf count as uint32 and a 16^3 bit child mask, followed by every child leaf in mask order as a
+// 8^3 bit value mask and the RGBA8 values of its occupied voxels in mask order. Masks are stored as uint64
+// words, bit i of word w is the child or voxel with index w * 64 + i, x varying fastest.
+struct VoxelSparseHeader
+{
+    char     magic[4]; // "VCTS"
+    uint32_t version;
+    uint32_t resolution;
+    uint32_t leaf_dim;     // Voxels per side of a leaf
+    uint32_t internal_dim; // Leaves per side of an internal node
+    uint32_t internal_count;
+    uint32_t padding[2];
+    float    aabb_min[4];
+    float    aabb_max[4];
+};
+
+// Exports the voxel grid without stalling a frame. The copy to a staging buffer is recorded into the frame's
+// own command buffer, and once the framework has waited on that frame's fence the files are written on the
+// thread pool.
+class VoxelGridExporter
+{
+public:
+    // Exports the next grid passed to record(), ignored while an export is in flight.
+    void request(uint32_t formats, const std::string& prefix);
+
+    // Records the staging copy if an export was requested. The grid has to be complete and owned by the
+    // queue cmd_buf is submitted to, outside of a render pass.
+    void record(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, const Voxelizer& voxelizer, uint64_t frame);
+
+    // Starts writing the files once the frame that recorded the copy has finished and releases the staging
+    // buffer once they are written. Call every frame with the index of the frame about to be recorded.
+    void update(uint64_t frame);
+
+    // Waits for an in-flight write and releases the staging buffer, call before the device is destroyed.
+    void shutdown();
+
+    void gui();
+
+    inline bool busy() const { return m_requested || m_staging != nullptr; }
+
+private:
+    uint32_t                       m_formats   = VOXEL_GRID_EXPORT_VOX | VOXEL_GRID_EXPORT_BRICKS | VOXEL_GRID_EXPORT_SPARSE;
+    std::string                    m_prefix    = "voxel_grid";
+    bool                           m_requested = false;
+    dw::vk::Buffer::Ptr            m_staging;
+    std::vector<VkBufferImageCopy> m_regions;
+    uint32_t                       m_resolution;
+    AABB                           m_aabb;
+    uint64_t                       m_copy_frame;
+    std::future<void>              m_write;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <vk.h>
+#include "Voxelizer.h"
+
+// CPU copy of a voxel grid, every mip as RGBA8 with x varying fastest, then y, then z.
+struct VoxelGrid
+{
+    uint32_t                          resolution = 0;
+    std::vector<std::vector<uint8_t>> mips;
+    std::string                       label;
+
+    inline uint32_t mip_resolution(uint32_t mip) const { return std::max(resolution >> mip, 1u); }
+};
+
+struct VoxelGridMipComparison
+{
+    uint32_t mip;
+    uint32_t resolution;
+    uint64_t occupied_a;
+    uint64_t occupied_b;
+    uint64_t occupied_both;
+    double   iou;                   // Occupied in both over occupied in either
+    double   mean_color_difference; // Mean absolute RGB difference over voxels occupied in both, 0 to 1
+    double   max_color_difference;
+};
+
+// Copy regions packing every mip of the grid tightly one after another, returns the buffer size they need.
+VkDeviceSize voxel_grid_copy_regions(const Voxelizer& voxelizer, std::vector<VkBufferImageCopy>& regions);
+
+// Records the copy of the grid into a host readable buffer, ordered after the writes to the grid and before
+// any later shader access. Has to be recorded outside of a render pass by the queue that owns the grid.
+void record_voxel_grid_copy(dw::vk::CommandBuffer::Ptr cmd_buf, const Voxelizer& voxelizer, dw::vk::Buffer::Ptr buffer, const std::vector<VkBufferImageCopy>& regions);
+
+// Copies every mip of the voxelizer's grid into a staging buffer and waits for it. The grid must not be in
+// use by the GPU and be owned by the graphics queue.
+bool read_back_voxel_grid(dw::vk::Backend::Ptr backend, const Voxelizer& voxelizer, VoxelGrid& grid);
+
+// Per mip coverage and color metrics, a voxel counts as occupied if its alpha is non-zero. Both grids must
+// have the same resolution.
+std::vector<VoxelGridMipComparison> compare_voxel_grids(const VoxelGrid& a, const VoxelGrid& b);
+
+// Writes the center slice along each axis of one mip as <prefix>_x.ppm, _y.ppm and _z.ppm. Each image shows
+// a, b and their difference side by side: red where only a is occupied, green where only b is and the
+// amplified color difference in grey where both are.
+bool write_voxel_grid_slices(const VoxelGrid& a, const VoxelGrid& b, uint32_t mip, const std::string& prefix);
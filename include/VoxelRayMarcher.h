@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <glm.hpp>
+#include <vk.h>
+#include "Voxelizer.h"
+#include "GpuMemoryReport.h"
+
+struct VoxelRayMarchPushConstants
+{
+    glm::mat4 inv_view_projection;
+    glm::vec4 camera_pos;
+    glm::vec4 grid; // xyz: minimum corner of the grid, w: side length of the grid
+    VkBool32  no_texture;
+};
+
+// Visualizes one mip of the voxel grid by DDA ray marching it from the camera in a fullscreen compute pass, then
+// copies the result into the swapchain render pass with a fullscreen triangle. Unlike the instanced cubes its cost
+// depends on the pixel count and the empty space crossed rather than on the occupied voxels, and it needs no
+// buffers beyond the output image.
+class VoxelRayMarcher
+{
+public:
+    // Allocates the descriptor sets, the pipelines come from create_pipeline_state(), which may run on another thread.
+    VoxelRayMarcher(dw::vk::Backend::Ptr backend);
+    void create_pipeline_state(dw::vk::Backend::Ptr backend);
+
+    // Call outside of a render pass. The grid must be readable by compute shaders.
+    void march(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Voxelizer& voxelizer, uint32_t mip_level, const glm::mat4& view_projection, const glm::vec3& camera_pos, uint32_t width, uint32_t height);
+
+    // Call inside the swapchain render pass after march() in the same frame.
+    void present(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend);
+
+    void report_memory(GpuMemoryReport& report) const;
+
+    bool no_texture = false;
+
+private:
+    // Output image replaced by a resize, kept alive until the frames that used it have finished.
+    struct RetiredImage
+    {
+        dw::vk::Image::Ptr     image;
+        dw::vk::ImageView::Ptr image_view;
+        uint32_t               frames_left;
+    };
+
+    uint32_t m_width  = 0;
+    uint32_t m_height = 0;
+
+    dw::vk::Image::Ptr        m_image;
+    dw::vk::ImageView::Ptr    m_image_view;
+    std::vector<RetiredImage> m_retired_images;
+
+    dw::vk::DescriptorSetLayout::Ptr m_ds_layout;
+    // One per frame in flight, rewritten every frame since the grid and the output image can change.
+    std::vector<dw::vk::DescriptorSet::Ptr> m_ds;
+
+    dw::vk::PipelineLayout::Ptr   m_compute_pipeline_layout;
+    dw::vk::ComputePipeline::Ptr  m_compute_pipeline;
+    dw::vk::PipelineLayout::Ptr   m_present_pipeline_layout;
+    dw::vk::GraphicsPipeline::Ptr m_present_pipeline;
+
+    void create_descriptor_sets(dw::vk::Backend::Ptr backend);
+    void create_compute_pipeline_state(dw::vk::Backend::Ptr backend);
+    void create_present_pipeline_state(dw::vk::Backend::Ptr backend);
+    void create_image(dw::vk::Backend::Ptr backend, uint32_t width, uint32_t height);
+    void write_descriptor_set(dw::vk::Backend::Ptr backend, Voxelizer& voxelizer, uint32_t mip_level);
+};
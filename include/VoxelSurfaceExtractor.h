@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <glm.hpp>
+#include <vk.h>
+#include "Voxelizer.h"
+#include "GpuMemoryReport.h"
+
+// Face written by voxel_faces.comp, see the packing there.
+struct VoxelFace
+{
+    uint32_t coordinate;
+    uint32_t size_and_direction;
+    uint32_t color;
+};
+
+// Layout of the DrawBuffer in voxel_faces.comp.
+struct VoxelFaceDraw
+{
+    VkDrawIndirectCommand command;
+    uint32_t              face_count; // Faces found by the last extraction, including those that did not fit
+};
+
+struct VoxelFacePushConstants
+{
+    glm::mat4 view_projection;
+    glm::vec4 grid; // xyz: minimum corner of the grid, w: voxel width
+    VkBool32  no_texture;
+};
+
+// Extracts the exposed faces of the occupied voxels of mip 0 into a face buffer that is drawn indirectly, two
+// triangles per face. Every slice of every face direction is merged greedily: runs of faces with the same color
+// along a row are merged, and runs that repeat on the following rows are merged into one rectangle. Faces are
+// only extracted again after invalidate() or when they did not fit, not every frame.
+class VoxelSurfaceExtractor
+{
+public:
+    // Allocates the descriptor sets, the pipelines come from create_pipeline_state(), which may run on another thread.
+    VoxelSurfaceExtractor(dw::vk::Backend::Ptr backend);
+    void create_pipeline_state(dw::vk::Backend::Ptr backend);
+
+    // The faces are extracted again from the next grid passed to update() that was voxelized in its frame.
+    void invalidate();
+
+    // Call outside of a render pass every frame the faces are drawn, before draw(). grid_voxelized is false if the
+    // grid is the one of an earlier frame, which the async voxelization may keep for a while after a change.
+    void update(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Voxelizer& voxelizer, bool grid_voxelized);
+
+    // Call inside the swapchain render pass. Draws the faces of the last extraction, with the grid bounds of
+    // the voxelizer they were extracted from.
+    void draw(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, const glm::mat4& view_projection, uint32_t width, uint32_t height);
+
+    void report_memory(GpuMemoryReport& report) const;
+
+    // Faces counted by the latest extraction that has been read back.
+    inline uint32_t face_count() const { return m_face_count; }
+    inline uint32_t face_capacity() const { return m_face_capacity; }
+
+    bool no_texture = false;
+
+private:
+    // Face buffer replaced by a resize, kept alive until the frames that used it have finished.
+    struct RetiredFaceBuffer
+    {
+        dw::vk::Buffer::Ptr buffer;
+        uint32_t            frames_left;
+    };
+
+    static const uint32_t kMinFaceCapacity = 65536;
+
+    bool      m_invalidated   = true;
+    bool      m_extract       = false;
+    uint32_t  m_face_capacity = 0;
+    uint32_t  m_face_count    = 0;
+    glm::vec4 m_grid; // xyz: minimum corner, w: voxel width of the grid the faces were extracted from
+
+    dw::vk::Buffer::Ptr            m_face_buffer;
+    std::vector<RetiredFaceBuffer> m_retired_face_buffers;
+    dw::vk::Buffer::Ptr            m_draw_buffer;
+    dw::vk::Buffer::Ptr            m_readback_buffer; // One count per frame in flight
+    std::vector<bool>              m_readback_recorded;
+
+    dw::vk::DescriptorSetLayout::Ptr m_ds_layout;
+    // One per frame in flight, rewritten every frame since the grid and the face buffer can change.
+    std::vector<dw::vk::DescriptorSet::Ptr> m_ds;
+
+    dw::vk::PipelineLayout::Ptr   m_extract_pipeline_layout;
+    dw::vk::ComputePipeline::Ptr  m_extract_pipeline;
+    dw::vk::PipelineLayout::Ptr   m_finalize_pipeline_layout;
+    dw::vk::ComputePipeline::Ptr  m_finalize_pipeline;
+    dw::vk::PipelineLayout::Ptr   m_draw_pipeline_layout;
+    dw::vk::GraphicsPipeline::Ptr m_draw_pipeline;
+
+    void create_buffers(dw::vk::Backend::Ptr backend);
+    void create_descriptor_sets(dw::vk::Backend::Ptr backend);
+    void create_compute_pipeline_state(dw::vk::Backend::Ptr backend);
+    void create_draw_pipeline_state(dw::vk::Backend::Ptr backend);
+    void create_face_buffer(dw::vk::Backend::Ptr backend, uint32_t capacity);
+    void write_descriptor_set(dw::vk::Backend::Ptr backend, Voxelizer& voxelizer);
+    void extract(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Voxelizer& voxelizer);
+};
@@ -8,6 +8,7 @@
 #include <vk_mem_alloc.h>
 #include <algorithm>
 #include <material.h>
+#include "GpuMemoryReport.h"
 
 struct VisualizerUBO
 {
@@ -17,13 +18,23 @@ struct VisualizerUBO
 		glm::mat4 view;
 	DW_ALIGNED(16)
 		glm::mat4 projection;
+	DW_ALIGNED(16)
+		glm::vec4 grid; // xyz: minimum corner of the grid, w: voxel width
 };
 
-// Per instance data
-struct InstanceData
+// Visualized voxel, see voxel_vis.comp. The coordinate packs x, y and z into 10 bits each, the color is RGBA8.
+struct VoxelInstance
 {
-	DW_ALIGNED(16)
-		glm::vec4 position;
+	uint32_t coordinate;
+	uint32_t color;
+};
+
+// Layout of the std140 IndirectBuffer in voxel_vis.comp.
+struct VoxelVisualizerIndirect
+{
+	VkDrawIndexedIndirectCommand command;
+	uint32_t                     padding[3];
+	uint32_t                     occupied; // Occupied voxels found by the last compaction, including those that did not fit
 };
 
 struct VoxelizerData
@@ -58,6 +69,11 @@ class Voxelizer
 public:
 	VkBool32 noTexture;
 
+	// The grid is double buffered, so that an async voxelization can write one grid on the compute queue while the
+	// main pass samples the other. The grid members and descriptor sets below refer to the grid selected by
+	// use_read_grid() or use_write_grid(), which is the one the commands recorded next use.
+	static const uint32_t kGridCount = 2;
+
 	dw::vk::Image::Ptr			  m_image;
 	dw::vk::ImageView::Ptr		  m_image_view;
 	std::vector<dw::vk::ImageView::Ptr>		  m_image_views_mip_levels;
@@ -68,6 +84,10 @@ public:
 	const float m_voxel_width;
 	uint32_t m_mip_level_count;
 
+	// Every descriptor set of the voxelizer comes from its own pool, so that a voxelizer built on a worker never
+	// allocates from or frees into the backend's pool. Declared before the sets so that it outlives them.
+	dw::vk::DescriptorPool::Ptr m_descriptor_pool;
+
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_image;
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_voxel_grid_mip_maps;
 	dw::vk::DescriptorSet::Ptr       m_ds_image;
@@ -92,7 +112,6 @@ public:
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_ubo_static;
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_ubo_dynamic;
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_instance_buffer;
-	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_instance_color_buffer;
 	dw::vk::DescriptorSetLayout::Ptr m_ds_layout_indirect_buffer;
 	dw::vk::DescriptorSet::Ptr       m_ds_visualizer_ubo;
 	dw::vk::DescriptorSet::Ptr       m_ds_voxel_grid_ubo;
@@ -109,10 +128,21 @@ public:
 	Voxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3 AABB_max, uint32_t voxels_per_side, const dw::vk::VertexInputStateDesc& vertex_input_state, VoxelizationType voxelization_type, uint32_t m_viewport_width, uint32_t m_viewport_height);
 	virtual ~Voxelizer();
 
+	static dw::Mesh::Ptr load_cube_mesh(dw::vk::Backend::Ptr backend);
+	static void reset_cube_mesh();
+
 	virtual void Voxelizer::begin_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend) = 0;
 	virtual void Voxelizer::end_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf) = 0;
 
-	void transition_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf);
+	void use_read_grid();
+	void use_write_grid();
+	// The write grid becomes the one that is sampled, once a voxelization into it has completed. Selects it.
+	void flip_grids();
+	inline uint32_t current_grid() const { return m_grid_idx; }
+
+	void transition_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf, VkPipelineStageFlags dst_stage_mask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	void release_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf, uint32_t src_queue_family, uint32_t dst_queue_family);
+	void acquire_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf, uint32_t src_queue_family, uint32_t dst_queue_family);
 	void reset_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf);
 	int get_work_groups_dim();
 	void debug_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
@@ -120,6 +150,7 @@ public:
 	void voxelization_visualization_image_memory_barrier_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf);
 	void pre_mip_map_image_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf);
 	void reset_instance_buffer(dw::vk::CommandBuffer::Ptr cmd_buf);
+	void create_finalize_instance_compute_pipeline_state(dw::vk::Backend::Ptr backend);
 	void begin_render_visualizer(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend);
 	void render_voxels(dw::vk::CommandBuffer::Ptr cmd_buf);
 	void reset_init_buffer_memory_barrier_indirect(dw::vk::CommandBuffer::Ptr cmd_buf);
@@ -134,6 +165,13 @@ public:
 	void generate_mip_maps(dw::vk::CommandBuffer::Ptr cmd_buf);
 	AABB get_AABB() const;
 
+	// Adds the grid and the buffers the voxelizer owns, subclasses add their own after calling this.
+	virtual void report_memory(GpuMemoryReport& report) const;
+
+	// Occupied voxels counted by the latest visualization that has been read back.
+	inline uint32_t occupied_voxels() const { return m_occupied_voxels; }
+	inline uint32_t instance_capacity() const { return m_instance_capacity; }
+
 protected:
 	size_t							 m_ubo_size;
 	dw::vk::Buffer::Ptr				 m_ubo_data;
@@ -142,27 +180,62 @@ protected:
 	VoxelizerData					 m_data;
 
 	float get_length(glm::vec3 AABB_min, glm::vec3 AABB_max) const;
+	dw::vk::DescriptorSet::Ptr allocate_descriptor_set(dw::vk::Backend::Ptr backend, dw::vk::DescriptorSetLayout::Ptr layout);
 	
 private:
 	uint32_t m_viewport_width;
 	uint32_t m_viewport_height;
 
+	struct Grid
+	{
+		dw::vk::Image::Ptr                  image;
+		dw::vk::ImageView::Ptr              image_view;
+		std::vector<dw::vk::ImageView::Ptr> image_views_mip_levels;
+		dw::vk::DescriptorSet::Ptr          ds_image;
+		dw::vk::DescriptorSet::Ptr          ds_voxel_grid_mip_maps;
+	};
+
+	Grid     m_grids[kGridCount];
+	uint32_t m_grid_idx      = 0;
+	uint32_t m_read_grid_idx = 0;
+
 	dw::vk::PipelineLayout::Ptr   m_reset_instance_compute_pipeline_layout;
 	dw::vk::ComputePipeline::Ptr  m_reset_instance_compute_pipeline;
-
-	size_t							 m_instance_buffer_size;
-	dw::vk::Buffer::Ptr				 m_instance_buffer;
-	size_t							 m_instance_color_buffer_size;
-	dw::vk::Buffer::Ptr				 m_instance_color_buffer;
+	dw::vk::PipelineLayout::Ptr   m_finalize_instance_compute_pipeline_layout;
+	dw::vk::ComputePipeline::Ptr  m_finalize_instance_compute_pipeline;
+
+	// Instance buffer replaced by a resize, kept alive until the frames that used it have finished.
+	struct RetiredInstanceBuffer
+	{
+		dw::vk::Buffer::Ptr buffer;
+		uint32_t            frames_left;
+	};
+
+	// Created on the first visualization and resized to the occupied voxel count read back from earlier frames.
+	static const uint32_t              kMinInstanceCapacity = 16384;
+	dw::vk::Buffer::Ptr				   m_instance_buffer;
+	uint32_t                           m_instance_capacity = 0;
+	std::vector<RetiredInstanceBuffer> m_retired_instance_buffers;
+	dw::vk::Buffer::Ptr                m_occupancy_readback_buffer; // One count per frame in flight
+	std::vector<bool>                  m_occupancy_recorded;
+	uint32_t                           m_occupied_voxels = 0;
 	size_t							 m_indirect_buffer_size;
 	dw::vk::Buffer::Ptr				 m_indirect_buffer;
 	size_t                           m_mip_map_atomic_counters_buffer_size;
 	dw::vk::Buffer::Ptr				 m_mip_map_atomic_counters_buffer;
 
-	dw::vk::DescriptorSet::Ptr       m_ds_instance_buffer;
-	dw::vk::DescriptorSet::Ptr       m_ds_instance_color_buffer;
+	// Allocated up front and rewritten round-robin on resize, so that the pool is only sized for creation. One more
+	// than the frames in flight, since a resize can happen every frame while the sets of the previous frames are still
+	// in use.
+	std::vector<dw::vk::DescriptorSet::Ptr> m_ds_instance_buffers;
+	uint32_t                                m_ds_instance_buffer_idx = 0;
 	dw::vk::DescriptorSet::Ptr       m_ds_indirect_buffer;
 
+	void create_descriptor_pool(dw::vk::Backend::Ptr backend);
 	void create_descriptor_sets(dw::vk::Backend::Ptr backend);
+	void create_grid(dw::vk::Backend::Ptr backend, uint32_t index);
+	void use_grid(uint32_t index);
+	void update_instance_capacity(dw::vk::Backend::Ptr backend);
+	void create_instance_buffer(dw::vk::Backend::Ptr backend, uint32_t capacity);
 
 };
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vk.h>
+#include "GpuProfiler.h"
+
+// Mirrors WorkCounterBuffer in work_counters.h. Each group starts on a 32 byte boundary so that it can be reset
+// and copied on its own, enabled is written with the reset and checked by the shaders before every atomic.
+struct WorkCounterValues
+{
+    // Compute voxelizer
+    uint32_t voxelizer_enabled;
+    uint32_t triangles;              // Triangle records written by the setup pass
+    uint32_t sat_tests;              // voxel_triangle_collision_test calls
+    uint32_t voxels_written;
+    uint32_t large_triangle_records; // Large triangle workgroups appended
+    uint32_t voxelizer_padding[3];
+
+    // Main pass
+    uint32_t render_enabled;
+    uint32_t cone_steps;
+    uint32_t cone_fragments; // Fragments that traced ambient occlusion cones
+    uint32_t render_padding[5];
+};
+
+enum WorkCounterGroup
+{
+    WORK_COUNTERS_VOXELIZER,
+    WORK_COUNTERS_RENDER,
+    WORK_COUNTER_GROUP_COUNT
+};
+
+// In the order Vulkan writes them, a compute queue only reports compute shader invocations.
+enum PipelineStatistic
+{
+    PIPELINE_STATISTIC_INPUT_PRIMITIVES,
+    PIPELINE_STATISTIC_VERTEX_INVOCATIONS,
+    PIPELINE_STATISTIC_GEOMETRY_INVOCATIONS,
+    PIPELINE_STATISTIC_CLIPPING_PRIMITIVES,
+    PIPELINE_STATISTIC_FRAGMENT_INVOCATIONS,
+    PIPELINE_STATISTIC_COMPUTE_INVOCATIONS,
+    PIPELINE_STATISTIC_COUNT
+};
+
+struct PassStatistics
+{
+    std::string name;
+    uint32_t    queue;
+    uint64_t    values[PIPELINE_STATISTIC_COUNT];
+};
+
+// Pipeline statistics queries around the voxelizer and main passes, and atomic counters the shaders increment
+// for the work the statistics cannot see. Both are kept per frame in flight and read back without stalling, the
+// same way as the GpuProfiler's timestamps. Nothing is recorded unless enabled, since the counters put atomics
+// into the innermost loops.
+class WorkCounters
+{
+public:
+    // Per queue and frame in flight, passes beyond it are dropped. The compute voxelizer takes three per batch.
+    static const uint32_t    kMaxPasses = 128;
+    static const char* const kStatisticNames[PIPELINE_STATISTIC_COUNT];
+
+    static WorkCounters& get();
+
+    void initialize(dw::vk::Backend::Ptr backend);
+    void shutdown();
+
+    // Reads back the frame that last used the current frame slot, call once per frame before recording.
+    void begin_frame();
+
+    // Same contract as GpuProfiler::begin_command_buffer(), call right after it.
+    void begin_command_buffer(dw::vk::CommandBuffer::Ptr cmd_buf, GpuQueue queue);
+
+    // Pipeline statistics of everything recorded in between. Passes cannot be nested, and a pass that begins
+    // inside a render pass has to end in the same subpass. Passes with the same name in a frame are added up.
+    void begin_pass(const std::string& name, dw::vk::CommandBuffer::Ptr cmd_buf);
+    void end_pass(dw::vk::CommandBuffer::Ptr cmd_buf);
+
+    // Resets a counter group before the shaders that increment it and copies it for readback after them, both
+    // outside of a render pass. The shaders find the counters of the current frame in ds(), or at counter_offset()
+    // of counter_buffer() when a pass binds them as a dynamic storage buffer of its own set.
+    void begin_counters(dw::vk::CommandBuffer::Ptr cmd_buf, WorkCounterGroup group, VkPipelineStageFlags dst_stage_mask);
+    void end_counters(dw::vk::CommandBuffer::Ptr cmd_buf, WorkCounterGroup group, VkPipelineStageFlags src_stage_mask);
+
+    void gui();
+
+    // Last frame read back that recorded the pass, nullptr if there is none.
+    const PassStatistics* find_pass(const std::string& name) const;
+
+    // Values read back before the counters were last enabled are dropped.
+    void set_enabled(bool enabled);
+
+    inline bool                                    enabled() const { return m_enabled; }
+    inline bool                                    statistics_supported() const { return m_statistics_supported; }
+    inline const dw::vk::DescriptorSetLayout::Ptr& ds_layout() const { return m_ds_layout; }
+    inline const dw::vk::DescriptorSet::Ptr&       ds() const { return m_frames[m_frame_idx].ds; }
+    inline const dw::vk::Buffer::Ptr&              counter_buffer() const { return m_counter_buffer; }
+    inline uint32_t                                counter_offset() const { return m_stride * m_frame_idx; }
+    inline const std::vector<PassStatistics>&      passes() const { return m_passes; }
+    inline const WorkCounterValues&                counters() const { return m_counters; }
+
+    // Whether a group has been read back since the counters were last enabled.
+    inline bool counters_valid(WorkCounterGroup group) const { return m_counters_valid[group]; }
+
+private:
+    struct PendingPass
+    {
+        std::string name;
+        uint32_t    queue;
+        uint32_t    query;
+    };
+
+    struct Frame
+    {
+        VkQueryPool                query_pools[GPU_QUEUE_COUNT];
+        uint32_t                   query_counts[GPU_QUEUE_COUNT];
+        bool                       reset[GPU_QUEUE_COUNT];
+        bool                       counters_recorded[WORK_COUNTER_GROUP_COUNT];
+        dw::vk::DescriptorSet::Ptr ds; // This frame's counters
+        std::vector<PendingPass>   pending;
+    };
+
+    dw::vk::Backend::Ptr             m_backend;
+    std::vector<Frame>               m_frames;
+    dw::vk::Buffer::Ptr              m_counter_buffer;
+    dw::vk::Buffer::Ptr              m_readback_buffer;
+    dw::vk::DescriptorSetLayout::Ptr m_ds_layout;
+    std::vector<PassStatistics>      m_passes;
+    WorkCounterValues                m_counters;
+    bool                             m_counters_valid[WORK_COUNTER_GROUP_COUNT] = {};
+    uint32_t                         m_stride                                   = 0;
+    uint32_t                         m_frame_idx                                = 0;
+    uint32_t                         m_active_queue                             = GPU_QUEUE_COUNT;
+    int32_t                          m_open_pass                                = -1;
+    uint32_t                         m_pass_depth                               = 0;
+    bool                             m_statistics_supported                     = false;
+    bool                             m_enabled                                  = false;
+};
+
+// Records the lifetime of the object as one WorkCounters pass.
+class ScopedPassStatistics
+{
+public:
+    inline ScopedPassStatistics(const std::string& name, dw::vk::CommandBuffer::Ptr cmd_buf) :
+        m_cmd_buf(cmd_buf) { WorkCounters::get().begin_pass(name, cmd_buf); }
+
+    inline ~ScopedPassStatistics() { WorkCounters::get().end_pass(m_cmd_buf); }
+
+private:
+    dw::vk::CommandBuffer::Ptr m_cmd_buf;
+};
@@ -0,0 +1,310 @@
+#include "Benchmark.h"
+#include "GpuProfiler.h"
+#include <imgui.h>
+#include <json.hpp>
+#include <logger.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+const uint32_t    Benchmark::kPassCount;
+const char* const Benchmark::kPasses[Benchmark::kPassCount] = { "Compute Voxelizer", "Small Triangles", "Large Triangles", "Geometry voxelizer", "Main render", "Shadow map" };
+
+static bool parse_list(const char* value, std::vector<uint32_t>& list)
+{
+    list.clear();
+
+    while (*value)
+    {
+        char*         end    = nullptr;
+        unsigned long number = strtoul(value, &end, 10);
+
+        if (end == value || (*end != ',' && *end != '\0'))
+            return false;
+
+        list.push_back(number);
+        value = *end == ',' ? end + 1 : end;
+    }
+
+    return !list.empty();
+}
+
+static void reset_timing(BenchmarkTiming& timing)
+{
+    timing.total_ms = 0.0;
+    timing.min_ms   = DBL_MAX;
+    timing.max_ms   = 0.0;
+    timing.count    = 0;
+}
+
+static void add_timing(BenchmarkTiming& timing, double ms)
+{
+    timing.total_ms += ms;
+    timing.min_ms = std::min(timing.min_ms, ms);
+    timing.max_ms = std::max(timing.max_ms, ms);
+    timing.count++;
+}
+
+static const char* type_name(VoxelizationType type)
+{
+    return type == GEOMETRY_SHADER_VOXELIZATION ? "geometry" : "compute";
+}
+
+bool Benchmark::parse_arguments(int argc, const char* argv[], std::vector<std::string>& remaining)
+{
+    std::vector<uint32_t> resolutions = { 64, 128, 256, 512 };
+    std::vector<uint32_t> thresholds  = { 5, 15, 30 };
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        const char* value    = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (argument == "--benchmark")
+        {
+            m_enabled = true;
+            continue;
+        }
+
+        if (argument != "--benchmark-output" && argument != "--warmup" && argument != "--frames" && argument != "--resolutions" && argument != "--thresholds")
+        {
+            remaining.push_back(argument);
+            continue;
+        }
+
+        std::vector<uint32_t> numbers;
+
+        if (!value || (argument != "--benchmark-output" && !parse_list(value, numbers)))
+        {
+            DW_LOG_ERROR("(Benchmark) Missing or invalid value for " + argument);
+            return false;
+        }
+
+        if (argument == "--benchmark-output")
+            m_output = value;
+        else if (argument == "--warmup")
+            m_warmup_frames = numbers[0];
+        else if (argument == "--frames")
+            m_measured_frames = std::max(numbers[0], 1u);
+        else if (argument == "--resolutions")
+            resolutions = numbers;
+        else
+            thresholds = numbers;
+
+        i++;
+    }
+
+    // Results of the previous configuration are still in flight for a few frames after switching, and the work
+    // counters of the first warm-up frames need as many to be read back.
+    m_warmup_frames = std::max(m_warmup_frames, 2 * (uint32_t)dw::vk::Backend::kMaxFramesInFlight);
+
+    for (uint32_t resolution : resolutions)
+    {
+        for (uint32_t ambient_occlusion = 0; ambient_occlusion < 2; ambient_occlusion++)
+        {
+            BenchmarkConfig config;
+
+            config.resolution               = resolution;
+            config.type                     = GEOMETRY_SHADER_VOXELIZATION;
+            config.large_triangle_threshold = -1;
+            config.ambient_occlusion        = ambient_occlusion != 0;
+
+            m_configs.push_back(config);
+
+            config.type = COMPUTE_SHADER_VOXELIZATION;
+
+            for (uint32_t threshold : thresholds)
+            {
+                config.large_triangle_threshold = threshold;
+                m_configs.push_back(config);
+            }
+        }
+    }
+
+    if (!m_enabled)
+        m_configs.clear();
+
+    return true;
+}
+
+bool Benchmark::update(double delta, bool ready)
+{
+    if (finished())
+        return false;
+
+    if (!ready)
+    {
+        WorkCounters::get().set_enabled(false);
+        m_frame = 0;
+        return false;
+    }
+
+    if (m_frame == 0)
+    {
+        m_current.config = config();
+        m_current.passes.resize(kPassCount);
+        m_current.statistics.clear();
+
+        reset_timing(m_current.frame);
+        for (auto& pass : m_current.passes)
+            reset_timing(pass);
+
+        for (uint32_t i = 0; i < WORK_COUNTER_GROUP_COUNT; i++)
+            m_current.counters_valid[i] = false;
+    }
+
+    m_frame++;
+
+    // The counters' atomics must not end up in the measured times, so they only run early in the warm-up and the
+    // last frame that counted is read back by its end.
+    WorkCounters::get().set_enabled(m_frame + dw::vk::Backend::kMaxFramesInFlight <= m_warmup_frames);
+
+    if (m_frame == m_warmup_frames)
+    {
+        m_current.counters   = WorkCounters::get().counters();
+        m_current.statistics = WorkCounters::get().passes();
+
+        for (uint32_t i = 0; i < WORK_COUNTER_GROUP_COUNT; i++)
+            m_current.counters_valid[i] = WorkCounters::get().counters_valid(WorkCounterGroup(i));
+    }
+
+    if (m_frame <= m_warmup_frames)
+        return false;
+
+    add_timing(m_current.frame, delta);
+
+    for (uint32_t i = 0; i < kPassCount; i++)
+    {
+        double ms = GpuProfiler::get().sample_ms(kPasses[i]);
+
+        if (ms >= 0.0)
+            add_timing(m_current.passes[i], ms);
+    }
+
+    if (m_frame < m_warmup_frames + m_measured_frames)
+        return false;
+
+    char line[256];
+    snprintf(line, sizeof(line), "(Benchmark) %u/%u: %s %u^3, threshold %d, AO %s, frame %.3f ms", m_config_idx + 1, (uint32_t)m_configs.size(), type_name(m_current.config.type), m_current.config.resolution, m_current.config.large_triangle_threshold, m_current.config.ambient_occlusion ? "on" : "off", m_current.frame.total_ms / m_current.frame.count);
+    DW_LOG_INFO(line);
+
+    m_results.push_back(m_current);
+    m_config_idx++;
+    m_frame = 0;
+
+    return finished();
+}
+
+bool Benchmark::write_results() const
+{
+    std::ofstream csv(m_output + ".csv");
+    std::ofstream json_file(m_output + ".json");
+
+    if (!csv || !json_file)
+    {
+        DW_LOG_ERROR("(Benchmark) Failed to open " + m_output + ".csv/.json for writing");
+        return false;
+    }
+
+    // CSV holds the mean of every pass, passes that never ran in a configuration are left empty.
+    csv << "resolution,voxelization,large_triangle_threshold,ambient_occlusion,frame_ms";
+    for (uint32_t i = 0; i < kPassCount; i++)
+        csv << "," << kPasses[i] << " (ms)";
+    csv << ",triangles,sat_tests,voxels_written,large_triangle_records,cone_steps,cone_fragments\n";
+
+    nlohmann::json runs = nlohmann::json::array();
+
+    for (const auto& result : m_results)
+    {
+        csv << result.config.resolution << "," << type_name(result.config.type) << ",";
+        if (result.config.large_triangle_threshold >= 0)
+            csv << result.config.large_triangle_threshold;
+        csv << "," << (result.config.ambient_occlusion ? 1 : 0) << "," << result.frame.total_ms / result.frame.count;
+
+        nlohmann::json run;
+
+        run["resolution"]               = result.config.resolution;
+        run["voxelization"]             = type_name(result.config.type);
+        run["large_triangle_threshold"] = result.config.large_triangle_threshold >= 0 ? nlohmann::json(result.config.large_triangle_threshold) : nlohmann::json();
+        run["ambient_occlusion"]        = result.config.ambient_occlusion;
+        run["frame_ms"]                 = result.frame.total_ms / result.frame.count;
+        run["passes"]                   = nlohmann::json::object();
+
+        for (uint32_t i = 0; i < kPassCount; i++)
+        {
+            const BenchmarkTiming& pass = result.passes[i];
+
+            csv << ",";
+
+            if (pass.count == 0)
+                continue;
+
+            csv << pass.total_ms / pass.count;
+
+            run["passes"][kPasses[i]] = { { "mean_ms", pass.total_ms / pass.count }, { "min_ms", pass.min_ms }, { "max_ms", pass.max_ms }, { "samples", pass.count } };
+        }
+
+        const WorkCounterValues& counters = result.counters;
+
+        run["work_counters"] = nlohmann::json::object();
+
+        if (result.counters_valid[WORK_COUNTERS_VOXELIZER])
+        {
+            csv << "," << counters.triangles << "," << counters.sat_tests << "," << counters.voxels_written << "," << counters.large_triangle_records;
+
+            run["work_counters"]["triangles"]              = counters.triangles;
+            run["work_counters"]["sat_tests"]              = counters.sat_tests;
+            run["work_counters"]["voxels_written"]         = counters.voxels_written;
+            run["work_counters"]["large_triangle_records"] = counters.large_triangle_records;
+        }
+        else
+            csv << ",,,,";
+
+        if (result.counters_valid[WORK_COUNTERS_RENDER])
+        {
+            csv << "," << counters.cone_steps << "," << counters.cone_fragments;
+
+            run["work_counters"]["cone_steps"]     = counters.cone_steps;
+            run["work_counters"]["cone_fragments"] = counters.cone_fragments;
+        }
+        else
+            csv << ",,";
+
+        run["pipeline_statistics"] = nlohmann::json::object();
+
+        for (const auto& pass : result.statistics)
+        {
+            nlohmann::json statistics = nlohmann::json::object();
+
+            for (uint32_t i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+                statistics[WorkCounters::kStatisticNames[i]] = pass.values[i];
+
+            run["pipeline_statistics"][pass.name] = statistics;
+        }
+
+        csv << "\n";
+        runs.push_back(run);
+    }
+
+    nlohmann::json json;
+
+    json["warmup_frames"]   = m_warmup_frames;
+    json["measured_frames"] = m_measured_frames;
+    json["runs"]            = runs;
+
+    json_file << json.dump(4) << "\n";
+
+    DW_LOG_INFO("(Benchmark) Wrote " + m_output + ".csv and " + m_output + ".json");
+
+    return true;
+}
+
+void Benchmark::gui() const
+{
+    if (finished())
+        ImGui::Text("Benchmark finished");
+    else
+        ImGui::Text("Benchmark %u/%u: %s %u^3, threshold %d, AO %s, frame %u", m_config_idx + 1, (uint32_t)m_configs.size(), type_name(config().type), config().resolution, config().large_triangle_threshold, config().ambient_occlusion ? "on" : "off", m_frame);
+}
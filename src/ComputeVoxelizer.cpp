@@ -1,15 +1,68 @@
 #include "ComputeVoxelizer.h"
+#include "StartupTimeline.h"
+#include "ThreadPool.h"
+#include "GpuProfiler.h"
+#include "WorkCounters.h"
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
+#include <logger.h>
 #include <profiler.h>
 
-ComputeVoxelizer::ComputeVoxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3 AABB_max, uint32_t voxels_per_side, const dw::vk::VertexInputStateDesc& vertex_input_state, uint32_t m_viewport_width, uint32_t m_viewport_height, std::vector<RenderObject>& objects) :
+const uint32_t ComputeVoxelizer::kClusterBatchSize;
+
+// Same test as meshlet_cull.comp. The grid and the instances never move, so this is the number of clusters every
+// voxelization appends. The bounds are widened slightly so that rounding on the GPU cannot keep one more cluster.
+static uint32_t count_grid_clusters(const Scene& scene, const AABB& aabb)
+{
+    const glm::vec3 epsilon = glm::vec3(1e-3f) * (aabb.max - aabb.min);
+
+    uint32_t count = 0;
+
+    for (const auto& mesh : scene.meshes)
+    {
+        for (uint32_t i = 0; i < mesh.instance_count; i++)
+        {
+            const glm::mat4& model = scene.instances[mesh.first_instance + i].model;
+
+            for (uint32_t j = 0; j < mesh.meshlet_count; j++)
+            {
+                const SceneMeshlet& meshlet = scene.m_meshlets[mesh.first_meshlet + j];
+
+                glm::vec3 center = glm::vec3(meshlet.min + meshlet.max) * 0.5f;
+                glm::vec3 extent = glm::vec3(meshlet.max - meshlet.min) * 0.5f;
+
+                glm::vec3 world_center = glm::vec3(model * glm::vec4(center, 1.0f));
+                glm::vec3 world_extent = glm::abs(glm::vec3(model[0])) * extent.x + glm::abs(glm::vec3(model[1])) * extent.y + glm::abs(glm::vec3(model[2])) * extent.z;
+
+                if (glm::any(glm::lessThan(world_center + world_extent, aabb.min - epsilon)) || glm::any(glm::greaterThan(world_center - world_extent, aabb.max + epsilon)))
+                    continue;
+
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+ComputeVoxelizer::ComputeVoxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3 AABB_max, uint32_t voxels_per_side, const dw::vk::VertexInputStateDesc& vertex_input_state, uint32_t m_viewport_width, uint32_t m_viewport_height, Scene& scene) :
     Voxelizer(backend, AABB_min, AABB_max, voxels_per_side, vertex_input_state, COMPUTE_SHADER_VOXELIZATION, m_viewport_width, m_viewport_height)
 {
-    create_descriptor_sets(backend, objects);
-    create_indirect_reset_pipeline_state(backend);
-    create_voxelizer_pipeline_state(backend);
+    create_descriptor_sets(backend, scene);
+
+    ThreadPool::global().parallel_for(2, [&](uint32_t i) {
+        ScopedStartupPhase phase(i == 0 ? "Compute voxelizer: reset pipeline" : "Compute voxelizer: voxelization pipelines");
+
+        if (i == 0)
+            create_indirect_reset_pipeline_state(backend);
+        else
+            create_voxelizer_pipeline_state(backend);
+    });
+
     this->m_compute_voxelization_type = CORRECT_TEXCOORDS;
     m_push_constants.large_triangel_threshold = 15;
+    m_push_constants.first_cluster = 0;
 }
 
 void ComputeVoxelizer::create_voxelizer_pipeline_state(dw::vk::Backend::Ptr backend)
@@ -23,9 +76,9 @@ void ComputeVoxelizer::create_voxelizer_pipeline_state(dw::vk::Backend::Ptr back
     pl_desc.add_descriptor_set_layout(m_ds_layout_image)
         .add_descriptor_set_layout(m_ds_layout_ubo_dynamic)
         .add_descriptor_set_layout(m_ds_layout_ubo_dynamic)
-        .add_descriptor_set_layout(RenderObject::get_ds_layout_vertex_index())
-        .add_descriptor_set_layout(m_ds_layout_bindless)
-        .add_descriptor_set_layout(m_ds_layout_bindless_buffer)
+        .add_descriptor_set_layout(Scene::get_ds_layout_voxel_geometry())
+        .add_descriptor_set_layout(Scene::get_ds_layout_materials())
+        .add_descriptor_set_layout(m_ds_layout_clusters)
         .add_descriptor_set_layout(m_ds_layout_indirect_compute_buffer)
         .add_descriptor_set_layout(m_ds_layout_large_triangle_buffer);
 
@@ -55,41 +108,99 @@ void ComputeVoxelizer::create_voxelizer_pipeline_state(dw::vk::Backend::Ptr back
     m_pipeline_large_triangle = dw::vk::ComputePipeline::create(backend, pso_desc3);
     m_pipeline_large_triangle->set_name("Voxelizer::m_compute_voxelizer_compute_pipeline_large_triangle");
 
+    // triangle setup
+    dw::vk::ShaderModule::Ptr     cs4 = dw::vk::ShaderModule::create_from_file(backend, "shaders/triangle_setup.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc4;
+    pso_desc4.set_shader_stage(cs4, "main");
+
+    pso_desc4.set_pipeline_layout(m_pipeline_layout);
+    m_pipeline_triangle_setup = dw::vk::ComputePipeline::create(backend, pso_desc4);
+    m_pipeline_triangle_setup->set_name("Voxelizer::m_compute_voxelizer_compute_pipeline_triangle_setup");
+
+    // meshlet culling
+    dw::vk::ShaderModule::Ptr     cs5 = dw::vk::ShaderModule::create_from_file(backend, "shaders/meshlet_cull.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc5;
+    pso_desc5.set_shader_stage(cs5, "main");
+
+    pso_desc5.set_pipeline_layout(m_pipeline_layout);
+    m_pipeline_meshlet_cull = dw::vk::ComputePipeline::create(backend, pso_desc5);
+    m_pipeline_meshlet_cull->set_name("Voxelizer::m_compute_voxelizer_compute_pipeline_meshlet_cull");
+
+    // cluster batch prepare
+    dw::vk::ShaderModule::Ptr     cs6 = dw::vk::ShaderModule::create_from_file(backend, "shaders/cluster_batch_prepare.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc6;
+    pso_desc6.set_shader_stage(cs6, "main");
+
+    pso_desc6.set_pipeline_layout(m_pipeline_layout);
+    m_pipeline_cluster_batch_prepare = dw::vk::ComputePipeline::create(backend, pso_desc6);
+    m_pipeline_cluster_batch_prepare->set_name("Voxelizer::m_compute_voxelizer_compute_pipeline_cluster_batch_prepare");
+
+    // large triangles finalize
+    dw::vk::ShaderModule::Ptr     cs7 = dw::vk::ShaderModule::create_from_file(backend, "shaders/large_triangles_finalize.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc7;
+    pso_desc7.set_shader_stage(cs7, "main");
+
+    pso_desc7.set_pipeline_layout(m_pipeline_layout);
+    m_pipeline_large_triangles_finalize = dw::vk::ComputePipeline::create(backend, pso_desc7);
+    m_pipeline_large_triangles_finalize->set_name("Voxelizer::m_compute_voxelizer_compute_pipeline_large_triangles_finalize");
 }
 
-void ComputeVoxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend, std::vector<RenderObject>& objects)
+void ComputeVoxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend, Scene& scene)
 {
     // Large triangle buffer
     m_large_triangle_buffer_size = backend->aligned_dynamic_ubo_size(sizeof(LargeTriangle) * 200000);
     m_large_triangle_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_large_triangle_buffer_size, VMA_MEMORY_USAGE_GPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
     m_large_triangle_buffer->set_name("ComputeVoxelizer::m_large_triangle_buffer");
 
+    // The cluster list and the batches are sized for the clusters inside the grid, so no batch is recorded empty and
+    // none is dropped. Each cluster of a batch owns kMeshletTriangles triangle records, whether its meshlet is full
+    // or not.
+    uint32_t grid_cluster_count = count_grid_clusters(scene, get_AABB());
+    uint32_t cluster_count      = std::max(grid_cluster_count, 1u);
+
+    m_cluster_batch_count = (grid_cluster_count + kClusterBatchSize - 1) / kClusterBatchSize;
+
+    DW_LOG_INFO("(ComputeVoxelizer) " + std::to_string(grid_cluster_count) + " clusters inside the grid, " + std::to_string(m_cluster_batch_count) + " batches");
+
+    m_triangle_record_buffer_size = sizeof(TriangleRecord) * Scene::kMeshletTriangles * std::min(cluster_count, kClusterBatchSize);
+    m_triangle_record_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_triangle_record_buffer_size, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_triangle_record_buffer->set_name("ComputeVoxelizer::m_triangle_record_buffer");
+
     dw::vk::DescriptorSetLayout::Desc desc_large_triangle_buffer;
     desc_large_triangle_buffer.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc_large_triangle_buffer.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
     m_ds_layout_large_triangle_buffer = dw::vk::DescriptorSetLayout::create(backend, desc_large_triangle_buffer);
     m_ds_layout_large_triangle_buffer->set_name("ComputeVoxelizer::m_ds_layout_large_triangle_buffer");
 
-    m_ds_large_triangle_buffer = backend->allocate_descriptor_set(m_ds_layout_large_triangle_buffer);
+    m_ds_large_triangle_buffer = allocate_descriptor_set(backend, m_ds_layout_large_triangle_buffer);
     m_ds_large_triangle_buffer->set_name("ComputeVoxelizer::m_ds_large_triangle_buffer");
 
-    VkDescriptorBufferInfo buffer_info_large_triangle;
-    buffer_info_large_triangle.buffer = m_large_triangle_buffer->handle();
-    buffer_info_large_triangle.offset = 0;
-    buffer_info_large_triangle.range  = m_large_triangle_buffer_size;
+    VkDescriptorBufferInfo buffer_info_large_triangle[2];
+    buffer_info_large_triangle[0].buffer = m_large_triangle_buffer->handle();
+    buffer_info_large_triangle[0].offset = 0;
+    buffer_info_large_triangle[0].range  = m_large_triangle_buffer_size;
 
-    VkWriteDescriptorSet write_data_large_triangle;
-    DW_ZERO_MEMORY(write_data_large_triangle);
-    write_data_large_triangle.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data_large_triangle.descriptorCount = 1;
-    write_data_large_triangle.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_data_large_triangle.pBufferInfo     = &buffer_info_large_triangle;
-    write_data_large_triangle.dstBinding      = 0;
-    write_data_large_triangle.dstSet          = m_ds_large_triangle_buffer->handle();
+    buffer_info_large_triangle[1].buffer = m_triangle_record_buffer->handle();
+    buffer_info_large_triangle[1].offset = 0;
+    buffer_info_large_triangle[1].range  = m_triangle_record_buffer_size;
 
-    vkUpdateDescriptorSets(backend->device(), 1, &write_data_large_triangle, 0, nullptr);
+    VkWriteDescriptorSet write_data_large_triangle[2];
+
+    for (int i = 0; i < 2; i++)
+    {
+        DW_ZERO_MEMORY(write_data_large_triangle[i]);
+        write_data_large_triangle[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_data_large_triangle[i].descriptorCount = 1;
+        write_data_large_triangle[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write_data_large_triangle[i].pBufferInfo     = &buffer_info_large_triangle[i];
+        write_data_large_triangle[i].dstBinding      = i;
+        write_data_large_triangle[i].dstSet          = m_ds_large_triangle_buffer->handle();
+    }
+
+    vkUpdateDescriptorSets(backend->device(), 2, write_data_large_triangle, 0, nullptr);
 
     // indirect compute buffer
-    m_indirect_compute_buffer_size = backend->aligned_dynamic_ubo_size(sizeof(VkDispatchIndirectCommand));
+    m_indirect_compute_buffer_size = backend->aligned_dynamic_ubo_size(sizeof(ComputeVoxelizerIndirectCommands));
     m_indirect_compute_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_indirect_compute_buffer_size, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
     m_indirect_compute_buffer->set_name("ComputeVoxelizer::m_indirect_compute_buffer");
 
@@ -98,15 +209,20 @@ void ComputeVoxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend, std:
     indirect_command.y = 1;
     indirect_command.z = 1;
 
+    ComputeVoxelizerIndirectCommands indirect_commands;
+    DW_ZERO_MEMORY(indirect_commands);
+    indirect_commands.large_triangles = indirect_command;
+    indirect_commands.clusters        = indirect_command;
+
     uint8_t* ptr = (uint8_t*)m_indirect_compute_buffer->mapped_ptr();
-    memcpy(ptr, &indirect_command, sizeof(VkDispatchIndirectCommand));
+    memcpy(ptr, &indirect_commands, sizeof(ComputeVoxelizerIndirectCommands));
 
     dw::vk::DescriptorSetLayout::Desc desc_indirect_compute_buffer;
     desc_indirect_compute_buffer.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
     m_ds_layout_indirect_compute_buffer = dw::vk::DescriptorSetLayout::create(backend, desc_indirect_compute_buffer);
     m_ds_layout_indirect_compute_buffer->set_name("ComputeVoxelizer::m_ds_layout_indirect_compute_buffer");
 
-    m_ds_indirect_compute_buffer = backend->allocate_descriptor_set(m_ds_layout_indirect_compute_buffer);
+    m_ds_indirect_compute_buffer = allocate_descriptor_set(backend, m_ds_layout_indirect_compute_buffer);
     m_ds_indirect_compute_buffer->set_name("ComputeVoxelizer::m_ds_indirect_compute_buffer");
 
     VkDescriptorBufferInfo buffer_info_indirect_compute;
@@ -125,145 +241,52 @@ void ComputeVoxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend, std:
 
     vkUpdateDescriptorSets(backend->device(), 1, &write_data_indirect_compute, 0, nullptr);
 
-    // submesh count
-    uint32_t submesh_count = 0;
-    for (auto object : objects)
-    {
-		auto mesh = object.mesh;
-		submesh_count += mesh->sub_meshes().size();
-	}
-
-    // bindless
     dw::vk::DescriptorSetLayout::Desc desc;
-    for (int i = 0; i < 5; i++)
-    {
-        desc.add_binding(i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, submesh_count, VK_SHADER_STAGE_ALL);
-    }
-    m_ds_layout_bindless = dw::vk::DescriptorSetLayout::create(backend, desc);
-    m_ds_layout_bindless->set_name("ComputeVoxelizer::ds_layout_bindless");
 
-    m_ds_bindless = backend->allocate_descriptor_set(m_ds_layout_bindless);
-    m_ds_bindless->set_name("ComputeVoxelizer::ds_bindless");
+    // Cluster list, filled by the culling pass every voxelization.
+    m_cluster_buffer_size = sizeof(uint32_t) * 2 * cluster_count;
+    m_cluster_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_cluster_buffer_size, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_cluster_buffer->set_name("ComputeVoxelizer::m_cluster_buffer");
 
-    std::vector<VkDescriptorImageInfo> image_infos[5];
-    for (int i = 0; i < 5; i++) { image_infos[i] = std::vector<VkDescriptorImageInfo>(); }
+    // The scene's instances and this frame's work counters share the set, which keeps the pipeline layout within
+    // 8 sets. The counters are dynamic, offset to the current frame when the set is bound.
+    DW_ZERO_MEMORY(desc);
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout_clusters = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout_clusters->set_name("ComputeVoxelizer::m_ds_layout_clusters");
 
-    std::vector<uint32_t> triangle_submesh_map;
+    m_ds_clusters = allocate_descriptor_set(backend, m_ds_layout_clusters);
+    m_ds_clusters->set_name("ComputeVoxelizer::m_ds_clusters");
 
-    for (auto object : objects)
-    {
-        auto        mesh      = object.mesh;
-        const auto& submeshes = mesh->sub_meshes();
+    VkDescriptorBufferInfo buffer_info[3];
+    buffer_info[0].buffer = m_cluster_buffer->handle();
+    buffer_info[0].offset = 0;
+    buffer_info[0].range  = m_cluster_buffer_size;
 
-        for (uint32_t i = 0; i < submeshes.size(); i++)
-        {
-            auto& submesh = submeshes[i];
-            auto& mat     = mesh->material(submesh.mat_idx);
-
-            VkDescriptorImageInfo image_info[5];
-
-            image_info[0].sampler = dw::Material::common_sampler()->handle();
-            // image_info[0].imageView   = mat->m_albedo_idx != -1 ? mat->m_image_views[mat->m_albedo_idx]->handle() : mat->m_default_image_view->handle();
-            image_info[0].imageView   = mat->m_albedo_idx != -1 ? mat->m_image_views[mat->m_albedo_idx]->handle() : mat->m_default_image_view->handle();
-            image_info[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_infos[0].push_back(image_info[0]);
-
-            image_info[1].sampler     = dw::Material::common_sampler()->handle();
-            image_info[1].imageView   = mat->m_albedo_idx != -1 ? mat->m_image_views[mat->m_albedo_idx]->handle() : mat->m_default_image_view->handle();
-            image_info[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_infos[1].push_back(image_info[1]);
-
-            image_info[2].sampler     = dw::Material::common_sampler()->handle();
-            image_info[2].imageView   = mat->m_albedo_idx != -1 ? mat->m_image_views[mat->m_albedo_idx]->handle() : mat->m_default_image_view->handle();
-            image_info[2].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_infos[2].push_back(image_info[2]);
-
-            image_info[3].sampler     = dw::Material::common_sampler()->handle();
-            image_info[3].imageView   = mat->m_albedo_idx != -1 ? mat->m_image_views[mat->m_albedo_idx]->handle() : mat->m_default_image_view->handle();
-            image_info[3].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_infos[3].push_back(image_info[3]);
-
-            image_info[4].sampler     = dw::Material::common_sampler()->handle();
-            image_info[4].imageView   = mat->m_albedo_idx != -1 ? mat->m_image_views[mat->m_albedo_idx]->handle() : mat->m_default_image_view->handle();
-            image_info[4].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            image_infos[4].push_back(image_info[4]);
-
-            // add triangles to map
-            uint32_t triangle_count = submesh.index_count / 3;
-            for (int j = 0; j < triangle_count; j++) {
-                triangle_submesh_map.push_back(i);
-            }
-        }
-    }
+    buffer_info[1].buffer = scene.m_instance_buffer->handle();
+    buffer_info[1].offset = 0;
+    buffer_info[1].range  = VK_WHOLE_SIZE;
 
-    VkWriteDescriptorSet write_data[5];
-    for (int i = 0; i < 5; i++) { DW_ZERO_MEMORY(write_data[i]); }
-
-    write_data[0].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data[0].descriptorCount = image_infos[0].size();
-    write_data[0].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    write_data[0].pImageInfo      = image_infos[0].data();
-    write_data[0].dstBinding      = 0;
-    write_data[0].dstSet          = m_ds_bindless->handle();
-
-    write_data[1].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data[1].descriptorCount = image_infos[1].size();
-    write_data[1].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    write_data[1].pImageInfo      = image_infos[1].data();
-    write_data[1].dstBinding      = 1;
-    write_data[1].dstSet          = m_ds_bindless->handle();
-
-    write_data[2].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data[2].descriptorCount = image_infos[2].size();
-    write_data[2].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    write_data[2].pImageInfo      = image_infos[2].data();
-    write_data[2].dstBinding      = 2;
-    write_data[2].dstSet          = m_ds_bindless->handle();
-
-    write_data[3].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data[3].descriptorCount = image_infos[3].size();
-    write_data[3].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    write_data[3].pImageInfo      = image_infos[3].data();
-    write_data[3].dstBinding      = 3;
-    write_data[3].dstSet          = m_ds_bindless->handle();
-
-    write_data[4].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data[4].descriptorCount = image_infos[4].size();
-    write_data[4].descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    write_data[4].pImageInfo      = image_infos[4].data();
-    write_data[4].dstBinding      = 4;
-    write_data[4].dstSet          = m_ds_bindless->handle();
-
-    vkUpdateDescriptorSets(backend->device(), 5, write_data, 0, nullptr);
-
-    // bindless buffer
-    m_bindless_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(uint32_t) * triangle_submesh_map.size(), VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
-    m_bindless_buffer->set_name("ComputeVoxelizer::m_bindless_buffer");
-    memcpy(m_bindless_buffer->mapped_ptr(), triangle_submesh_map.data(), sizeof(uint32_t) * triangle_submesh_map.size());
+    buffer_info[2].buffer = WorkCounters::get().counter_buffer()->handle();
+    buffer_info[2].offset = 0;
+    buffer_info[2].range  = sizeof(WorkCounterValues);
 
-    DW_ZERO_MEMORY(desc);
-    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
-    m_ds_layout_bindless_buffer = dw::vk::DescriptorSetLayout::create(backend, desc);
-    m_ds_layout_bindless_buffer->set_name("ComputeVoxelizer::m_ds_layout_bindless_buffer");
-
-    m_ds_bindless_buffer = backend->allocate_descriptor_set(m_ds_layout_bindless_buffer);
-    m_ds_bindless_buffer->set_name("ComputeVoxelizer::m_ds_bindless_buffer");
-
-    VkDescriptorBufferInfo buffer_info;
-    buffer_info.buffer = m_bindless_buffer->handle();
-    buffer_info.offset = 0;
-    buffer_info.range  = sizeof(uint32_t) * triangle_submesh_map.size();
-
-    VkWriteDescriptorSet write_data2;
-    DW_ZERO_MEMORY(write_data2);
-    write_data2.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data2.descriptorCount = 1;
-    write_data2.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_data2.pBufferInfo     = &buffer_info;
-    write_data2.dstBinding      = 0;
-    write_data2.dstSet          = m_ds_bindless_buffer->handle();
-
-    vkUpdateDescriptorSets(backend->device(), 1, &write_data2, 0, nullptr);
+    VkWriteDescriptorSet write_data2[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+        DW_ZERO_MEMORY(write_data2[i]);
+        write_data2[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_data2[i].descriptorCount = 1;
+        write_data2[i].descriptorType  = i == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write_data2[i].pBufferInfo     = &buffer_info[i];
+        write_data2[i].dstBinding      = i;
+        write_data2[i].dstSet          = m_ds_clusters->handle();
+    }
+
+    vkUpdateDescriptorSets(backend->device(), 3, write_data2, 0, nullptr);
 }
 
 void ComputeVoxelizer::begin_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend)
@@ -278,15 +301,15 @@ void ComputeVoxelizer::begin_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf, dw
     uint8_t* ptr = (uint8_t*)m_ubo_data->mapped_ptr();
     memcpy(ptr + m_ubo_size * backend->current_frame_idx(), &m_data, sizeof(VoxelizerData));
 
-    uint32_t offset = 0;
+    uint32_t offset         = 0;
+    uint32_t counter_offset = WorkCounters::get().counter_offset();
 
-	vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_correct_texcoords->handle());
+	vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_meshlet_cull->handle());
 
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 0, 1, &m_ds_image->handle(), 0, 0);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 1, 1, &m_ds_data->handle(), 1, &offset);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 2, 1, &m_ds_view_proj_ubo->handle(), 1, &offset);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 4, 1, &m_ds_bindless->handle(), 0, 0);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 5, 1, &m_ds_bindless_buffer->handle(), 0, 0);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 5, 1, &m_ds_clusters->handle(), 1, &counter_offset);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 6, 1, &m_ds_indirect_compute_buffer->handle(), 0, 0);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 7, 1, &m_ds_large_triangle_buffer->handle(), 0, 0);
 }
@@ -302,15 +325,15 @@ void ComputeVoxelizer::begin_large_triangle_voxelization(dw::vk::CommandBuffer::
     uint8_t* ptr = (uint8_t*)m_ubo_data->mapped_ptr();
     memcpy(ptr + m_ubo_size * backend->current_frame_idx(), &m_data, sizeof(VoxelizerData));
 
-    uint32_t offset = 0;
+    uint32_t offset         = 0;
+    uint32_t counter_offset = WorkCounters::get().counter_offset();
 
     vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_large_triangle->handle());
 
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 0, 1, &m_ds_image->handle(), 0, 0);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 1, 1, &m_ds_data->handle(), 1, &offset);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 2, 1, &m_ds_view_proj_ubo->handle(), 1, &offset);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 4, 1, &m_ds_bindless->handle(), 0, 0);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 5, 1, &m_ds_bindless_buffer->handle(), 0, 0);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 5, 1, &m_ds_clusters->handle(), 1, &counter_offset);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 6, 1, &m_ds_indirect_compute_buffer->handle(), 0, 0);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 7, 1, &m_ds_large_triangle_buffer->handle(), 0, 0);
 }
@@ -368,39 +391,144 @@ void ComputeVoxelizer::large_triangle_buffer_memory_barrier(dw::vk::CommandBuffe
 	vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
-void ComputeVoxelizer::voxelize(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, std::vector<RenderObject>& objects)
+void ComputeVoxelizer::triangle_record_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer                = m_triangle_record_buffer->handle();
+    barrier.srcAccessMask         = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask         = VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.size                  = m_triangle_record_buffer_size;
+    barrier.offset                = 0;
+    barrier.pNext                 = nullptr;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void ComputeVoxelizer::cluster_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf)
 {
-    DW_SCOPED_SAMPLE("Compute Voxelizer", cmd_buf);
+    // The cluster list is read by the setup and small triangle passes, the cluster count by their indirect dispatch.
+    VkBufferMemoryBarrier barriers[2] = {};
 
+    for (int i = 0; i < 2; i++)
     {
-        DW_SCOPED_SAMPLE("Small Triangles", cmd_buf);
-        VkDeviceSize offset = 0;
+        barriers[i].sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barriers[i].srcAccessMask       = VK_ACCESS_SHADER_WRITE_BIT;
+        barriers[i].dstAccessMask       = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].offset              = 0;
+        barriers[i].pNext               = nullptr;
+    }
 
-        for (auto object : objects)
-        {
-            auto mesh = object.mesh;
+    barriers[0].buffer = m_cluster_buffer->handle();
+    barriers[0].size   = m_cluster_buffer_size;
+    barriers[1].buffer = m_indirect_compute_buffer->handle();
+    barriers[1].size   = m_indirect_compute_buffer_size;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 2, barriers, 0, nullptr);
+}
+
+void ComputeVoxelizer::indirect_compute_buffer_memory_barrier(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    // The counts written by one pass are read by the next and by the indirect dispatches.
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer                = m_indirect_compute_buffer->handle();
+    barrier.srcAccessMask         = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask         = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.size                  = m_indirect_compute_buffer_size;
+    barrier.offset                = 0;
+    barrier.pNext                 = nullptr;
 
-            vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 3, 1, &object.m_ds_vertex_index->handle(), 0, 0);
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void ComputeVoxelizer::voxelize(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Scene& scene)
+{
+    VCT_SCOPED_SAMPLE("Compute Voxelizer", cmd_buf);
+
+    // The merged index buffer holds global vertex indices, so every mesh shares one set of buffers and a single
+    // large triangle pass. Meshlets outside the grid are culled first, setup then transforms the triangles of the
+    // surviving clusters once into records and the small and large triangle passes only read records. The last
+    // three run once per batch of the clusters counted at creation.
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 3, 1, &scene.m_ds_voxel_geometry->handle(), 0, 0);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 4, 1, &scene.m_ds_materials->handle(), 0, 0);
+
+    WorkCounters::get().begin_counters(cmd_buf, WORK_COUNTERS_VOXELIZER, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    {
+        VCT_SCOPED_SAMPLE("Meshlet Culling", cmd_buf);
+        ScopedPassStatistics statistics("Meshlet Culling", cmd_buf);
 
-            int local_size      = 32;
-            int triangle_count  = mesh->indices().size() / 3;
-            int workgroup_count = ceil(double(triangle_count) / double(local_size));
+        // One dispatch per unique mesh covering all of its instances (y = instance).
+        for (const auto& mesh : scene.meshes)
+        {
+            int local_size      = 64;
+            int workgroup_count = ceil(double(mesh.meshlet_count) / double(local_size));
 
-            m_push_constants.model          = object.get_model();
-            m_push_constants.triangle_count = triangle_count;
+            m_push_constants.first_instance = mesh.first_instance;
+            m_push_constants.first_meshlet  = mesh.first_meshlet;
+            m_push_constants.meshlet_count  = mesh.meshlet_count;
 
             vkCmdPushConstants(cmd_buf->handle(), m_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeVoxelizerPushConstants), &m_push_constants);
-            vkCmdDispatch(cmd_buf->handle(), workgroup_count, 1, 1);
-        }    
-    
+            vkCmdDispatch(cmd_buf->handle(), workgroup_count, mesh.instance_count, 1);
+        }
     }
-    debug_barrier(cmd_buf);
+    cluster_buffer_memory_barrier(cmd_buf);
+
     {
-        DW_SCOPED_SAMPLE("Large Triangles", cmd_buf);
-        begin_large_triangle_voxelization(cmd_buf, backend);
-        vkCmdDispatchIndirect(cmd_buf->handle(), m_indirect_compute_buffer->handle(), 0);
+        // The GpuProfiler and WorkCounters add up the samples and passes of every batch by name, the framework
+        // profiler only sees the batches as a whole.
+        DW_SCOPED_SAMPLE("Cluster Batches", cmd_buf);
+
+        for (uint32_t batch = 0; batch < m_cluster_batch_count; batch++)
+        {
+            m_push_constants.first_cluster = batch * kClusterBatchSize;
+
+            vkCmdPushConstants(cmd_buf->handle(), m_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeVoxelizerPushConstants), &m_push_constants);
+            vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_cluster_batch_prepare->handle());
+            vkCmdDispatch(cmd_buf->handle(), 1, 1, 1);
+
+            indirect_compute_buffer_memory_barrier(cmd_buf);
+            {
+                ScopedGpuSample      sample("Triangle Setup", cmd_buf);
+                ScopedPassStatistics statistics("Triangle Setup", cmd_buf);
+                vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_triangle_setup->handle());
+                vkCmdDispatchIndirect(cmd_buf->handle(), m_indirect_compute_buffer->handle(), offsetof(ComputeVoxelizerIndirectCommands, clusters));
+            }
+            triangle_record_buffer_memory_barrier(cmd_buf);
+            {
+                ScopedGpuSample      sample("Small Triangles", cmd_buf);
+                ScopedPassStatistics statistics("Small Triangles", cmd_buf);
+                vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_correct_texcoords->handle());
+                vkCmdDispatchIndirect(cmd_buf->handle(), m_indirect_compute_buffer->handle(), offsetof(ComputeVoxelizerIndirectCommands, clusters));
+            }
+            indirect_compute_buffer_memory_barrier(cmd_buf);
+
+            vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_large_triangles_finalize->handle());
+            vkCmdDispatch(cmd_buf->handle(), 1, 1, 1);
+
+            indirect_compute_buffer_memory_barrier(cmd_buf);
+            debug_barrier(cmd_buf);
+            {
+                ScopedGpuSample      sample("Large Triangles", cmd_buf);
+                ScopedPassStatistics statistics("Large Triangles", cmd_buf);
+                begin_large_triangle_voxelization(cmd_buf, backend);
+                vkCmdDispatchIndirect(cmd_buf->handle(), m_indirect_compute_buffer->handle(), 0);
+            }
+
+            // The next batch overwrites the counts, the records and the large triangle list read by this one.
+            vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 0, nullptr);
+        }
     }
 
+    WorkCounters::get().end_counters(cmd_buf, WORK_COUNTERS_VOXELIZER, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
     vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 0, nullptr);
 }
 
@@ -408,3 +536,14 @@ void ComputeVoxelizer::end_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf)
 {
 
 }
+
+void ComputeVoxelizer::report_memory(GpuMemoryReport& report) const
+{
+    Voxelizer::report_memory(report);
+
+    // The bindless material table is a descriptor set of the scene's textures, it owns no memory of its own.
+    report.add("ComputeVoxelizer", "Large triangle buffer", m_large_triangle_buffer);
+    report.add("ComputeVoxelizer", "Triangle record buffer", m_triangle_record_buffer);
+    report.add("ComputeVoxelizer", "Cluster buffer", m_cluster_buffer);
+    report.add("ComputeVoxelizer", "Indirect dispatch buffer", m_indirect_compute_buffer);
+}
@@ -0,0 +1,216 @@
+#include "FrustumCuller.h"
+#include "GpuProfiler.h"
+#include <macros.h>
+#include <profiler.h>
+#include <imgui.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+
+static void write_storage_buffer(dw::vk::Backend::Ptr backend, dw::vk::DescriptorSet::Ptr ds, uint32_t binding, dw::vk::Buffer::Ptr buffer)
+{
+    VkDescriptorBufferInfo buffer_info;
+    VkWriteDescriptorSet   write_data;
+
+    DW_ZERO_MEMORY(buffer_info);
+    DW_ZERO_MEMORY(write_data);
+
+    buffer_info.buffer = buffer->handle();
+    buffer_info.offset = 0;
+    buffer_info.range  = VK_WHOLE_SIZE;
+
+    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data.descriptorCount = 1;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data.pBufferInfo     = &buffer_info;
+    write_data.dstBinding      = binding;
+    write_data.dstSet          = ds->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+}
+
+FrustumCuller::FrustumCuller(dw::vk::Backend::Ptr backend, Scene& scene, uint32_t view_count) :
+    m_scene(scene), m_view_count(view_count)
+{
+    m_draw_count         = scene.m_draw_commands.size();
+    m_max_instance_count = 0;
+
+    for (const auto& command : scene.m_draw_commands)
+        m_max_instance_count = std::max(m_max_instance_count, command.instanceCount);
+
+    m_stats.resize(view_count);
+    for (auto& stats : m_stats)
+        DW_ZERO_MEMORY(stats);
+
+    create_buffers(backend);
+    create_descriptor_sets(backend);
+}
+
+void FrustumCuller::create_buffers(dw::vk::Backend::Ptr backend)
+{
+    std::vector<VkDrawIndexedIndirectCommand> cleared_commands = m_scene.m_draw_commands;
+
+    for (auto& command : cleared_commands)
+        command.instanceCount = 0;
+
+    m_cleared_draw_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(VkDrawIndexedIndirectCommand) * m_draw_count, VMA_MEMORY_USAGE_GPU_ONLY, 0, cleared_commands.data());
+    m_cleared_draw_buffer->set_name("FrustumCuller::m_cleared_draw_buffer");
+
+    size_t draw_instance_count = 0;
+
+    for (const auto& command : m_scene.m_draw_commands)
+        draw_instance_count += command.instanceCount;
+
+    for (uint32_t i = 0; i < m_view_count * dw::vk::Backend::kMaxFramesInFlight; i++)
+    {
+        m_draw_buffers.push_back(dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(VkDrawIndexedIndirectCommand) * m_draw_count, VMA_MEMORY_USAGE_GPU_ONLY, 0));
+        m_draw_buffers.back()->set_name("FrustumCuller::m_draw_buffers");
+
+        m_draw_instance_buffers.push_back(dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(SceneDrawInstance) * draw_instance_count, VMA_MEMORY_USAGE_GPU_ONLY, 0));
+        m_draw_instance_buffers.back()->set_name("FrustumCuller::m_draw_instance_buffers");
+
+        m_stats_buffers.push_back(dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(FrustumCullStats), VMA_MEMORY_USAGE_GPU_TO_CPU, VMA_ALLOCATION_CREATE_MAPPED_BIT));
+        m_stats_buffers.back()->set_name("FrustumCuller::m_stats_buffers");
+    }
+}
+
+void FrustumCuller::create_descriptor_sets(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::DescriptorSetLayout::Desc desc_draws;
+    desc_draws.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc_draws.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout_draws = dw::vk::DescriptorSetLayout::create(backend, desc_draws);
+    m_ds_layout_draws->set_name("FrustumCuller::m_ds_layout_draws");
+
+    dw::vk::DescriptorSetLayout::Desc desc_output;
+    desc_output.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc_output.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc_output.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout_output = dw::vk::DescriptorSetLayout::create(backend, desc_output);
+    m_ds_layout_output->set_name("FrustumCuller::m_ds_layout_output");
+
+    m_ds_draws = backend->allocate_descriptor_set(m_ds_layout_draws);
+    m_ds_draws->set_name("FrustumCuller::m_ds_draws");
+
+    write_storage_buffer(backend, m_ds_draws, 0, m_scene.m_indirect_buffer);
+    write_storage_buffer(backend, m_ds_draws, 1, m_scene.m_draw_bounds_buffer);
+
+    for (uint32_t i = 0; i < m_draw_buffers.size(); i++)
+    {
+        m_ds_output.push_back(backend->allocate_descriptor_set(m_ds_layout_output));
+        m_ds_output.back()->set_name("FrustumCuller::m_ds_output");
+
+        write_storage_buffer(backend, m_ds_output.back(), 0, m_draw_buffers[i]);
+        write_storage_buffer(backend, m_ds_output.back(), 1, m_draw_instance_buffers[i]);
+        write_storage_buffer(backend, m_ds_output.back(), 2, m_stats_buffers[i]);
+
+        // Same layout as the scene's instance set, with the draw instances replaced by the culled ones.
+        m_ds_instances.push_back(backend->allocate_descriptor_set(Scene::get_ds_layout_instances()));
+        m_ds_instances.back()->set_name("FrustumCuller::m_ds_instances");
+
+        write_storage_buffer(backend, m_ds_instances.back(), 0, m_scene.m_instance_buffer);
+        write_storage_buffer(backend, m_ds_instances.back(), 1, m_draw_instance_buffers[i]);
+    }
+}
+
+void FrustumCuller::create_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::ShaderModule::Ptr     cs = dw::vk::ShaderModule::create_from_file(backend, "shaders/frustum_cull.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc;
+    pso_desc.set_shader_stage(cs, "main");
+
+    dw::vk::PipelineLayout::Desc pl_desc;
+    pl_desc.add_descriptor_set_layout(Scene::get_ds_layout_instances())
+        .add_descriptor_set_layout(m_ds_layout_draws)
+        .add_descriptor_set_layout(m_ds_layout_output);
+    pl_desc.add_push_constant_range(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FrustumCullPushConstants));
+    m_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+    m_pipeline_layout->set_name("FrustumCuller::m_pipeline_layout");
+
+    pso_desc.set_pipeline_layout(m_pipeline_layout);
+    m_pipeline = dw::vk::ComputePipeline::create(backend, pso_desc);
+}
+
+void FrustumCuller::cull(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, uint32_t view, const glm::mat4& view_projection)
+{
+    VCT_SCOPED_SAMPLE("Frustum culling", cmd_buf);
+
+    uint32_t idx = view * dw::vk::Backend::kMaxFramesInFlight + backend->current_frame_idx();
+
+    // The frame that last used this slot has finished, keep its counts before they are cleared.
+    memcpy(&m_stats[view], m_stats_buffers[idx]->mapped_ptr(), sizeof(FrustumCullStats));
+
+    VkBufferCopy region;
+    region.srcOffset = 0;
+    region.dstOffset = 0;
+    region.size      = sizeof(VkDrawIndexedIndirectCommand) * m_draw_count;
+
+    vkCmdCopyBuffer(cmd_buf->handle(), m_cleared_draw_buffer->handle(), m_draw_buffers[idx]->handle(), 1, &region);
+    vkCmdFillBuffer(cmd_buf->handle(), m_stats_buffers[idx]->handle(), 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier barrier;
+    DW_ZERO_MEMORY(barrier);
+    barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Gribb-Hartmann plane extraction, normalized so that the bounds test can use distances.
+    FrustumCullPushConstants push_constants;
+
+    glm::mat4 m = glm::transpose(view_projection);
+
+    push_constants.planes[0]  = m[3] + m[0];
+    push_constants.planes[1]  = m[3] - m[0];
+    push_constants.planes[2]  = m[3] + m[1];
+    push_constants.planes[3]  = m[3] - m[1];
+    push_constants.planes[4]  = m[3] + m[2];
+    push_constants.planes[5]  = m[3] - m[2];
+    push_constants.draw_count = m_draw_count;
+
+    for (int i = 0; i < 6; i++)
+        push_constants.planes[i] /= glm::length(glm::vec3(push_constants.planes[i]));
+
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->handle());
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 0, 1, &m_scene.m_ds_instances->handle(), 0, nullptr);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 1, 1, &m_ds_draws->handle(), 0, nullptr);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout->handle(), 2, 1, &m_ds_output[idx]->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(FrustumCullPushConstants), &push_constants);
+
+    // x = instance within the draw, y = draw.
+    const uint32_t local_size = 64;
+    vkCmdDispatch(cmd_buf->handle(), (m_max_instance_count + local_size - 1) / local_size, m_draw_count, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void FrustumCuller::draw(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, dw::vk::PipelineLayout::Ptr pipeline_layout, uint32_t instance_set, uint32_t view)
+{
+    uint32_t idx = view * dw::vk::Backend::kMaxFramesInFlight + backend->current_frame_idx();
+
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout->handle(), instance_set, 1, &m_ds_instances[idx]->handle(), 0, nullptr);
+    m_scene.draw(cmd_buf, m_draw_buffers[idx]);
+}
+
+void FrustumCuller::gui(const char* const* view_names, uint32_t view_count)
+{
+    for (uint32_t i = 0; i < std::min(view_count, m_view_count); i++)
+        ImGui::Text("%s: %u drawn, %u culled, %u triangles", view_names[i], m_stats[i].drawn_instances, m_stats[i].culled_instances, m_stats[i].drawn_triangles);
+}
+
+void FrustumCuller::report_memory(GpuMemoryReport& report) const
+{
+    report.add("FrustumCuller", "Cleared draws", m_cleared_draw_buffer);
+
+    for (const auto& buffer : m_draw_buffers)
+        report.add("FrustumCuller", "Culled draws", buffer);
+
+    for (const auto& buffer : m_draw_instance_buffers)
+        report.add("FrustumCuller", "Culled draw instances", buffer);
+
+    for (const auto& buffer : m_stats_buffers)
+        report.add("FrustumCuller", "Statistics", buffer);
+}
@@ -233,9 +233,10 @@ void GeometryVoxelizer::create_voxelization_pipeline_state(dw::vk::Backend::Ptr
 
     dw::vk::PipelineLayout::Desc pl_desc;
 
-    pl_desc.add_descriptor_set_layout(dw::Material::descriptor_set_layout())
+    pl_desc.add_descriptor_set_layout(Scene::get_ds_layout_materials())
         .add_descriptor_set_layout(m_ds_layout_ubo_dynamic)
-        .add_descriptor_set_layout(m_ds_layout_image);
+        .add_descriptor_set_layout(m_ds_layout_image)
+        .add_descriptor_set_layout(Scene::get_ds_layout_instances());
     pl_desc.add_push_constant_range(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants));
 
     m_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
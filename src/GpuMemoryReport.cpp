@@ -0,0 +1,156 @@
+#include "GpuMemoryReport.h"
+#include <imgui.h>
+#include <json.hpp>
+#include <logger.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+#include <fstream>
+
+static double to_mb(VkDeviceSize size)
+{
+    return double(size) / (1024.0 * 1024.0);
+}
+
+void GpuMemoryReport::begin(dw::vk::Backend::Ptr backend)
+{
+    m_backend          = backend;
+    m_attributed_bytes = 0;
+    m_entries.clear();
+}
+
+void GpuMemoryReport::end()
+{
+    VmaStats stats;
+    vmaCalculateStats(m_backend->allocator(), &stats);
+
+    m_used_bytes       = stats.total.usedBytes;
+    m_unused_bytes     = stats.total.unusedBytes;
+    m_allocation_count = stats.total.allocationCount;
+    m_block_count      = stats.total.blockCount;
+
+    m_backend.reset();
+}
+
+void GpuMemoryReport::add(const std::string& subsystem, const std::string& name, dw::vk::Buffer::Ptr buffer)
+{
+    if (!buffer)
+        return;
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(m_backend->device(), buffer->handle(), &requirements);
+
+    add(subsystem, name, requirements.size);
+}
+
+void GpuMemoryReport::add(const std::string& subsystem, const std::string& name, dw::vk::Image::Ptr image)
+{
+    if (!image)
+        return;
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(m_backend->device(), image->handle(), &requirements);
+
+    add(subsystem, name, requirements.size);
+}
+
+void GpuMemoryReport::add(const std::string& subsystem, const std::string& name, VkDeviceSize size)
+{
+    m_entries.push_back({ subsystem, name, size });
+    m_attributed_bytes += size;
+}
+
+std::vector<GpuMemorySubsystem> GpuMemoryReport::subsystems() const
+{
+    std::vector<GpuMemorySubsystem> subsystems;
+
+    for (const auto& entry : m_entries)
+    {
+        auto it = std::find_if(subsystems.begin(), subsystems.end(), [&entry](const GpuMemorySubsystem& subsystem) { return subsystem.name == entry.subsystem; });
+
+        if (it == subsystems.end())
+            subsystems.push_back({ entry.subsystem, entry.size, 1 });
+        else
+        {
+            it->size += entry.size;
+            it->resource_count++;
+        }
+    }
+
+    return subsystems;
+}
+
+bool GpuMemoryReport::write_json(const std::string& path) const
+{
+    std::ofstream file(path);
+
+    if (!file)
+    {
+        DW_LOG_ERROR("(GpuMemoryReport) Failed to open " + path + " for writing");
+        return false;
+    }
+
+    nlohmann::json subsystems = nlohmann::json::array();
+
+    for (const auto& subsystem : this->subsystems())
+    {
+        nlohmann::json resources = nlohmann::json::array();
+
+        for (const auto& entry : m_entries)
+        {
+            if (entry.subsystem != subsystem.name)
+                continue;
+
+            nlohmann::json resource;
+
+            resource["name"]  = entry.name;
+            resource["bytes"] = entry.size;
+
+            resources.push_back(resource);
+        }
+
+        nlohmann::json json_subsystem;
+
+        json_subsystem["name"]      = subsystem.name;
+        json_subsystem["bytes"]     = subsystem.size;
+        json_subsystem["resources"] = resources;
+
+        subsystems.push_back(json_subsystem);
+    }
+
+    nlohmann::json json;
+
+    json["vma_used_bytes"]     = m_used_bytes;
+    json["vma_unused_bytes"]   = m_unused_bytes;
+    json["vma_allocations"]    = m_allocation_count;
+    json["vma_blocks"]         = m_block_count;
+    json["attributed_bytes"]   = m_attributed_bytes;
+    json["unattributed_bytes"] = unattributed_bytes();
+    json["subsystems"]         = subsystems;
+
+    file << json.dump(4) << "\n";
+
+    DW_LOG_INFO("(GpuMemoryReport) Wrote " + path);
+
+    return true;
+}
+
+void GpuMemoryReport::gui()
+{
+    ImGui::Text("VMA: %.1f MB used in %u allocations, %.1f MB free in %u blocks", to_mb(m_used_bytes), m_allocation_count, to_mb(m_unused_bytes), m_block_count);
+    ImGui::Text("Attributed: %.1f MB, unattributed: %.1f MB", to_mb(m_attributed_bytes), to_mb(unattributed_bytes()));
+    ImGui::Separator();
+
+    for (const auto& subsystem : subsystems())
+    {
+        if (!ImGui::TreeNode(subsystem.name.c_str(), "%s: %.2f MB (%u)", subsystem.name.c_str(), to_mb(subsystem.size), subsystem.resource_count))
+            continue;
+
+        for (const auto& entry : m_entries)
+        {
+            if (entry.subsystem == subsystem.name)
+                ImGui::BulletText("%s: %.3f MB", entry.name.c_str(), to_mb(entry.size));
+        }
+
+        ImGui::TreePop();
+    }
+}
@@ -0,0 +1,226 @@
+#include "GpuProfiler.h"
+#include <macros.h>
+#include <algorithm>
+
+GpuProfiler& GpuProfiler::get()
+{
+    static GpuProfiler profiler;
+    return profiler;
+}
+
+void GpuProfiler::initialize(dw::vk::Backend::Ptr backend)
+{
+    m_backend = backend;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(backend->physical_device(), &properties);
+
+    m_timestamp_period_ms = double(properties.limits.timestampPeriod) / 1000000.0;
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(backend->physical_device(), &family_count, nullptr);
+
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(backend->physical_device(), &family_count, families.data());
+
+    // Queues without valid timestamp bits simply record no samples.
+    const auto& queue_infos = backend->queue_infos();
+
+    m_queue_valid[GPU_QUEUE_GRAPHICS] = families[queue_infos.graphics_queue_index].timestampValidBits > 0;
+    m_queue_valid[GPU_QUEUE_COMPUTE]  = families[queue_infos.compute_queue_index].timestampValidBits > 0;
+
+    VkQueryPoolCreateInfo pool_info;
+    DW_ZERO_MEMORY(pool_info);
+
+    pool_info.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = kMaxSamples * 2;
+
+    m_frames.resize(dw::vk::Backend::kMaxFramesInFlight);
+
+    for (auto& frame : m_frames)
+    {
+        for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+        {
+            vkCreateQueryPool(backend->device(), &pool_info, nullptr, &frame.query_pools[i]);
+
+            frame.query_counts[i] = 0;
+            frame.reset[i]        = false;
+        }
+
+        frame.trace_frame = 0;
+    }
+
+    pool_info.queryCount = 1;
+    vkCreateQueryPool(backend->device(), &pool_info, nullptr, &m_calibration_query_pool);
+}
+
+void GpuProfiler::shutdown()
+{
+    for (auto& frame : m_frames)
+    {
+        for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+            vkDestroyQueryPool(m_backend->device(), frame.query_pools[i], nullptr);
+    }
+
+    vkDestroyQueryPool(m_backend->device(), m_calibration_query_pool, nullptr);
+
+    m_frames.clear();
+    m_samples.clear();
+    m_backend.reset();
+}
+
+void GpuProfiler::begin_frame()
+{
+    m_frame_idx = m_backend->current_frame_idx();
+
+    Frame& frame = m_frames[m_frame_idx];
+
+    // Each query is followed by its availability, graphics work of this slot is known to be done but the
+    // compute queue may still be busy with it.
+    std::vector<uint64_t> results[GPU_QUEUE_COUNT];
+
+    for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+    {
+        if (frame.query_counts[i] == 0)
+            continue;
+
+        results[i].resize(frame.query_counts[i] * 2);
+        vkGetQueryPoolResults(m_backend->device(), frame.query_pools[i], 0, frame.query_counts[i], sizeof(uint64_t) * results[i].size(), results[i].data(), sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    }
+
+    m_samples.clear();
+
+    for (const auto& pending : frame.pending)
+    {
+        const uint64_t* start = &results[pending.queue][pending.query * 2];
+        const uint64_t* end   = &results[pending.queue][(pending.query + 1) * 2];
+
+        if (!start[1] || !end[1])
+            continue;
+
+        GpuSample sample;
+
+        sample.name     = pending.name;
+        sample.queue    = pending.queue;
+        sample.depth    = pending.depth;
+        sample.start_ms = double(start[0]) * m_timestamp_period_ms;
+        sample.end_ms   = double(end[0]) * m_timestamp_period_ms;
+
+        m_samples.push_back(sample);
+        TraceRecorder::get().record_gpu(frame.trace_frame, sample.name, sample.queue, sample.start_ms, sample.end_ms);
+    }
+
+    for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+    {
+        frame.query_counts[i] = 0;
+        frame.reset[i]        = false;
+    }
+
+    frame.trace_frame = TraceRecorder::get().current_frame();
+    frame.pending.clear();
+    m_open_samples.clear();
+    m_active_queue = GPU_QUEUE_COUNT;
+}
+
+void GpuProfiler::begin_command_buffer(dw::vk::CommandBuffer::Ptr cmd_buf, GpuQueue queue)
+{
+    Frame& frame = m_frames[m_frame_idx];
+
+    if (!frame.reset[queue])
+    {
+        vkCmdResetQueryPool(cmd_buf->handle(), frame.query_pools[queue], 0, kMaxSamples * 2);
+        frame.reset[queue] = true;
+    }
+
+    m_active_queue = queue;
+}
+
+void GpuProfiler::begin_sample(const std::string& name, dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    Frame& frame = m_frames[m_frame_idx];
+
+    if (m_active_queue == GPU_QUEUE_COUNT || !m_queue_valid[m_active_queue] || frame.query_counts[m_active_queue] + 2 > kMaxSamples * 2)
+    {
+        m_open_samples.push_back(-1);
+        return;
+    }
+
+    PendingSample pending;
+
+    pending.name  = name;
+    pending.queue = m_active_queue;
+    pending.depth = m_open_samples.size();
+    pending.query = frame.query_counts[m_active_queue];
+
+    frame.query_counts[m_active_queue] += 2;
+
+    vkCmdWriteTimestamp(cmd_buf->handle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.query_pools[pending.queue], pending.query);
+
+    m_open_samples.push_back(frame.pending.size());
+    frame.pending.push_back(pending);
+}
+
+void GpuProfiler::end_sample(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    if (m_open_samples.empty())
+        return;
+
+    int32_t index = m_open_samples.back();
+    m_open_samples.pop_back();
+
+    if (index < 0)
+        return;
+
+    Frame&               frame   = m_frames[m_frame_idx];
+    const PendingSample& pending = frame.pending[index];
+
+    vkCmdWriteTimestamp(cmd_buf->handle(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.query_pools[pending.queue], pending.query + 1);
+}
+
+double GpuProfiler::sample_ms(const std::string& name) const
+{
+    double total = -1.0;
+
+    for (const auto& sample : m_samples)
+    {
+        if (sample.name == name)
+            total = std::max(total, 0.0) + (sample.end_ms - sample.start_ms);
+    }
+
+    return total;
+}
+
+double GpuProfiler::calibrate()
+{
+    dw::vk::CommandBuffer::Ptr cmd_buf = m_backend->allocate_graphics_command_buffer();
+
+    VkCommandBufferBeginInfo begin_info;
+    DW_ZERO_MEMORY(begin_info);
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
+    vkCmdResetQueryPool(cmd_buf->handle(), m_calibration_query_pool, 0, 1);
+    vkCmdWriteTimestamp(cmd_buf->handle(), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_calibration_query_pool, 0);
+    vkEndCommandBuffer(cmd_buf->handle());
+
+    VkSubmitInfo submit_info;
+    DW_ZERO_MEMORY(submit_info);
+
+    submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers    = &cmd_buf->handle();
+
+    // With nothing else queued the timestamp is written between submission and the wait returning.
+    vkQueueWaitIdle(m_backend->graphics_queue());
+
+    double submit_ms = TraceRecorder::get().now_ms();
+    vkQueueSubmit(m_backend->graphics_queue(), 1, &submit_info, VK_NULL_HANDLE);
+    vkQueueWaitIdle(m_backend->graphics_queue());
+    double complete_ms = TraceRecorder::get().now_ms();
+
+    uint64_t timestamp = 0;
+    vkGetQueryPoolResults(m_backend->device(), m_calibration_query_pool, 0, 1, sizeof(uint64_t), &timestamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+    return (submit_ms + complete_ms) * 0.5 - double(timestamp) * m_timestamp_period_ms;
+}
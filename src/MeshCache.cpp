@@ -0,0 +1,412 @@
+#include "MeshCache.h"
+#include "ThreadPool.h"
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <stb_image.h>
+#include <logger.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#    define NOMINMAX
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+
+    HANDLE mapping = size.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    m_file    = file;
+    m_mapping = mapping;
+    m_data    = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    m_size    = size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = (const uint8_t*)data;
+    m_size = st.st_size;
+#endif
+
+    if (!m_data)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+#if defined(_WIN32)
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+
+    m_mapping = nullptr;
+    m_file    = nullptr;
+#else
+    if (m_data)
+        munmap((void*)m_data, m_size);
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+static bool source_stats(const std::string& path, uint64_t& size, int64_t& time)
+{
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    size = st.st_size;
+    time = st.st_mtime;
+
+    return true;
+}
+
+static uint64_t align16(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+std::string MeshCache::cache_path(const std::string& source_path)
+{
+    return source_path + ".vctcache";
+}
+
+std::shared_ptr<MeshCache> MeshCache::load(const std::string& source_path)
+{
+    uint64_t source_size = 0;
+    int64_t  source_time = 0;
+
+    if (!source_stats(source_path, source_size, source_time))
+    {
+        DW_LOG_ERROR("(MeshCache) Source model not found: " + source_path);
+        return nullptr;
+    }
+
+    std::string                path  = cache_path(source_path);
+    std::shared_ptr<MeshCache> cache = std::make_shared<MeshCache>();
+
+    if (!cache->m_file.open(path) || !cache->validate(source_size, source_time))
+    {
+        cache->m_file.close();
+
+        if (!build(source_path, path, source_size, source_time) || !cache->m_file.open(path) || !cache->validate(source_size, source_time))
+        {
+            DW_LOG_ERROR("(MeshCache) Failed to build mesh cache: " + path);
+            return nullptr;
+        }
+
+        cache->m_built = true;
+    }
+
+    return cache;
+}
+
+bool MeshCache::validate(uint64_t source_size, int64_t source_time) const
+{
+    if (m_file.size() < sizeof(MeshCacheHeader))
+        return false;
+
+    const MeshCacheHeader& h = header();
+
+    return h.magic == kMagic && h.version == kVersion && h.source_size == source_size && h.source_time == source_time && h.file_size == m_file.size();
+}
+
+// Spreads the low 10 bits of v so that there are two zero bits between each of them.
+static uint32_t expand_bits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30 bit Morton code of a point inside the box, 10 bits per axis.
+static uint32_t morton_code(const glm::vec3& p, const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 n = glm::clamp((p - min) / glm::max(max - min, glm::vec3(1e-6f)), 0.0f, 1.0f) * 1023.0f;
+    return (expand_bits((uint32_t)n.x) << 2) | (expand_bits((uint32_t)n.y) << 1) | expand_bits((uint32_t)n.z);
+}
+
+// Reorders the triangles of a submesh along a Morton curve through their centroids, so that consecutive
+// triangles, and therefore the meshlets cut from them, stay close together in space. Triangles never leave
+// their submesh, which keeps the material of every triangle unchanged.
+static void sort_triangles_morton(const std::vector<MeshCacheVertex>& vertices, uint32_t* indices, uint32_t triangle_count, const glm::vec3& min, const glm::vec3& max)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> keys(triangle_count);
+
+    for (uint32_t i = 0; i < triangle_count; i++)
+    {
+        glm::vec3 centroid = (glm::vec3(vertices[indices[i * 3]].position) + glm::vec3(vertices[indices[i * 3 + 1]].position) + glm::vec3(vertices[indices[i * 3 + 2]].position)) / 3.0f;
+        keys[i]            = std::make_pair(morton_code(centroid, min, max), i);
+    }
+
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> sorted(triangle_count * 3);
+
+    for (uint32_t i = 0; i < triangle_count; i++)
+        memcpy(&sorted[i * 3], &indices[keys[i].second * 3], sizeof(uint32_t) * 3);
+
+    memcpy(indices, sorted.data(), sizeof(uint32_t) * sorted.size());
+}
+
+static void generate_mip_chain(const uint8_t* pixels, uint32_t width, uint32_t height, std::vector<uint8_t>& data, uint32_t& mip_levels)
+{
+    mip_levels = 1;
+    data.assign(pixels, pixels + width * height * 4);
+
+    size_t   src_offset = 0;
+    uint32_t src_width  = width;
+    uint32_t src_height = height;
+
+    // 2x2 box filter down to 1x1, edges are clamped for odd sizes.
+    while (src_width > 1 || src_height > 1)
+    {
+        uint32_t dst_width  = std::max(src_width / 2, 1u);
+        uint32_t dst_height = std::max(src_height / 2, 1u);
+        size_t   dst_offset = data.size();
+
+        data.resize(dst_offset + dst_width * dst_height * 4);
+
+        for (uint32_t y = 0; y < dst_height; y++)
+        {
+            for (uint32_t x = 0; x < dst_width; x++)
+            {
+                uint32_t x0 = std::min(x * 2, src_width - 1);
+                uint32_t x1 = std::min(x * 2 + 1, src_width - 1);
+                uint32_t y0 = std::min(y * 2, src_height - 1);
+                uint32_t y1 = std::min(y * 2 + 1, src_height - 1);
+
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    uint32_t sum = data[src_offset + (y0 * src_width + x0) * 4 + c] +
+                                   data[src_offset + (y0 * src_width + x1) * 4 + c] +
+                                   data[src_offset + (y1 * src_width + x0) * 4 + c] +
+                                   data[src_offset + (y1 * src_width + x1) * 4 + c];
+
+                    data[dst_offset + (y * dst_width + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+                }
+            }
+        }
+
+        src_offset = dst_offset;
+        src_width  = dst_width;
+        src_height = dst_height;
+        mip_levels++;
+    }
+}
+
+bool MeshCache::build(const std::string& source_path, const std::string& cache_path, uint64_t source_size, int64_t source_time)
+{
+    Assimp::Importer importer;
+    const aiScene*   scene = importer.ReadFile(source_path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs);
+
+    if (!scene)
+    {
+        DW_LOG_ERROR("(MeshCache) Failed to import " + source_path + ": " + importer.GetErrorString());
+        return false;
+    }
+
+    std::vector<MeshCacheVertex>  vertices;
+    std::vector<uint32_t>         indices;
+    std::vector<MeshCacheSubmesh> submeshes;
+
+    for (uint32_t i = 0; i < scene->mNumMeshes; i++)
+    {
+        const aiMesh* mesh        = scene->mMeshes[i];
+        uint32_t      base_vertex = vertices.size();
+
+        for (uint32_t j = 0; j < mesh->mNumVertices; j++)
+        {
+            MeshCacheVertex vertex;
+
+            vertex.position  = glm::vec4(mesh->mVertices[j].x, mesh->mVertices[j].y, mesh->mVertices[j].z, 1.0f);
+            vertex.texcoord  = mesh->HasTextureCoords(0) ? glm::vec4(mesh->mTextureCoords[0][j].x, mesh->mTextureCoords[0][j].y, 0.0f, 0.0f) : glm::vec4(0.0f);
+            vertex.normal    = mesh->HasNormals() ? glm::vec4(mesh->mNormals[j].x, mesh->mNormals[j].y, mesh->mNormals[j].z, 0.0f) : glm::vec4(0.0f);
+            vertex.tangent   = mesh->HasTangentsAndBitangents() ? glm::vec4(mesh->mTangents[j].x, mesh->mTangents[j].y, mesh->mTangents[j].z, 0.0f) : glm::vec4(0.0f);
+            vertex.bitangent = mesh->HasTangentsAndBitangents() ? glm::vec4(mesh->mBitangents[j].x, mesh->mBitangents[j].y, mesh->mBitangents[j].z, 0.0f) : glm::vec4(0.0f);
+
+            vertices.push_back(vertex);
+        }
+
+        MeshCacheSubmesh submesh;
+
+        submesh.first_index = indices.size();
+        submesh.material    = mesh->mMaterialIndex;
+        submesh.padding     = 0;
+        submesh.min         = glm::vec4(FLT_MAX, FLT_MAX, FLT_MAX, 1.0f);
+        submesh.max         = glm::vec4(-FLT_MAX, -FLT_MAX, -FLT_MAX, 1.0f);
+
+        for (uint32_t j = 0; j < mesh->mNumFaces; j++)
+        {
+            // Points and lines left over after triangulation are dropped.
+            if (mesh->mFaces[j].mNumIndices != 3)
+                continue;
+
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                uint32_t index = base_vertex + mesh->mFaces[j].mIndices[k];
+
+                submesh.min = glm::min(submesh.min, vertices[index].position);
+                submesh.max = glm::max(submesh.max, vertices[index].position);
+
+                indices.push_back(index);
+            }
+        }
+
+        submesh.index_count = indices.size() - submesh.first_index;
+        submeshes.push_back(submesh);
+    }
+
+    // Submeshes are independent ranges of the index buffer, sorted on the pool like the textures below.
+    ThreadPool::global().parallel_for(submeshes.size(), [&](uint32_t i) {
+        const MeshCacheSubmesh& submesh = submeshes[i];
+
+        if (submesh.index_count > 0)
+            sort_triangles_morton(vertices, &indices[submesh.first_index], submesh.index_count / 3, glm::vec3(submesh.min), glm::vec3(submesh.max));
+    });
+
+    std::string directory = source_path.substr(0, source_path.find_last_of("/\\") + 1);
+
+    std::vector<MeshCacheTexture>     textures(scene->mNumMaterials);
+    std::vector<std::vector<uint8_t>> texture_data(scene->mNumMaterials);
+
+    // Decoding and mip generation dominate cache builds, every material is handled by its own job.
+    ThreadPool::global().parallel_for(scene->mNumMaterials, [&](uint32_t i) {
+        MeshCacheTexture& texture = textures[i];
+        aiString          texture_path;
+
+        memset(&texture, 0, sizeof(MeshCacheTexture));
+
+        if (scene->mMaterials[i]->GetTexture(aiTextureType_DIFFUSE, 0, &texture_path) != AI_SUCCESS)
+            return;
+
+        int      width, height, channels;
+        uint8_t* pixels = stbi_load((directory + texture_path.C_Str()).c_str(), &width, &height, &channels, 4);
+
+        if (!pixels)
+        {
+            DW_LOG_ERROR("(MeshCache) Failed to load texture: " + directory + texture_path.C_Str());
+            return;
+        }
+
+        texture.width  = width;
+        texture.height = height;
+
+        generate_mip_chain(pixels, width, height, texture_data[i], texture.mip_levels);
+        stbi_image_free(pixels);
+
+        texture.data_size = texture_data[i].size();
+    });
+
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(MeshCacheHeader));
+
+    header.magic          = kMagic;
+    header.version        = kVersion;
+    header.source_size    = source_size;
+    header.source_time    = source_time;
+    header.vertex_count   = vertices.size();
+    header.index_count    = indices.size();
+    header.submesh_count  = submeshes.size();
+    header.texture_count  = textures.size();
+    header.vertex_offset  = align16(sizeof(MeshCacheHeader));
+    header.index_offset   = align16(header.vertex_offset + sizeof(MeshCacheVertex) * vertices.size());
+    header.submesh_offset = align16(header.index_offset + sizeof(uint32_t) * indices.size());
+    header.texture_offset = align16(header.submesh_offset + sizeof(MeshCacheSubmesh) * submeshes.size());
+
+    uint64_t offset = align16(header.texture_offset + sizeof(MeshCacheTexture) * textures.size());
+
+    for (auto& texture : textures)
+    {
+        texture.data_offset = offset;
+        offset              = align16(offset + texture.data_size);
+    }
+
+    header.file_size = offset;
+
+    std::ofstream file(cache_path, std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+        return false;
+
+    auto write_section = [&](uint64_t section_offset, const void* data, size_t size) {
+        static const char zeros[16] = {};
+        uint64_t          position  = (uint64_t)file.tellp();
+
+        file.write(zeros, section_offset - position);
+        file.write((const char*)data, size);
+    };
+
+    write_section(0, &header, sizeof(MeshCacheHeader));
+    write_section(header.vertex_offset, vertices.data(), sizeof(MeshCacheVertex) * vertices.size());
+    write_section(header.index_offset, indices.data(), sizeof(uint32_t) * indices.size());
+    write_section(header.submesh_offset, submeshes.data(), sizeof(MeshCacheSubmesh) * submeshes.size());
+    write_section(header.texture_offset, textures.data(), sizeof(MeshCacheTexture) * textures.size());
+
+    for (uint32_t i = 0; i < textures.size(); i++)
+        write_section(textures[i].data_offset, texture_data[i].data(), texture_data[i].size());
+
+    write_section(header.file_size, nullptr, 0);
+
+    return file.good();
+}
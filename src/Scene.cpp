@@ -0,0 +1,877 @@
+#include "Scene.h"
+#include "StartupTimeline.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <unordered_map>
+#include <json.hpp>
+#include <gtc/quaternion.hpp>
+#include <gtc/matrix_transform.hpp>
+#include <logger.h>
+
+dw::vk::DescriptorSetLayout::Ptr m_ds_layout_instances;
+dw::vk::DescriptorSetLayout::Ptr m_ds_layout_materials;
+dw::vk::DescriptorSetLayout::Ptr m_ds_layout_voxel_geometry;
+dw::vk::VertexInputStateDesc     m_vertex_input_state_desc;
+
+const uint32_t Scene::kMeshletTriangles;
+
+void Scene::initialize_common_resources(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::DescriptorSetLayout::Desc desc;
+    DW_ZERO_MEMORY(desc);
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_GEOMETRY_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout_instances = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout_instances->set_name("Scene::m_ds_layout_instances");
+
+    DW_ZERO_MEMORY(desc);
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout_voxel_geometry = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout_voxel_geometry->set_name("Scene::m_ds_layout_voxel_geometry");
+
+    m_vertex_input_state_desc.add_binding_desc(0, sizeof(MeshCacheVertex));
+    m_vertex_input_state_desc.add_attribute_desc(0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(MeshCacheVertex, position));
+    m_vertex_input_state_desc.add_attribute_desc(1, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(MeshCacheVertex, texcoord));
+    m_vertex_input_state_desc.add_attribute_desc(2, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(MeshCacheVertex, normal));
+    m_vertex_input_state_desc.add_attribute_desc(3, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(MeshCacheVertex, tangent));
+    m_vertex_input_state_desc.add_attribute_desc(4, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(MeshCacheVertex, bitangent));
+}
+
+dw::vk::DescriptorSetLayout::Ptr Scene::get_ds_layout_instances()
+{
+    return m_ds_layout_instances;
+}
+
+const dw::vk::VertexInputStateDesc& Scene::vertex_input_state_desc()
+{
+    return m_vertex_input_state_desc;
+}
+
+dw::vk::DescriptorSetLayout::Ptr Scene::get_ds_layout_materials()
+{
+    return m_ds_layout_materials;
+}
+
+dw::vk::DescriptorSetLayout::Ptr Scene::get_ds_layout_voxel_geometry()
+{
+    return m_ds_layout_voxel_geometry;
+}
+
+void Scene::reset_ds_layout_instances()
+{
+    m_ds_layout_instances.reset();
+    m_ds_layout_materials.reset();
+    m_ds_layout_voxel_geometry.reset();
+}
+
+static glm::vec3 read_vec3(const nlohmann::json& json, const char* key, glm::vec3 default_value)
+{
+    if (json.find(key) == json.end())
+        return default_value;
+
+    const auto& value = json[key];
+
+    if (value.is_number())
+        return glm::vec3(value.get<float>());
+
+    return glm::vec3(value[0].get<float>(), value[1].get<float>(), value[2].get<float>());
+}
+
+static glm::mat4 read_transform(const nlohmann::json& json)
+{
+    glm::vec3 position = read_vec3(json, "position", glm::vec3(0.0f));
+    glm::vec3 rotation = read_vec3(json, "rotation", glm::vec3(0.0f));
+    glm::vec3 scale    = read_vec3(json, "scale", glm::vec3(1.0f));
+
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model           = model * glm::mat4_cast(glm::quat(glm::radians(rotation)));
+    model           = glm::scale(model, scale);
+
+    return model;
+}
+
+std::unique_ptr<Scene> Scene::read(const std::string& path)
+{
+    ScopedStartupPhase phase("Scene: read " + path);
+
+    std::ifstream file(path);
+
+    if (!file.is_open())
+    {
+        DW_LOG_ERROR("(Scene) Failed to open scene file: " + path);
+        return nullptr;
+    }
+
+    nlohmann::json json;
+
+    try
+    {
+        file >> json;
+    }
+    catch (const std::exception& e)
+    {
+        DW_LOG_ERROR("(Scene) Failed to parse scene file: " + path + " (" + e.what() + ")");
+        return nullptr;
+    }
+
+    // Meshes are deduplicated by path, several names may refer to the same file.
+    std::unordered_map<std::string, uint32_t> mesh_indices_by_name;
+    std::unordered_map<std::string, uint32_t> mesh_indices_by_path;
+    std::vector<std::string>                  mesh_paths;
+
+    for (const auto& mesh : json["meshes"])
+    {
+        std::string name      = mesh["name"].get<std::string>();
+        std::string mesh_path = mesh["path"].get<std::string>();
+
+        auto it = mesh_indices_by_path.find(mesh_path);
+
+        if (it == mesh_indices_by_path.end())
+        {
+            it = mesh_indices_by_path.insert({ mesh_path, (uint32_t)mesh_paths.size() }).first;
+            mesh_paths.push_back(mesh_path);
+        }
+
+        mesh_indices_by_name[name] = it->second;
+    }
+
+    std::vector<std::vector<SceneInstance>> instances_per_mesh(mesh_paths.size());
+
+    for (const auto& instance : json["instances"])
+    {
+        std::string mesh_name = instance["mesh"].get<std::string>();
+        auto        it        = mesh_indices_by_name.find(mesh_name);
+
+        if (it == mesh_indices_by_name.end())
+        {
+            DW_LOG_ERROR("(Scene) Instance refers to unknown mesh: " + mesh_name);
+            return nullptr;
+        }
+
+        SceneInstance scene_instance;
+        scene_instance.model = read_transform(instance);
+
+        instances_per_mesh[it->second].push_back(scene_instance);
+    }
+
+    std::unique_ptr<Scene> scene = std::make_unique<Scene>();
+
+    for (uint32_t i = 0; i < mesh_paths.size(); i++)
+    {
+        // Meshes without instances are never drawn, don't load them.
+        if (instances_per_mesh[i].empty())
+            continue;
+
+        SceneMesh mesh;
+
+        mesh.path           = mesh_paths[i];
+        mesh.first_instance = scene->instances.size();
+        mesh.instance_count = instances_per_mesh[i].size();
+        mesh.first_triangle = 0;
+        mesh.triangle_count = 0;
+        mesh.first_draw     = 0;
+        mesh.draw_count     = 0;
+        mesh.first_texture  = 0;
+        mesh.first_meshlet  = 0;
+        mesh.meshlet_count  = 0;
+
+        scene->meshes.push_back(mesh);
+        scene->instances.insert(scene->instances.end(), instances_per_mesh[i].begin(), instances_per_mesh[i].end());
+    }
+
+    // Caches are mapped, or built from the source model on a miss, in parallel.
+    ThreadPool::global().parallel_for(scene->meshes.size(), [&](uint32_t i) {
+        SceneMesh&         mesh = scene->meshes[i];
+        ScopedStartupPhase mesh_phase("Mesh cache: " + mesh.path);
+
+        mesh.cache = MeshCache::load(mesh.path);
+    });
+
+    for (const auto& mesh : scene->meshes)
+    {
+        if (!mesh.cache)
+        {
+            DW_LOG_ERROR("(Scene) Failed to load mesh: " + mesh.path);
+            return nullptr;
+        }
+
+        DW_LOG_INFO("(Scene) " + mesh.path + (mesh.cache->built() ? ": cache miss, built " : ": cache hit, mapped ") + MeshCache::cache_path(mesh.path));
+    }
+
+    if (scene->meshes.empty())
+    {
+        DW_LOG_ERROR("(Scene) Scene contains no instances: " + path);
+        return nullptr;
+    }
+
+    return scene;
+}
+
+void Scene::create_gpu_resources(dw::vk::Backend::Ptr backend)
+{
+    ScopedStartupPhase phase("Scene: GPU resources");
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // Without these features every draw is recorded on the CPU instead.
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(backend->physical_device(), &features);
+    m_multi_draw_indirect = features.multiDrawIndirect && features.drawIndirectFirstInstance;
+
+    upload_geometry_and_textures(backend);
+    create_material_table(backend);
+    create_draw_buffers(backend);
+    create_meshlets(backend);
+    create_geometry_descriptor_set(backend);
+    create_instance_buffer(backend);
+
+    // The mapped files are only needed for the bounds, draws and meshlets above, the GPU copies are complete.
+    for (auto& mesh : meshes)
+        mesh.cache.reset();
+
+    double upload_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+
+    DW_LOG_INFO("(Scene) Created GPU resources for " + std::to_string(meshes.size()) + " unique meshes, " + std::to_string(instances.size()) + " instances in " + std::to_string(upload_time) + " ms");
+}
+
+static size_t align16(size_t offset)
+{
+    return (offset + 15) & ~size_t(15);
+}
+
+void Scene::upload_geometry_and_textures(dw::vk::Backend::Ptr backend)
+{
+    // Lay out every vertex, index and texel of the scene in one staging buffer: vertices, voxelization vertices,
+    // indices, the default texel and then each texture with its mips.
+    uint32_t vertex_count = 0;
+    uint32_t index_count  = 0;
+    size_t   texture_size = 0;
+
+    for (auto& mesh : meshes)
+    {
+        const MeshCacheHeader& header = mesh.cache->header();
+
+        vertex_count += header.vertex_count;
+        index_count += header.index_count;
+
+        for (uint32_t i = 0; i < header.texture_count; i++)
+            texture_size += align16(mesh.cache->textures()[i].data_size);
+    }
+
+    size_t vertex_size         = sizeof(MeshCacheVertex) * vertex_count;
+    size_t voxel_vertex_size   = sizeof(SceneVoxelVertex) * vertex_count;
+    size_t index_size          = sizeof(uint32_t) * index_count;
+    size_t voxel_vertex_offset = align16(vertex_size);
+    size_t index_offset        = align16(voxel_vertex_offset + voxel_vertex_size);
+    size_t default_offset = align16(index_offset + index_size);
+    size_t texture_offset = default_offset + 16;
+
+    dw::vk::Buffer::Ptr staging = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, texture_offset + texture_size, VMA_MEMORY_USAGE_CPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    staging->set_name("Scene::staging");
+
+    uint8_t*         ptr          = (uint8_t*)staging->mapped_ptr();
+    MeshCacheVertex*  vertices       = (MeshCacheVertex*)ptr;
+    SceneVoxelVertex* voxel_vertices = (SceneVoxelVertex*)(ptr + voxel_vertex_offset);
+    uint32_t*         indices        = (uint32_t*)(ptr + index_offset);
+    uint32_t          base_vertex    = 0;
+    uint32_t          first_index    = 0;
+    uint32_t          draw_count     = 0;
+    size_t            copy_offset    = texture_offset;
+    uint32_t          white          = 0xFFFFFFFF;
+
+    std::vector<SceneMeshQuantization> quantization(meshes.size());
+
+    memcpy(ptr + default_offset, &white, sizeof(uint32_t));
+
+    struct TextureCopy
+    {
+        VkImage                        image;
+        std::vector<VkBufferImageCopy> regions;
+    };
+
+    std::vector<TextureCopy> copies;
+
+    // Images and copy regions are created here, the staging writes themselves are deferred and run in parallel.
+    std::vector<std::function<void()>> writes;
+
+    for (uint32_t mesh_index = 0; mesh_index < meshes.size(); mesh_index++)
+    {
+        SceneMesh&             mesh   = meshes[mesh_index];
+        const MeshCacheHeader& header = mesh.cache->header();
+        const uint32_t*        src    = mesh.cache->indices();
+
+        // Cache indices address the mesh's own vertices, rebase them so that they address the merged vertex buffer
+        // directly, the compute voxelizer relies on it.
+        const MeshCacheVertex* src_vertices      = mesh.cache->vertices();
+        uint32_t               mesh_vertex_count = header.vertex_count;
+        uint32_t               mesh_index_count  = header.index_count;
+        SceneMeshQuantization* mesh_quantization = &quantization[mesh_index];
+
+        writes.push_back([=]() {
+            memcpy(vertices + base_vertex, src_vertices, sizeof(MeshCacheVertex) * mesh_vertex_count);
+
+            for (uint32_t i = 0; i < mesh_index_count; i++)
+                indices[first_index + i] = src[i] + base_vertex;
+
+            // Quantize against the bounds of every vertex, not just the indexed ones, so that nothing gets clamped.
+            glm::vec3 min = glm::vec3(FLT_MAX);
+            glm::vec3 max = glm::vec3(-FLT_MAX);
+
+            for (uint32_t i = 0; i < mesh_vertex_count; i++)
+            {
+                min = glm::min(min, glm::vec3(src_vertices[i].position));
+                max = glm::max(max, glm::vec3(src_vertices[i].position));
+            }
+
+            if (mesh_vertex_count == 0)
+                min = max = glm::vec3(0.0f);
+
+            glm::vec3 scale = glm::max(max - min, glm::vec3(1e-6f));
+
+            mesh_quantization->offset = glm::vec4(min, 0.0f);
+            mesh_quantization->scale  = glm::vec4(scale, 0.0f);
+
+            for (uint32_t i = 0; i < mesh_vertex_count; i++)
+            {
+                glm::vec3         normalized = (glm::vec3(src_vertices[i].position) - min) / scale;
+                SceneVoxelVertex& vertex     = voxel_vertices[base_vertex + i];
+
+                vertex.position_xy = glm::packUnorm2x16(glm::vec2(normalized.x, normalized.y));
+                vertex.position_z  = glm::packUnorm2x16(glm::vec2(normalized.z, 0.0f));
+                vertex.texcoord    = glm::packHalf2x16(glm::vec2(src_vertices[i].texcoord));
+            }
+        });
+
+        mesh.first_triangle = first_index / 3;
+        mesh.triangle_count = header.index_count / 3;
+        mesh.first_draw     = draw_count;
+        mesh.draw_count     = header.submesh_count;
+        mesh.first_texture  = m_textures.size();
+
+        for (uint32_t i = 0; i < header.texture_count; i++)
+        {
+            const MeshCacheTexture& texture = mesh.cache->textures()[i];
+
+            if (texture.width == 0)
+            {
+                m_textures.push_back(nullptr);
+                m_texture_views.push_back(nullptr);
+                continue;
+            }
+
+            dw::vk::Image::Ptr image = dw::vk::Image::create(backend, VK_IMAGE_TYPE_2D, texture.width, texture.height, 1, texture.mip_levels, 1, VK_FORMAT_R8G8B8A8_SRGB, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+            image->set_name("Scene::m_textures");
+
+            dw::vk::ImageView::Ptr view = dw::vk::ImageView::create(backend, image, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_COLOR_BIT, 0, texture.mip_levels, 0, 1);
+            view->set_name("Scene::m_texture_views");
+
+            const uint8_t* texture_data = mesh.cache->texture_data(texture);
+            uint8_t*       dst          = ptr + copy_offset;
+
+            size_t         size         = texture.data_size;
+
+            writes.push_back([=]() { memcpy(dst, texture_data, size); });
+
+            TextureCopy copy;
+            copy.image = image->handle();
+
+            size_t mip_offset = copy_offset;
+
+            for (uint32_t mip = 0; mip < texture.mip_levels; mip++)
+            {
+                uint32_t width  = std::max(texture.width >> mip, 1u);
+                uint32_t height = std::max(texture.height >> mip, 1u);
+
+                VkBufferImageCopy region;
+                DW_ZERO_MEMORY(region);
+
+                region.bufferOffset                = mip_offset;
+                region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                region.imageSubresource.mipLevel   = mip;
+                region.imageSubresource.layerCount = 1;
+                region.imageExtent                 = { width, height, 1 };
+
+                copy.regions.push_back(region);
+                mip_offset += width * height * 4;
+            }
+
+            copies.push_back(copy);
+            copy_offset += align16(texture.data_size);
+
+            m_textures.push_back(image);
+            m_texture_views.push_back(view);
+        }
+
+        base_vertex += header.vertex_count;
+        first_index += header.index_count;
+        draw_count += header.submesh_count;
+    }
+
+    ThreadPool::global().parallel_for(writes.size(), [&](uint32_t i) { writes[i](); });
+
+    m_vertex_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vertex_size, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_vertex_buffer->set_name("Scene::m_vertex_buffer");
+
+    m_voxel_vertex_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, voxel_vertex_size, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_voxel_vertex_buffer->set_name("Scene::m_voxel_vertex_buffer");
+
+    m_mesh_quantization_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(SceneMeshQuantization) * quantization.size(), VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_mesh_quantization_buffer->set_name("Scene::m_mesh_quantization_buffer");
+    memcpy(m_mesh_quantization_buffer->mapped_ptr(), quantization.data(), sizeof(SceneMeshQuantization) * quantization.size());
+
+    m_index_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, index_size, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_index_buffer->set_name("Scene::m_index_buffer");
+
+    m_default_texture = dw::vk::Image::create(backend, VK_IMAGE_TYPE_2D, 1, 1, 1, 1, 1, VK_FORMAT_R8G8B8A8_SRGB, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+    m_default_texture->set_name("Scene::m_default_texture");
+
+    m_default_texture_view = dw::vk::ImageView::create(backend, m_default_texture, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1);
+    m_default_texture_view->set_name("Scene::m_default_texture_view");
+
+    TextureCopy default_copy;
+    default_copy.image = m_default_texture->handle();
+    default_copy.regions.resize(1);
+
+    DW_ZERO_MEMORY(default_copy.regions[0]);
+    default_copy.regions[0].bufferOffset                = default_offset;
+    default_copy.regions[0].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    default_copy.regions[0].imageSubresource.layerCount = 1;
+    default_copy.regions[0].imageExtent                 = { 1, 1, 1 };
+
+    copies.push_back(default_copy);
+
+    dw::vk::Sampler::Desc sampler_desc;
+    DW_ZERO_MEMORY(sampler_desc);
+    sampler_desc.mag_filter     = VK_FILTER_LINEAR;
+    sampler_desc.min_filter     = VK_FILTER_LINEAR;
+    sampler_desc.mipmap_mode    = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_desc.address_mode_u = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_desc.address_mode_v = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_desc.address_mode_w = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    sampler_desc.mip_lod_bias   = 0.0f;
+    sampler_desc.max_anisotropy = 1.0f;
+    sampler_desc.min_lod        = 0.0f;
+    sampler_desc.max_lod        = VK_LOD_CLAMP_NONE;
+    sampler_desc.compare_enable = VK_FALSE;
+    sampler_desc.compare_op     = VK_COMPARE_OP_NEVER;
+    m_sampler                   = dw::vk::Sampler::create(backend, sampler_desc);
+    m_sampler->set_name("Scene::m_sampler");
+
+    // Record every copy into one command buffer and wait for it once.
+    std::vector<VkImageMemoryBarrier> barriers(copies.size());
+
+    for (uint32_t i = 0; i < copies.size(); i++)
+    {
+        DW_ZERO_MEMORY(barriers[i]);
+
+        barriers[i].sType                       = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barriers[i].srcAccessMask               = 0;
+        barriers[i].dstAccessMask               = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barriers[i].oldLayout                   = VK_IMAGE_LAYOUT_UNDEFINED;
+        barriers[i].newLayout                   = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barriers[i].srcQueueFamilyIndex         = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].dstQueueFamilyIndex         = VK_QUEUE_FAMILY_IGNORED;
+        barriers[i].image                       = copies[i].image;
+        barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barriers[i].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barriers[i].subresourceRange.layerCount = 1;
+    }
+
+    dw::vk::CommandBuffer::Ptr cmd_buf = backend->allocate_graphics_command_buffer();
+
+    VkCommandBufferBeginInfo begin_info;
+    DW_ZERO_MEMORY(begin_info);
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+
+    VkBufferCopy vertex_copy       = { 0, 0, vertex_size };
+    VkBufferCopy voxel_vertex_copy = { voxel_vertex_offset, 0, voxel_vertex_size };
+    VkBufferCopy index_copy        = { index_offset, 0, index_size };
+
+    vkCmdCopyBuffer(cmd_buf->handle(), staging->handle(), m_vertex_buffer->handle(), 1, &vertex_copy);
+    vkCmdCopyBuffer(cmd_buf->handle(), staging->handle(), m_voxel_vertex_buffer->handle(), 1, &voxel_vertex_copy);
+    vkCmdCopyBuffer(cmd_buf->handle(), staging->handle(), m_index_buffer->handle(), 1, &index_copy);
+
+    for (const auto& copy : copies)
+        vkCmdCopyBufferToImage(cmd_buf->handle(), staging->handle(), copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy.regions.size(), copy.regions.data());
+
+    for (auto& barrier : barriers)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, barriers.size(), barriers.data());
+
+    vkEndCommandBuffer(cmd_buf->handle());
+
+    VkSubmitInfo submit_info;
+    DW_ZERO_MEMORY(submit_info);
+
+    submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers    = &cmd_buf->handle();
+
+    vkQueueSubmit(backend->graphics_queue(), 1, &submit_info, VK_NULL_HANDLE);
+    vkQueueWaitIdle(backend->graphics_queue());
+}
+
+void Scene::create_geometry_descriptor_set(dw::vk::Backend::Ptr backend)
+{
+    m_ds_voxel_geometry = backend->allocate_descriptor_set(m_ds_layout_voxel_geometry);
+    m_ds_voxel_geometry->set_name("Scene::m_ds_voxel_geometry");
+
+    VkDescriptorBufferInfo buffer_info[4];
+    VkWriteDescriptorSet   write_data[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        DW_ZERO_MEMORY(buffer_info[i]);
+        DW_ZERO_MEMORY(write_data[i]);
+    }
+
+    buffer_info[0].buffer = m_voxel_vertex_buffer->handle();
+    buffer_info[0].offset = 0;
+    buffer_info[0].range  = VK_WHOLE_SIZE;
+
+    write_data[0].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data[0].descriptorCount = 1;
+    write_data[0].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data[0].pBufferInfo     = &buffer_info[0];
+    write_data[0].dstBinding      = 0;
+    write_data[0].dstSet          = m_ds_voxel_geometry->handle();
+
+    buffer_info[1].buffer = m_index_buffer->handle();
+    buffer_info[1].offset = 0;
+    buffer_info[1].range  = VK_WHOLE_SIZE;
+
+    write_data[1].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data[1].descriptorCount = 1;
+    write_data[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data[1].pBufferInfo     = &buffer_info[1];
+    write_data[1].dstBinding      = 1;
+    write_data[1].dstSet          = m_ds_voxel_geometry->handle();
+
+    buffer_info[2].buffer = m_mesh_quantization_buffer->handle();
+    buffer_info[2].offset = 0;
+    buffer_info[2].range  = VK_WHOLE_SIZE;
+
+    write_data[2].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data[2].descriptorCount = 1;
+    write_data[2].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data[2].pBufferInfo     = &buffer_info[2];
+    write_data[2].dstBinding      = 2;
+    write_data[2].dstSet          = m_ds_voxel_geometry->handle();
+
+    buffer_info[3].buffer = m_meshlet_buffer->handle();
+    buffer_info[3].offset = 0;
+    buffer_info[3].range  = VK_WHOLE_SIZE;
+
+    write_data[3].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data[3].descriptorCount = 1;
+    write_data[3].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data[3].pBufferInfo     = &buffer_info[3];
+    write_data[3].dstBinding      = 3;
+    write_data[3].dstSet          = m_ds_voxel_geometry->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 4, write_data, 0, nullptr);
+}
+
+void Scene::create_draw_buffers(dw::vk::Backend::Ptr backend)
+{
+    std::vector<SceneDrawInstance> draw_instances;
+
+    m_draw_commands.clear();
+    m_draw_bounds.clear();
+
+    for (const auto& mesh : meshes)
+    {
+        const MeshCacheSubmesh* submeshes   = mesh.cache->submeshes();
+        uint32_t                first_index = mesh.first_triangle * 3;
+
+        for (uint32_t i = 0; i < mesh.cache->header().submesh_count; i++)
+        {
+            const MeshCacheSubmesh& submesh = submeshes[i];
+
+            SceneDrawBounds bounds;
+
+            bounds.min = submesh.min;
+            bounds.max = submesh.max;
+
+            m_draw_bounds.push_back(bounds);
+
+            VkDrawIndexedIndirectCommand command;
+
+            command.indexCount    = submesh.index_count;
+            command.instanceCount = mesh.instance_count;
+            command.firstIndex    = first_index + submesh.first_index;
+            command.vertexOffset  = 0;
+            command.firstInstance = draw_instances.size();
+
+            uint32_t material = m_draw_materials[m_draw_commands.size()];
+
+            for (uint32_t j = 0; j < mesh.instance_count; j++)
+            {
+                SceneDrawInstance draw_instance;
+
+                draw_instance.instance = mesh.first_instance + j;
+                draw_instance.material = material;
+
+                draw_instances.push_back(draw_instance);
+            }
+
+            m_draw_commands.push_back(command);
+        }
+    }
+
+    m_indirect_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(VkDrawIndexedIndirectCommand) * m_draw_commands.size(), VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_indirect_buffer->set_name("Scene::m_indirect_buffer");
+    memcpy(m_indirect_buffer->mapped_ptr(), m_draw_commands.data(), sizeof(VkDrawIndexedIndirectCommand) * m_draw_commands.size());
+
+    m_draw_bounds_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(SceneDrawBounds) * m_draw_bounds.size(), VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_draw_bounds_buffer->set_name("Scene::m_draw_bounds_buffer");
+    memcpy(m_draw_bounds_buffer->mapped_ptr(), m_draw_bounds.data(), sizeof(SceneDrawBounds) * m_draw_bounds.size());
+
+    m_draw_instance_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(SceneDrawInstance) * draw_instances.size(), VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_draw_instance_buffer->set_name("Scene::m_draw_instance_buffer");
+    memcpy(m_draw_instance_buffer->mapped_ptr(), draw_instances.data(), sizeof(SceneDrawInstance) * draw_instances.size());
+}
+
+void Scene::create_material_table(dw::vk::Backend::Ptr backend)
+{
+    m_material_image_infos.clear();
+    m_draw_materials.clear();
+
+    // Materials are deduplicated by albedo view, submeshes sharing a material and all untextured submeshes end up
+    // with a single descriptor.
+    std::unordered_map<VkImageView, uint32_t> material_indices;
+
+    for (const auto& mesh : meshes)
+    {
+        const MeshCacheSubmesh* submeshes = mesh.cache->submeshes();
+
+        for (uint32_t i = 0; i < mesh.cache->header().submesh_count; i++)
+        {
+            auto&       view   = m_texture_views[mesh.first_texture + submeshes[i].material];
+            VkImageView handle = view ? view->handle() : m_default_texture_view->handle();
+            auto        it     = material_indices.find(handle);
+
+            if (it == material_indices.end())
+            {
+                it = material_indices.insert({ handle, (uint32_t)m_material_image_infos.size() }).first;
+
+                VkDescriptorImageInfo image_info;
+
+                image_info.sampler     = m_sampler->handle();
+                image_info.imageView   = handle;
+                image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+                m_material_image_infos.push_back(image_info);
+            }
+
+            m_draw_materials.push_back(it->second);
+        }
+    }
+
+    DW_LOG_INFO("(Scene) " + std::to_string(m_draw_materials.size()) + " draws share " + std::to_string(m_material_image_infos.size()) + " materials");
+
+    dw::vk::DescriptorSetLayout::Desc desc;
+    DW_ZERO_MEMORY(desc);
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_material_image_infos.size(), VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout_materials = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout_materials->set_name("Scene::m_ds_layout_materials");
+
+    m_ds_materials = backend->allocate_descriptor_set(m_ds_layout_materials);
+    m_ds_materials->set_name("Scene::m_ds_materials");
+
+    VkWriteDescriptorSet write_data;
+    DW_ZERO_MEMORY(write_data);
+
+    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data.descriptorCount = m_material_image_infos.size();
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write_data.pImageInfo      = m_material_image_infos.data();
+    write_data.dstBinding      = 0;
+    write_data.dstSet          = m_ds_materials->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+}
+
+void Scene::create_meshlets(dw::vk::Backend::Ptr backend)
+{
+    // Meshlets never cross a draw, so each one has a single material and culling a meshlet never affects
+    // another draw's triangles. Meshes are split in parallel and concatenated in order.
+    std::vector<std::vector<SceneMeshlet>> mesh_meshlets(meshes.size());
+
+    ThreadPool::global().parallel_for(meshes.size(), [&](uint32_t mesh_index) {
+        const SceneMesh&        mesh      = meshes[mesh_index];
+        const MeshCacheSubmesh* submeshes = mesh.cache->submeshes();
+        const MeshCacheVertex*  vertices  = mesh.cache->vertices();
+        const uint32_t*         indices   = mesh.cache->indices();
+
+        for (uint32_t i = 0; i < mesh.draw_count; i++)
+        {
+            const MeshCacheSubmesh& submesh        = submeshes[i];
+            uint32_t                first_triangle = submesh.first_index / 3;
+            uint32_t                triangle_count = submesh.index_count / 3;
+
+            for (uint32_t first = 0; first < triangle_count; first += kMeshletTriangles)
+            {
+                SceneMeshlet meshlet;
+
+                meshlet.first_triangle = mesh.first_triangle + first_triangle + first;
+                meshlet.triangle_count = std::min(kMeshletTriangles, triangle_count - first);
+                meshlet.mesh           = mesh_index;
+                meshlet.material       = m_draw_materials[mesh.first_draw + i];
+                meshlet.min            = glm::vec4(FLT_MAX);
+                meshlet.max            = glm::vec4(-FLT_MAX);
+
+                for (uint32_t j = 0; j < meshlet.triangle_count * 3; j++)
+                {
+                    const glm::vec4& position = vertices[indices[(first_triangle + first) * 3 + j]].position;
+
+                    meshlet.min = glm::min(meshlet.min, position);
+                    meshlet.max = glm::max(meshlet.max, position);
+                }
+
+                mesh_meshlets[mesh_index].push_back(meshlet);
+            }
+        }
+    });
+
+    m_meshlets.clear();
+
+    for (uint32_t i = 0; i < meshes.size(); i++)
+    {
+        meshes[i].first_meshlet = m_meshlets.size();
+        meshes[i].meshlet_count = mesh_meshlets[i].size();
+
+        m_meshlets.insert(m_meshlets.end(), mesh_meshlets[i].begin(), mesh_meshlets[i].end());
+    }
+
+    DW_LOG_INFO("(Scene) Split " + std::to_string(meshes.size()) + " meshes into " + std::to_string(m_meshlets.size()) + " meshlets");
+
+    m_meshlet_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(SceneMeshlet) * std::max<size_t>(m_meshlets.size(), 1), VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_meshlet_buffer->set_name("Scene::m_meshlet_buffer");
+    memcpy(m_meshlet_buffer->mapped_ptr(), m_meshlets.data(), sizeof(SceneMeshlet) * m_meshlets.size());
+}
+
+void Scene::create_instance_buffer(dw::vk::Backend::Ptr backend)
+{
+    size_t size = sizeof(SceneInstance) * instances.size();
+
+    m_instance_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, size, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_instance_buffer->set_name("Scene::m_instance_buffer");
+    memcpy(m_instance_buffer->mapped_ptr(), instances.data(), size);
+
+    m_ds_instances = backend->allocate_descriptor_set(m_ds_layout_instances);
+    m_ds_instances->set_name("Scene::m_ds_instances");
+
+    VkDescriptorBufferInfo buffer_info[2];
+    VkWriteDescriptorSet   write_data[2];
+
+    DW_ZERO_MEMORY(buffer_info[0]);
+    DW_ZERO_MEMORY(buffer_info[1]);
+    DW_ZERO_MEMORY(write_data[0]);
+    DW_ZERO_MEMORY(write_data[1]);
+
+    buffer_info[0].buffer = m_instance_buffer->handle();
+    buffer_info[0].offset = 0;
+    buffer_info[0].range  = size;
+
+    write_data[0].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data[0].descriptorCount = 1;
+    write_data[0].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data[0].pBufferInfo     = &buffer_info[0];
+    write_data[0].dstBinding      = 0;
+    write_data[0].dstSet          = m_ds_instances->handle();
+
+    buffer_info[1].buffer = m_draw_instance_buffer->handle();
+    buffer_info[1].offset = 0;
+    buffer_info[1].range  = VK_WHOLE_SIZE;
+
+    write_data[1].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data[1].descriptorCount = 1;
+    write_data[1].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data[1].pBufferInfo     = &buffer_info[1];
+    write_data[1].dstBinding      = 1;
+    write_data[1].dstSet          = m_ds_instances->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 2, write_data, 0, nullptr);
+}
+
+void Scene::draw(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Buffer::Ptr indirect_buffer)
+{
+    VkDeviceSize offset = 0;
+
+    vkCmdBindVertexBuffers(cmd_buf->handle(), 0, 1, &m_vertex_buffer->handle(), &offset);
+    vkCmdBindIndexBuffer(cmd_buf->handle(), m_index_buffer->handle(), 0, VK_INDEX_TYPE_UINT32);
+
+    if (m_multi_draw_indirect)
+        vkCmdDrawIndexedIndirect(cmd_buf->handle(), indirect_buffer ? indirect_buffer->handle() : m_indirect_buffer->handle(), 0, m_draw_commands.size(), sizeof(VkDrawIndexedIndirectCommand));
+    else
+    {
+        for (const auto& command : m_draw_commands)
+            vkCmdDrawIndexed(cmd_buf->handle(), command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+    }
+}
+
+void Scene::reset()
+{
+    meshes.clear();
+    instances.clear();
+    m_meshlets.clear();
+    m_material_image_infos.clear();
+    m_draw_materials.clear();
+    m_draw_commands.clear();
+    m_draw_bounds.clear();
+    m_ds_instances.reset();
+    m_ds_voxel_geometry.reset();
+    m_ds_materials.reset();
+    m_instance_buffer.reset();
+    m_draw_instance_buffer.reset();
+    m_vertex_buffer.reset();
+    m_index_buffer.reset();
+    m_voxel_vertex_buffer.reset();
+    m_mesh_quantization_buffer.reset();
+    m_meshlet_buffer.reset();
+    m_indirect_buffer.reset();
+    m_draw_bounds_buffer.reset();
+    m_texture_views.clear();
+    m_textures.clear();
+    m_default_texture_view.reset();
+    m_default_texture.reset();
+    m_sampler.reset();
+    reset_ds_layout_instances();
+}
+
+void Scene::report_memory(GpuMemoryReport& report) const
+{
+    report.add("Meshes", "Vertex buffer", m_vertex_buffer);
+    report.add("Meshes", "Index buffer", m_index_buffer);
+    report.add("Meshes", "Voxel vertex buffer", m_voxel_vertex_buffer);
+    report.add("Meshes", "Mesh quantization", m_mesh_quantization_buffer);
+    report.add("Meshes", "Meshlets", m_meshlet_buffer);
+    report.add("Meshes", "Instances", m_instance_buffer);
+    report.add("Meshes", "Draw instances", m_draw_instance_buffer);
+    report.add("Meshes", "Indirect draws", m_indirect_buffer);
+    report.add("Meshes", "Draw bounds", m_draw_bounds_buffer);
+
+    for (size_t i = 0; i < m_textures.size(); i++)
+        report.add("Textures", "Albedo " + std::to_string(i), m_textures[i]);
+
+    report.add("Textures", "Default texture", m_default_texture);
+}
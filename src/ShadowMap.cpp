@@ -3,12 +3,21 @@
 #include <macros.h>
 #include <imgui.h>
 #include <vk_mem_alloc.h>
+#include <algorithm>
+#include <cmath>
 
-ShadowMap::ShadowMap(dw::vk::Backend::Ptr backend, uint32_t m_size, const dw::vk::VertexInputStateDesc& vertex_input_state) :
-    m_size(m_size)
+const uint32_t ShadowMap::kMaxCascades;
+
+ShadowMap::ShadowMap(dw::vk::Backend::Ptr backend, uint32_t m_size, ShadowMapMode mode, uint32_t cascade_count) :
+    m_size(m_size), m_mode(mode)
 {
-    m_image      = dw::vk::Image::create(backend, VK_IMAGE_TYPE_2D, m_size, m_size, 1, 1, 1, VK_FORMAT_D32_SFLOAT, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
-    m_image_view = dw::vk::ImageView::create(backend, m_image, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1);
+    m_cascade_count = mode == SHADOW_MAP_CASCADED ? std::min(std::max(cascade_count, 1u), kMaxCascades) : 1;
+
+    m_image      = dw::vk::Image::create(backend, VK_IMAGE_TYPE_2D, m_size, m_size, 1, 1, m_cascade_count, VK_FORMAT_D32_SFLOAT, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+    m_image_view = dw::vk::ImageView::create(backend, m_image, VK_IMAGE_VIEW_TYPE_2D_ARRAY, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, m_cascade_count);
+
+    for (uint32_t i = 0; i < m_cascade_count; i++)
+        m_layer_image_views.push_back(dw::vk::ImageView::create(backend, m_image, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1));
 
     VkAttachmentDescription attachment;
     DW_ZERO_MEMORY(attachment);
@@ -59,7 +68,9 @@ ShadowMap::ShadowMap(dw::vk::Backend::Ptr backend, uint32_t m_size, const dw::vk
     dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
     m_render_pass = dw::vk::RenderPass::create(backend, { attachment }, subpass_description, dependencies);
-    m_framebuffer = dw::vk::Framebuffer::create(backend, m_render_pass, { m_image_view }, m_size, m_size, 1);
+
+    for (uint32_t i = 0; i < m_cascade_count; i++)
+        m_framebuffers.push_back(dw::vk::Framebuffer::create(backend, m_render_pass, { m_layer_image_views[i] }, m_size, m_size, 1));
 
     // Shadow map sampler
     dw::vk::Sampler::Desc sampler_desc;
@@ -79,7 +90,6 @@ ShadowMap::ShadowMap(dw::vk::Backend::Ptr backend, uint32_t m_size, const dw::vk
     m_shadow_map_sampler        = dw::vk::Sampler::create(backend, sampler_desc);
 
     create_descriptor_sets(backend);
-    create_pipeline_state(backend, vertex_input_state);
     update();
 }
 
@@ -87,7 +97,7 @@ void ShadowMap::create_descriptor_sets(dw::vk::Backend::Ptr backend)
 {
 
     m_ubo_size = backend->aligned_dynamic_ubo_size(sizeof(TransformsShadow));
-    m_ubo_transforms = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, m_ubo_size * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_ubo_transforms = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, m_ubo_size * kMaxCascades * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
 
     dw::vk::DescriptorSetLayout::Desc desc;
 
@@ -256,8 +266,9 @@ void ShadowMap::create_pipeline_state(dw::vk::Backend::Ptr backend, const dw::vk
 
     dw::vk::PipelineLayout::Desc pl_desc;
 
-    pl_desc.add_descriptor_set_layout(dw::Material::descriptor_set_layout())
+    pl_desc.add_descriptor_set_layout(Scene::get_ds_layout_materials())
         .add_descriptor_set_layout(m_ds_layout_ubo)
+        .add_descriptor_set_layout(Scene::get_ds_layout_instances())
         .add_push_constant_range(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants));
 
     m_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
@@ -282,8 +293,9 @@ void ShadowMap::create_pipeline_state(dw::vk::Backend::Ptr backend, const dw::vk
 
 ShadowMap::~ShadowMap()
 {
-    m_framebuffer.reset();
+    m_framebuffers.clear();
     m_render_pass.reset();
+    m_layer_image_views.clear();
     m_image_view.reset();
     m_image.reset();
     m_shadow_map_sampler.reset();
@@ -296,8 +308,16 @@ ShadowMap::~ShadowMap()
     m_pipeline_layout.reset();
 }
 
-void ShadowMap::begin_render(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend)
+bool ShadowMap::needs_render(uint32_t cascade)
 {
+    return !m_cache_enabled || !m_cascade_valid[cascade] || m_rendered_view_projections[cascade] != m_cascade_view_projections[cascade];
+}
+
+void ShadowMap::begin_render(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, uint32_t cascade)
+{
+    m_cascade_valid[cascade]             = true;
+    m_rendered_view_projections[cascade] = m_cascade_view_projections[cascade];
+
     VkClearValue clear_value;
 
     clear_value.depthStencil.depth = 1.0f;
@@ -305,7 +325,7 @@ void ShadowMap::begin_render(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend
     VkRenderPassBeginInfo info    = {};
     info.sType                    = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     info.renderPass               = m_render_pass->handle();
-    info.framebuffer              = m_framebuffer->handle();
+    info.framebuffer              = m_framebuffers[cascade]->handle();
     info.renderArea.extent.width  = m_size;
     info.renderArea.extent.height = m_size;
     info.clearValueCount          = 1;
@@ -337,13 +357,13 @@ void ShadowMap::begin_render(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend
     // Required to avoid shadow mapping artifacts
     vkCmdSetDepthBias(cmd_buf->handle(), depthBiasConstant, 0.0f, depthBiasSlope);
 
-    // update buffers
-    m_transforms.view       = m_view;
-    m_transforms.projection = m_projection;
-    uint8_t* ptr                   = (uint8_t*)m_ubo_transforms->mapped_ptr();
-    memcpy(ptr + m_ubo_size * backend->current_frame_idx(), &m_transforms, sizeof(TransformsShadow));
+    // update buffers, the cascade's view projection is baked into the projection
+    m_transforms.view       = m_mode == SHADOW_MAP_CASCADED ? glm::mat4(1.0f) : m_view;
+    m_transforms.projection = m_mode == SHADOW_MAP_CASCADED ? m_cascade_view_projections[cascade] : m_projection;
+    uint32_t dynamic_offset = m_ubo_size * (backend->current_frame_idx() * kMaxCascades + cascade);
+    uint8_t* ptr            = (uint8_t*)m_ubo_transforms->mapped_ptr();
+    memcpy(ptr + dynamic_offset, &m_transforms, sizeof(TransformsShadow));
 
-    uint32_t dynamic_offset = m_ubo_size * backend->current_frame_idx();
     vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_correct_texcoords->handle());
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout->handle(), 1, 1, &m_ds_transforms->handle(), 1, &dynamic_offset);
 }
@@ -355,10 +375,28 @@ void ShadowMap::end_render(dw::vk::CommandBuffer::Ptr cmd_buf)
 
 void ShadowMap::gui()
 {
-    ImGui::SliderFloat("Extents", &m_extents, 1.0f, 10000.0f);
-    ImGui::SliderFloat("Near Plane", &m_near_plane, 1.0f, 10000.0f);
-    ImGui::SliderFloat("Far Plane", &m_far_plane, 1.0f, 10000.0f);
-    ImGui::SliderFloat("Back Off Distance", &m_backoff_distance, 1.0f, 10000.0f);
+    ImGui::Checkbox("Cache Shadow Map", &m_cache_enabled);
+
+    if (m_mode == SHADOW_MAP_CASCADED)
+    {
+        ImGui::SliderFloat("Cascade Distance", &m_cascade_distance, 100.0f, 10000.0f);
+        ImGui::SliderFloat("Cascade Split Lambda", &m_cascade_split_lambda, 0.0f, 1.0f);
+    }
+
+    bool changed = false;
+
+    // The extents and far plane only shape the single map, the cascades fit their own bounds.
+    if (m_mode == SHADOW_MAP_SINGLE)
+    {
+        changed |= ImGui::SliderFloat("Extents", &m_extents, 1.0f, 10000.0f);
+        changed |= ImGui::SliderFloat("Far Plane", &m_far_plane, 1.0f, 10000.0f);
+    }
+
+    changed |= ImGui::SliderFloat("Near Plane", &m_near_plane, 1.0f, 10000.0f);
+    changed |= ImGui::SliderFloat("Back Off Distance", &m_backoff_distance, 1.0f, 10000.0f);
+
+    if (changed)
+        update();
 }
 
 void ShadowMap::set_direction(const glm::vec3& d)
@@ -408,4 +446,81 @@ void ShadowMap::update()
     glm::vec3 light_camera_pos = m_light_target - m_light_direction * m_backoff_distance;
     m_view                     = glm::lookAt(light_camera_pos, m_light_target, glm::vec3(0.0f, 1.0f, 0.0f));
     m_projection               = glm::ortho(-m_extents, m_extents, -m_extents, m_extents, m_near_plane, m_far_plane);
-}
\ No newline at end of file
+}
+
+void ShadowMap::update_cascades(const glm::mat4& camera_view, float fov, float aspect_ratio, float near_plane, float far_plane)
+{
+    if (m_mode != SHADOW_MAP_CASCADED)
+    {
+        m_cascade_view_projections[0] = m_projection * m_view;
+        m_cascade_splits[0]           = far_plane;
+        return;
+    }
+
+    // Practical split scheme, blending logarithmic and uniform splits over the shadowed distance.
+    float shadow_far = std::min(far_plane, m_cascade_distance);
+
+    for (uint32_t i = 0; i < m_cascade_count; i++)
+    {
+        float p             = float(i + 1) / float(m_cascade_count);
+        float log_split     = near_plane * std::pow(shadow_far / near_plane, p);
+        float uniform_split = near_plane + (shadow_far - near_plane) * p;
+        m_cascade_splits[i] = m_cascade_split_lambda * log_split + (1.0f - m_cascade_split_lambda) * uniform_split;
+    }
+
+    glm::mat4 inv_camera_view = glm::inverse(camera_view);
+    float     tan_half_fov    = std::tan(glm::radians(fov) * 0.5f);
+    glm::vec3 up              = std::abs(m_light_direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+    for (uint32_t i = 0; i < m_cascade_count; i++)
+    {
+        float split_near = i == 0 ? near_plane : m_cascade_splits[i - 1];
+        float split_far  = m_cascade_splits[i];
+
+        // World space corners of the camera frustum slice.
+        glm::vec3 corners[8];
+        glm::vec3 center = glm::vec3(0.0f);
+
+        for (uint32_t j = 0; j < 8; j++)
+        {
+            float     d      = (j & 4) ? split_far : split_near;
+            float     h      = d * tan_half_fov;
+            float     w      = h * aspect_ratio;
+            glm::vec4 corner = inv_camera_view * glm::vec4((j & 1) ? w : -w, (j & 2) ? h : -h, -d, 1.0f);
+
+            corners[j] = glm::vec3(corner);
+            center += corners[j];
+        }
+
+        center /= 8.0f;
+
+        // A bounding sphere keeps the cascade size constant while the camera rotates.
+        float radius = 0.0f;
+
+        for (uint32_t j = 0; j < 8; j++)
+            radius = std::max(radius, glm::length(corners[j] - center));
+
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // Casters between the light and the slice are kept by backing the light off.
+        glm::mat4 view       = glm::lookAt(center - m_light_direction * m_backoff_distance, center, up);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, m_near_plane, m_backoff_distance + radius);
+
+        // Snap to whole texels so that the shadow edges do not shimmer when the camera moves.
+        glm::vec4 origin = projection * view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        origin *= float(m_size) * 0.5f;
+
+        glm::vec4 offset = (glm::round(origin) - origin) * (2.0f / float(m_size));
+
+        projection[3][0] += offset.x;
+        projection[3][1] += offset.y;
+
+        m_cascade_view_projections[i] = projection * view;
+    }
+}
+
+void ShadowMap::report_memory(GpuMemoryReport& report) const
+{
+    report.add("ShadowMap", "Depth (" + std::to_string(m_size) + "^2 x " + std::to_string(m_cascade_count) + ")", m_image);
+    report.add("ShadowMap", "Transforms", m_ubo_transforms);
+}
@@ -0,0 +1,77 @@
+#include "StartupTimeline.h"
+#include <imgui.h>
+#include <logger.h>
+#include <algorithm>
+#include <cstdio>
+
+StartupTimeline& StartupTimeline::get()
+{
+    static StartupTimeline timeline;
+    return timeline;
+}
+
+void StartupTimeline::begin()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_origin = std::chrono::high_resolution_clock::now();
+    m_phases.clear();
+    m_threads.clear();
+    m_threads.push_back(std::this_thread::get_id());
+    m_recording = true;
+}
+
+void StartupTimeline::end()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_recording = false;
+}
+
+void StartupTimeline::record(const std::string& name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_recording)
+        return;
+
+    // Threads are numbered in the order they first record a phase, the thread that called begin() is 0.
+    auto     it     = std::find(m_threads.begin(), m_threads.end(), std::this_thread::get_id());
+    uint32_t thread = it - m_threads.begin();
+
+    if (it == m_threads.end())
+        m_threads.push_back(std::this_thread::get_id());
+
+    StartupPhase phase;
+
+    phase.name     = name;
+    phase.thread   = thread;
+    phase.start_ms = std::chrono::duration<double, std::milli>(start - m_origin).count();
+    phase.end_ms   = std::chrono::duration<double, std::milli>(end - m_origin).count();
+
+    m_phases.push_back(phase);
+}
+
+void StartupTimeline::log()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::sort(m_phases.begin(), m_phases.end(), [](const StartupPhase& a, const StartupPhase& b) { return a.start_ms < b.start_ms; });
+
+    for (const auto& phase : m_phases)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "(Startup) %8.2f - %8.2f ms (%7.2f ms) thread %u: %s", phase.start_ms, phase.end_ms, phase.end_ms - phase.start_ms, phase.thread, phase.name.c_str());
+        DW_LOG_INFO(line);
+    }
+}
+
+void StartupTimeline::gui()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!ImGui::CollapsingHeader("Startup Timeline"))
+        return;
+
+    for (const auto& phase : m_phases)
+        ImGui::Text("%8.2f ms %7.2f ms  [%u] %s", phase.start_ms, phase.end_ms - phase.start_ms, phase.thread, phase.name.c_str());
+}
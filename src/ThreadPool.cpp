@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t worker_count)
+{
+    for (uint32_t i = 0; i < worker_count; i++)
+        m_workers.push_back(std::thread(&ThreadPool::worker, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_condition.notify_all();
+
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return pool;
+}
+
+void ThreadPool::push(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(job));
+    }
+
+    m_condition.notify_one();
+}
+
+bool ThreadPool::run_one()
+{
+    std::function<void()> job;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_jobs.empty())
+            return false;
+
+        job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+    }
+
+    job();
+
+    return true;
+}
+
+void ThreadPool::worker()
+{
+    while (true)
+    {
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+
+            if (m_stop && m_jobs.empty())
+                return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+void ThreadPool::parallel_for(uint32_t count, const std::function<void(uint32_t)>& job)
+{
+    if (count == 0)
+        return;
+
+    if (count == 1 || m_workers.empty())
+    {
+        for (uint32_t i = 0; i < count; i++)
+            job(i);
+
+        return;
+    }
+
+    std::atomic<uint32_t> remaining(count);
+
+    // The first index runs on the calling thread, the rest are queued.
+    for (uint32_t i = 1; i < count; i++)
+    {
+        push([&job, &remaining, i]() {
+            job(i);
+            remaining--;
+        });
+    }
+
+    job(0);
+    remaining--;
+
+    // Help with whatever is queued instead of blocking, the remaining indices may be behind other jobs.
+    while (remaining > 0)
+    {
+        if (!run_one())
+            std::this_thread::yield();
+    }
+}
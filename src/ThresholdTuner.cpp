@@ -0,0 +1,266 @@
+#include "ThresholdTuner.h"
+#include "GpuProfiler.h"
+#include <imgui.h>
+#include <json.hpp>
+#include <logger.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+const uint32_t ThresholdTuner::kCoarseThresholdCount;
+const int      ThresholdTuner::kCoarseThresholds[ThresholdTuner::kCoarseThresholdCount] = { 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+const uint32_t ThresholdTuner::kMaxRefinements;
+
+// Timings lag the frame that recorded them by the frames in flight, and a threshold change only reaches the
+// GPU with the next voxelization.
+static const uint32_t kWarmupFrames = 2 * (uint32_t)dw::vk::Backend::kMaxFramesInFlight;
+
+// Frames per threshold after which it is measured with whatever samples it has, the async voxelization skips
+// frames while the compute queue is busy.
+static const uint32_t kMaxFramesPerSample = 4;
+
+bool ThresholdTuner::load_cache(const std::string& path)
+{
+    m_cache_path = path;
+    m_cache.clear();
+
+    std::ifstream file(path);
+
+    if (!file)
+        return true;
+
+    nlohmann::json json;
+
+    try
+    {
+        file >> json;
+
+        for (const auto& entry : json.at("entries"))
+            m_cache.push_back({ entry.at("scene").get<std::string>(), entry.at("resolution").get<uint32_t>(), entry.at("threshold").get<int>(), entry.at("ms").get<double>() });
+    }
+    catch (const std::exception& e)
+    {
+        DW_LOG_ERROR("(ThresholdTuner) Failed to parse " + path + ": " + e.what());
+        m_cache.clear();
+        return false;
+    }
+
+    DW_LOG_INFO("(ThresholdTuner) Loaded " + std::to_string(m_cache.size()) + " tuned thresholds from " + path);
+
+    return true;
+}
+
+bool ThresholdTuner::save_cache() const
+{
+    std::ofstream file(m_cache_path);
+
+    if (!file)
+    {
+        DW_LOG_ERROR("(ThresholdTuner) Failed to open " + m_cache_path + " for writing");
+        return false;
+    }
+
+    nlohmann::json entries = nlohmann::json::array();
+
+    for (const auto& entry : m_cache)
+    {
+        nlohmann::json json_entry;
+
+        json_entry["scene"]      = entry.scene;
+        json_entry["resolution"] = entry.resolution;
+        json_entry["threshold"]  = entry.threshold;
+        json_entry["ms"]         = entry.ms;
+
+        entries.push_back(json_entry);
+    }
+
+    nlohmann::json json;
+
+    json["entries"] = entries;
+
+    file << json.dump(4) << "\n";
+
+    return true;
+}
+
+bool ThresholdTuner::find(const std::string& scene, uint32_t resolution, int& threshold) const
+{
+    for (const auto& entry : m_cache)
+    {
+        if (entry.scene == scene && entry.resolution == resolution)
+        {
+            threshold = entry.threshold;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThresholdTuner::start(const std::string& scene, uint32_t resolution, uint32_t samples)
+{
+    m_scene       = scene;
+    m_resolution  = resolution;
+    m_samples     = std::max(samples, 1u);
+    m_threshold   = kCoarseThresholds[0];
+    m_refinements = 0;
+    m_frame       = 0;
+    m_count       = 0;
+    m_total_ms    = 0.0;
+    m_running     = true;
+    m_measurements.clear();
+
+    DW_LOG_INFO("(ThresholdTuner) Tuning the large triangle threshold for " + scene + " at " + std::to_string(resolution) + "^3");
+}
+
+void ThresholdTuner::cancel()
+{
+    if (m_running)
+        DW_LOG_INFO("(ThresholdTuner) Tuning cancelled");
+
+    m_running = false;
+}
+
+bool ThresholdTuner::update(ComputeVoxelizer& voxelizer, bool ready)
+{
+    if (!m_running)
+        return false;
+
+    if (!ready)
+    {
+        m_frame    = 0;
+        m_count    = 0;
+        m_total_ms = 0.0;
+        return false;
+    }
+
+    // Set every frame so that the UI cannot change it in the middle of a measurement.
+    voxelizer.m_push_constants.large_triangel_threshold = m_threshold;
+
+    m_frame++;
+
+    if (m_frame <= kWarmupFrames)
+        return false;
+
+    double small_ms = GpuProfiler::get().sample_ms("Small Triangles");
+    double large_ms = GpuProfiler::get().sample_ms("Large Triangles");
+
+    if (small_ms >= 0.0 && large_ms >= 0.0)
+    {
+        m_total_ms += small_ms + large_ms;
+        m_count++;
+    }
+
+    if (m_count < m_samples && m_frame < kWarmupFrames + m_samples * kMaxFramesPerSample)
+        return false;
+
+    m_measurements.push_back({ m_threshold, m_count > 0 ? m_total_ms / m_count : -1.0 });
+    m_frame    = 0;
+    m_count    = 0;
+    m_total_ms = 0.0;
+
+    if (next_threshold())
+        return false;
+
+    finish(voxelizer);
+
+    return true;
+}
+
+const ThresholdMeasurement* ThresholdTuner::best() const
+{
+    const ThresholdMeasurement* best = nullptr;
+
+    for (const auto& measurement : m_measurements)
+    {
+        if (measurement.ms >= 0.0 && (!best || measurement.ms < best->ms))
+            best = &measurement;
+    }
+
+    return best;
+}
+
+bool ThresholdTuner::next_threshold()
+{
+    if (m_measurements.size() < kCoarseThresholdCount)
+    {
+        m_threshold = kCoarseThresholds[m_measurements.size()];
+        return true;
+    }
+
+    const ThresholdMeasurement* best_measurement = best();
+
+    if (!best_measurement || m_refinements == kMaxRefinements)
+        return false;
+
+    // Closest measured thresholds below and above the best one.
+    int best_threshold = best_measurement->threshold;
+    int lower          = best_threshold;
+    int upper          = best_threshold;
+
+    for (const auto& measurement : m_measurements)
+    {
+        if (measurement.threshold < best_threshold && (lower == best_threshold || measurement.threshold > lower))
+            lower = measurement.threshold;
+
+        if (measurement.threshold > best_threshold && (upper == best_threshold || measurement.threshold < upper))
+            upper = measurement.threshold;
+    }
+
+    if (best_threshold - lower > 1)
+        m_threshold = (lower + best_threshold) / 2;
+    else if (upper - best_threshold > 1)
+        m_threshold = (best_threshold + upper) / 2;
+    else
+        return false;
+
+    m_refinements++;
+
+    return true;
+}
+
+void ThresholdTuner::finish(ComputeVoxelizer& voxelizer)
+{
+    m_running = false;
+
+    const ThresholdMeasurement* best_measurement = best();
+
+    if (!best_measurement)
+    {
+        DW_LOG_ERROR("(ThresholdTuner) No voxelization was timed, is the GPU profiler running?");
+        return;
+    }
+
+    voxelizer.m_push_constants.large_triangel_threshold = best_measurement->threshold;
+
+    ThresholdCacheEntry entry = { m_scene, m_resolution, best_measurement->threshold, best_measurement->ms };
+
+    auto it = std::find_if(m_cache.begin(), m_cache.end(), [this](const ThresholdCacheEntry& cached) { return cached.scene == m_scene && cached.resolution == m_resolution; });
+
+    if (it == m_cache.end())
+        m_cache.push_back(entry);
+    else
+        *it = entry;
+
+    char line[256];
+    snprintf(line, sizeof(line), "(ThresholdTuner) Best threshold for %u^3 is %d at %.3f ms after %u measurements", m_resolution, entry.threshold, entry.ms, (uint32_t)m_measurements.size());
+    DW_LOG_INFO(line);
+
+    save_cache();
+}
+
+void ThresholdTuner::gui() const
+{
+    if (m_running)
+        ImGui::Text("Tuning threshold %d (%u/%u samples, %u thresholds done)", m_threshold, m_count, m_samples, (uint32_t)m_measurements.size());
+
+    const ThresholdMeasurement* best_measurement = best();
+
+    for (const auto& measurement : m_measurements)
+    {
+        if (measurement.ms < 0.0)
+            ImGui::BulletText("%d: not timed", measurement.threshold);
+        else
+            ImGui::BulletText("%d: %.3f ms%s", measurement.threshold, measurement.ms, &measurement == best_measurement ? " (best)" : "");
+    }
+}
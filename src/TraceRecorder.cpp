@@ -0,0 +1,167 @@
+#include "TraceRecorder.h"
+#include <json.hpp>
+#include <logger.h>
+#include <algorithm>
+#include <fstream>
+
+TraceRecorder& TraceRecorder::get()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+double TraceRecorder::now_ms() const
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_origin).count();
+}
+
+void TraceRecorder::begin_frame()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_frames.empty())
+        m_frames.resize(kFrameCount);
+
+    m_frame_index++;
+
+    TraceFrame& frame = m_frames[m_frame_index % kFrameCount];
+
+    frame.index = m_frame_index;
+    frame.cpu_events.clear();
+    frame.gpu_events.clear();
+}
+
+uint64_t TraceRecorder::current_frame()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_frame_index;
+}
+
+TraceFrame* TraceRecorder::find_frame(uint64_t frame)
+{
+    if (frame == 0 || m_frames.empty() || m_frames[frame % kFrameCount].index != frame)
+        return nullptr;
+
+    return &m_frames[frame % kFrameCount];
+}
+
+void TraceRecorder::record_cpu(const std::string& name, std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point end)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Threads are numbered in the order they first record an event.
+    auto     it     = std::find(m_threads.begin(), m_threads.end(), std::this_thread::get_id());
+    uint32_t thread = it - m_threads.begin();
+
+    if (it == m_threads.end())
+        m_threads.push_back(std::this_thread::get_id());
+
+    TraceEvent event;
+
+    event.name     = name;
+    event.thread   = thread;
+    event.start_ms = std::chrono::duration<double, std::milli>(start - m_origin).count();
+    event.end_ms   = std::chrono::duration<double, std::milli>(end - m_origin).count();
+
+    // Work finishing on a background thread is attributed to the frame it finished in.
+    TraceFrame* frame = find_frame(m_frame_index);
+
+    if (frame)
+        frame->cpu_events.push_back(event);
+    else
+        m_startup_events.push_back(event);
+}
+
+void TraceRecorder::record_gpu(uint64_t frame, const std::string& name, uint32_t queue, double start_ms, double end_ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TraceFrame* trace_frame = find_frame(frame);
+
+    if (!trace_frame)
+        return;
+
+    TraceEvent event;
+
+    event.name     = name;
+    event.thread   = queue;
+    event.start_ms = start_ms;
+    event.end_ms   = end_ms;
+
+    trace_frame->gpu_events.push_back(event);
+}
+
+static nlohmann::json trace_event(const TraceEvent& event, uint32_t pid, double offset_ms)
+{
+    nlohmann::json json;
+
+    json["name"] = event.name;
+    json["ph"]   = "X";
+    json["pid"]  = pid;
+    json["tid"]  = event.thread;
+    json["ts"]   = (event.start_ms + offset_ms) * 1000.0;
+    json["dur"]  = (event.end_ms - event.start_ms) * 1000.0;
+
+    return json;
+}
+
+static nlohmann::json name_event(const char* type, uint32_t pid, uint32_t tid, const std::string& name)
+{
+    return { { "name", type }, { "ph", "M" }, { "pid", pid }, { "tid", tid }, { "args", { { "name", name } } } };
+}
+
+bool TraceRecorder::write_chrome_trace(const std::string& path, double gpu_offset_ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::ofstream file(path);
+
+    if (!file)
+    {
+        DW_LOG_ERROR("(TraceRecorder) Failed to open " + path + " for writing");
+        return false;
+    }
+
+    nlohmann::json events = nlohmann::json::array();
+
+    events.push_back(name_event("process_name", 0, 0, "CPU"));
+    events.push_back(name_event("process_name", 1, 0, "GPU"));
+    events.push_back(name_event("thread_name", 1, 0, "Graphics queue"));
+    events.push_back(name_event("thread_name", 1, 1, "Compute queue"));
+
+    for (uint32_t i = 0; i < m_threads.size(); i++)
+        events.push_back(name_event("thread_name", 0, i, i == 0 ? std::string("Main thread") : "Thread " + std::to_string(i)));
+
+    for (const auto& event : m_startup_events)
+        events.push_back(trace_event(event, 0, 0.0));
+
+    uint32_t frame_count = 0;
+
+    // Oldest frame first, slots that were never used or have been overwritten are skipped.
+    for (uint64_t i = m_frame_index >= kFrameCount ? m_frame_index - kFrameCount + 1 : 1; i <= m_frame_index; i++)
+    {
+        const TraceFrame* frame = find_frame(i);
+
+        if (!frame)
+            continue;
+
+        for (const auto& event : frame->cpu_events)
+            events.push_back(trace_event(event, 0, 0.0));
+
+        for (const auto& event : frame->gpu_events)
+            events.push_back(trace_event(event, 1, gpu_offset_ms));
+
+        frame_count++;
+    }
+
+    nlohmann::json json;
+
+    json["traceEvents"]     = events;
+    json["displayTimeUnit"] = "ms";
+
+    file << json.dump() << "\n";
+
+    DW_LOG_INFO("(TraceRecorder) Wrote " + std::to_string(frame_count) + " frames to " + path);
+
+    return true;
+}
@@ -1,60 +1,179 @@
 #include "VCTRenderer.h"
 #include <array>
+#include <algorithm>
 
-void VCTRenderer::create_voxelizer()
+std::shared_ptr<Voxelizer> VCTRenderer::create_voxelizer(VoxelizationType type, uint32_t resolution)
 {
-    if (m_voxelization_type == COMPUTE_SHADER_VOXELIZATION)
+    if (type == COMPUTE_SHADER_VOXELIZATION)
     {
-        m_voxelizer = std::make_shared<ComputeVoxelizer>(
+        return std::make_shared<ComputeVoxelizer>(
             m_vk_backend,
             glm::vec3(-1963.12f, -160.925f, 1119.94f),
             glm::vec3(1950.5f, 1543.24f, -1285.63f),
-            m_voxelization_resolution,
-            m_meshes[0]->vertex_input_state_desc(),
+            resolution,
+            Scene::vertex_input_state_desc(),
             m_width,
             m_height,
-            objects);
+            *m_scene);
     }
-    else if (m_voxelization_type == GEOMETRY_SHADER_VOXELIZATION)
+    else if (type == GEOMETRY_SHADER_VOXELIZATION)
 	{
-        m_voxelizer = std::make_shared<GeometryVoxelizer>(
+        return std::make_shared<GeometryVoxelizer>(
             m_vk_backend,
             glm::vec3(-1963.12f, -160.925f, 1119.94f),
             glm::vec3(1950.5f, 1543.24f, -1285.63f),
-            m_voxelization_resolution,
-            m_meshes[0]->vertex_input_state_desc(),
+            resolution,
+            Scene::vertex_input_state_desc(),
             m_width,
             m_height);
 	}
+
+    return nullptr;
 }
 
 bool VCTRenderer::init(int argc, const char* argv[])
 {
+    StartupTimeline::get().begin();
+
     // Create Uniform buffers
-    if (!create_uniform_buffers())
+    {
+        ScopedStartupPhase phase("Uniform buffers");
+
+        if (!create_uniform_buffers())
+            return false;
+    }
+
+    std::vector<std::string> arguments;
+
+    if (!m_benchmark.parse_arguments(argc, argv, arguments))
+        return false;
+
+    if (!arguments.empty())
+        m_scene_path = arguments[0];
+
+    // The main pass and the compute voxelizer bind 8 sets, more than the spec requires a device to support.
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(m_vk_backend->physical_device(), &properties);
+
+    if (properties.limits.maxBoundDescriptorSets < kMaxBoundDescriptorSets)
+    {
+        DW_LOG_ERROR("(VCTRenderer) The device binds " + std::to_string(properties.limits.maxBoundDescriptorSets) + " descriptor sets, " + std::to_string(kMaxBoundDescriptorSets) + " are required");
         return false;
+    }
+
+    GpuProfiler::get().initialize(m_vk_backend);
+    WorkCounters::get().initialize(m_vk_backend);
+    m_threshold_tuner.load_cache(m_threshold_cache_path);
 
-    // Load mesh.
     RenderObject::initialize_common_resources(m_vk_backend);
-    if (!load_objects())
+    Scene::initialize_common_resources(m_vk_backend);
+
+    // Read the scene on the pool, parsing and mapping or building the mesh caches doesn't touch Vulkan. The main
+    // thread meanwhile sets up everything that does not depend on the scene.
+    std::future<std::unique_ptr<Scene>> scene_read = ThreadPool::global().submit([this]() { return Scene::read(m_scene_path); });
+
+    {
+        ScopedStartupPhase phase("Cube mesh and debug draw");
+
+        Voxelizer::load_cube_mesh(m_vk_backend);
+
+        m_debug_draw.init(m_vk_backend, m_vk_backend->swapchain_render_pass());
+        m_debug_draw.set_depth_test(true);
+    }
+
+    {
+        ScopedStartupPhase phase("Synchronization objects");
+
+        m_compute_fences = std::vector<dw::vk::Fence::Ptr>(m_vk_backend->kMaxFramesInFlight);
+        for (auto& fence : m_compute_fences)
+            fence = dw::vk::Fence::create(m_vk_backend);
+
+        m_voxelization_finished_semaphores = std::vector<dw::vk::Semaphore::Ptr>(m_vk_backend->kMaxFramesInFlight);
+        m_grid_consumed_semaphores         = std::vector<dw::vk::Semaphore::Ptr>(m_vk_backend->kMaxFramesInFlight);
+        for (int i = 0; i < m_vk_backend->kMaxFramesInFlight; i++)
+        {
+            m_voxelization_finished_semaphores[i] = dw::vk::Semaphore::create(m_vk_backend);
+            m_grid_consumed_semaphores[i]         = dw::vk::Semaphore::create(m_vk_backend);
+        }
+    }
+
+    // The backend's descriptor pool is not thread safe, so the objects that do not depend on the scene allocate
+    // their sets here and only their shader modules and pipelines are created on the pool alongside the scene read.
+    {
+        ScopedStartupPhase phase("Descriptor sets");
+
+        m_voxel_ray_marcher       = std::make_unique<VoxelRayMarcher>(m_vk_backend);
+        m_voxel_surface_extractor = std::make_unique<VoxelSurfaceExtractor>(m_vk_backend);
+
+        // Cascades are much smaller than the single map, 4 x 1536^2 D32 is about 36 MB against 400 MB.
+        uint32_t shadow_map_size = m_shadow_map_mode == SHADOW_MAP_CASCADED ? m_shadow_cascade_size : uint32_t(m_shadow_map_size);
+        m_shadow_map             = std::make_unique<ShadowMap>(m_vk_backend, shadow_map_size, m_shadow_map_mode, m_shadow_cascade_count);
+        m_shadow_map->set_target(glm::vec3(-110.0f, 64.0f, 0.0f));
+        m_shadow_map->set_direction(glm::normalize(m_lights.lights[0].direction));
+        m_shadow_map->set_backoff_distance(6000.0f);
+        m_shadow_map->set_extents(1400.0f);
+        m_shadow_map->set_near_plane(1.0f);
+        m_shadow_map->set_far_plane(8000.0f);
+    }
+
+    std::vector<std::future<void>> pipeline_builds;
+
+    pipeline_builds.push_back(ThreadPool::global().submit([this]() {
+        ScopedStartupPhase phase("Voxel ray marcher");
+        m_voxel_ray_marcher->create_pipeline_state(m_vk_backend);
+    }));
+
+    pipeline_builds.push_back(ThreadPool::global().submit([this]() {
+        ScopedStartupPhase phase("Voxel surface extractor");
+        m_voxel_surface_extractor->create_pipeline_state(m_vk_backend);
+    }));
+
+    pipeline_builds.push_back(ThreadPool::global().submit([this]() {
+        ScopedStartupPhase phase("Shadow map");
+        m_shadow_map->create_pipeline_state(m_vk_backend, Scene::vertex_input_state_desc());
+    }));
+
+    // Load scene.
+    if (!load_objects(scene_read))
+    {
+        for (auto& build : pipeline_builds)
+            build.wait();
+
         return false;
+    }
 
     create_descriptor_set_layouts();
 
-    // Shadow map
-    m_shadow_map = std::make_unique<ShadowMap>(m_vk_backend, m_shadow_map_size, m_meshes[0]->vertex_input_state_desc());
-    m_shadow_map->set_target(glm::vec3(-110.0f, 64.0f, 0.0f));
-    m_shadow_map->set_direction(glm::normalize(m_lights.lights[0].direction));
-    m_shadow_map->set_backoff_distance(6000.0f);
-    m_shadow_map->set_extents(1400.0f);
-    m_shadow_map->set_near_plane(1.0f);
-    m_shadow_map->set_far_plane(8000.0f);
+    {
+        ScopedStartupPhase phase("Frustum culler");
+        m_frustum_culler = std::make_unique<FrustumCuller>(m_vk_backend, *m_scene, CULL_VIEW_COUNT);
+    }
+
+    pipeline_builds.push_back(ThreadPool::global().submit([this]() {
+        ScopedStartupPhase phase("Frustum culler pipeline");
+        m_frustum_culler->create_pipeline_state(m_vk_backend);
+    }));
 
-    create_voxelizer();
+    {
+        ScopedStartupPhase phase("Voxelizer");
+        m_voxelizer = create_voxelizer(m_voxelization_type, m_voxelization_resolution);
+        apply_tuned_threshold(m_voxelizer.get());
+    }
 
-    create_descriptor_sets();
-    write_descriptor_sets();
-    create_main_pipeline_state();
+    {
+        ScopedStartupPhase phase("Main pass");
+
+        create_descriptor_sets();
+        write_descriptor_sets();
+        create_main_pipeline_state(m_voxelizer, m_pipeline_layout_main, m_graphics_pipeline_main);
+    }
+
+    {
+        ScopedStartupPhase phase("Waiting for pipelines");
+
+        for (auto& build : pipeline_builds)
+            build.get();
+    }
 
     // Lights
     Light light;
@@ -68,14 +187,6 @@ bool VCTRenderer::init(int argc, const char* argv[])
     // Create camera.
     create_camera();
 
-    // Debug draw
-    m_debug_draw.init(m_vk_backend, m_vk_backend->swapchain_render_pass());
-    m_debug_draw.set_depth_test(true);
-
-    m_compute_fences = std::vector<dw::vk::Fence::Ptr>(m_vk_backend->kMaxFramesInFlight);
-    for (auto& fence : m_compute_fences)
-		fence = dw::vk::Fence::create(m_vk_backend);
-
     m_mesh_push_constants.occlusionDecayFactor          = 0.0f;
     m_mesh_push_constants.ambientOcclusionEnabled   = VK_FALSE;
     m_mesh_push_constants.occlusionVisualizationEnabled = VK_FALSE;
@@ -84,17 +195,46 @@ bool VCTRenderer::init(int argc, const char* argv[])
     m_mesh_push_constants.noTexture                     = false;
     m_voxelizer->noTexture = m_mesh_push_constants.noTexture;
 
+    update_memory_report();
+
+    StartupTimeline::get().end();
+    StartupTimeline::get().log();
+
     return true;
 }
 
 void VCTRenderer::update(double delta)
 {
+    TraceRecorder::get().begin_frame();
+    ScopedTraceEvent frame_event("Frame");
+
+    swap_pending_voxelizer();
+    m_grid_exporter.update(m_frame_count - 1);
+    record_frame_time(delta);
+    GpuProfiler::get().begin_frame();
+    WorkCounters::get().begin_frame();
+    update_benchmark(delta);
+    update_threshold_tuner();
+
     dw::vk::CommandBuffer::Ptr cmd_buf = m_vk_backend->allocate_graphics_command_buffer();
 
     VkCommandBufferBeginInfo begin_info;
     DW_ZERO_MEMORY(begin_info);
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
+    if (m_benchmark.enabled())
+        m_benchmark.gui();
+
+    if (ImGui::Button("Export Trace"))
+        export_trace();
+
+    ImGui::Checkbox("Async Compute Voxelization", &m_async_compute_enabled);
+    ImGui::Checkbox("Frustum Culling", &m_frustum_culling_enabled);
+
+    ImGui::PlotLines("Frame Time (ms)", m_frame_times.data(), (int)m_frame_times.size(), m_frame_time_idx, nullptr, 0.0f, 50.0f, ImVec2(0.0f, 60.0f));
+    if (m_voxelizer_build.valid())
+        ImGui::Text("Building voxelizer...");
+
     if (ImGui::Checkbox("No Texture", (bool*)(&m_mesh_push_constants.noTexture)))
     {
         m_voxelizer->noTexture = m_mesh_push_constants.noTexture;
@@ -102,6 +242,22 @@ void VCTRenderer::update(double delta)
 
     ImGui::Checkbox("Voxelization Visualization", &m_voxelization_visualization_enabled);
 
+    if (m_voxelization_visualization_enabled)
+    {
+        ImGui::RadioButton("Cubes", &m_voxel_visualization_mode, VOXEL_VISUALIZATION_CUBES);
+        ImGui::SameLine();
+        ImGui::RadioButton("Ray March", &m_voxel_visualization_mode, VOXEL_VISUALIZATION_RAY_MARCH);
+        ImGui::SameLine();
+        ImGui::RadioButton("Surface", &m_voxel_visualization_mode, VOXEL_VISUALIZATION_SURFACE);
+
+        if (m_voxel_visualization_mode == VOXEL_VISUALIZATION_CUBES)
+            ImGui::Text("Occupied voxels: %u (instance buffer: %u)", m_voxelizer->occupied_voxels(), m_voxelizer->instance_capacity());
+        else if (m_voxel_visualization_mode == VOXEL_VISUALIZATION_RAY_MARCH)
+            ImGui::SliderInt("Mip Level", &m_voxel_ray_march_mip, 0, m_voxelizer->m_mip_level_count - 1);
+        else
+            ImGui::Text("Faces: %u (face buffer: %u)", m_voxel_surface_extractor->face_count(), m_voxel_surface_extractor->face_capacity());
+    }
+
     static int res_group = 0;
 
     if (m_voxelization_resolution == 64)
@@ -144,6 +300,16 @@ void VCTRenderer::update(double delta)
     {
         ComputeVoxelizer* voxelization_ptr = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
         ImGui::InputInt("Large Triangle Threshold", &voxelization_ptr->m_push_constants.large_triangel_threshold);
+
+        if (m_threshold_tuner.running())
+        {
+            if (ImGui::Button("Cancel Auto-Tune"))
+                m_threshold_tuner.cancel();
+        }
+        else if (!m_benchmark.enabled() && ImGui::Button("Auto-Tune Threshold"))
+            m_threshold_tuner.start(m_scene_path, voxelization_ptr->m_voxels_per_side);
+
+        m_threshold_tuner.gui();
     }
 
     ImGui::Text("");
@@ -153,36 +319,114 @@ void VCTRenderer::update(double delta)
     ImGui::SliderFloat("Surface Offset", &m_mesh_push_constants.surfaceOffset, 0.0f, 30.0f);
     ImGui::SliderFloat("Cone Cutoff", &m_mesh_push_constants.coneCutoff, 0.0f, 2000.0f);
 
-    vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
-
-    {
-        DW_SCOPED_SAMPLE("update", cmd_buf);
+    ImGui::Text("\nShadow map");
+    m_shadow_map->gui();
 
-        // Render profiler.
-        dw::profiler::ui();
+    // Before this frame's async voxelization is submitted, so that a readback finds the sampled grid with the graphics queue.
+    voxel_grid_comparison_ui();
+    m_grid_exporter.gui();
+    WorkCounters::get().gui();
+    memory_report_ui();
 
+    if (async_voxelization_available())
+    {
         // Update camera.
         update_camera();
 
-        // Render.
-        render(cmd_buf);
+        // The shadow map goes into its own submission so that it does not wait on the compute queue.
+        dw::vk::CommandBuffer::Ptr shadow_cmd_buf = m_vk_backend->allocate_graphics_command_buffer();
+
+        vkBeginCommandBuffer(shadow_cmd_buf->handle(), &begin_info);
+        GpuProfiler::get().begin_command_buffer(shadow_cmd_buf, GPU_QUEUE_GRAPHICS);
+        WorkCounters::get().begin_command_buffer(shadow_cmd_buf, GPU_QUEUE_GRAPHICS);
+        render_shadow_map(shadow_cmd_buf);
+        vkEndCommandBuffer(shadow_cmd_buf->handle());
+
+        bool grid_flipped = submit_async_voxelization(shadow_cmd_buf);
+
+        vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
+        GpuProfiler::get().begin_command_buffer(cmd_buf, GPU_QUEUE_GRAPHICS);
+        WorkCounters::get().begin_command_buffer(cmd_buf, GPU_QUEUE_GRAPHICS);
+
+        {
+            VCT_SCOPED_SAMPLE("update", cmd_buf);
+
+            // Render profiler.
+            dw::profiler::ui();
+            culling_ui();
+            StartupTimeline::get().gui();
+
+            const auto& queue_infos = m_vk_backend->queue_infos();
+
+            // A grid that has not been flipped this frame was acquired by an earlier one and is only read since.
+            if (grid_flipped)
+                m_voxelizer->acquire_voxel_grid(cmd_buf, queue_infos.compute_queue_index, queue_infos.graphics_queue_index);
+
+            // Render.
+            render_main(cmd_buf, grid_flipped);
+        }
+
+        vkEndCommandBuffer(cmd_buf->handle());
+
+        submit_and_present_main(cmd_buf);
     }
+    else
+    {
+        vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
+        GpuProfiler::get().begin_command_buffer(cmd_buf, GPU_QUEUE_GRAPHICS);
+        WorkCounters::get().begin_command_buffer(cmd_buf, GPU_QUEUE_GRAPHICS);
 
-    vkEndCommandBuffer(cmd_buf->handle());
+        {
+            VCT_SCOPED_SAMPLE("update", cmd_buf);
+
+            drain_async_voxelization(cmd_buf);
+
+            // Render profiler.
+            dw::profiler::ui();
+            culling_ui();
+            StartupTimeline::get().gui();
+
+            // Update camera.
+            update_camera();
 
-    submit_and_present({ cmd_buf });
+            // Render.
+            render(cmd_buf);
+        }
+
+        vkEndCommandBuffer(cmd_buf->handle());
+
+        submit_and_present_main(cmd_buf);
+    }
 }
 
 void VCTRenderer::shutdown()
 {
+    if (m_voxelizer_build.valid())
+        m_voxelizer_build.wait();
+
     vkDeviceWaitIdle(m_vk_backend->device());
 
-    for (auto& mesh : m_meshes)
-        mesh.reset();
-    for (auto& object : objects)
-        object.reset();
+    GpuProfiler::get().shutdown();
+    WorkCounters::get().shutdown();
+    m_grid_exporter.shutdown();
+    m_retired_voxelizers.clear();
+    m_pending_voxelizer.reset();
+    m_pending_pipeline_layout_main.reset();
+    m_pending_graphics_pipeline_main.reset();
+
+    m_frustum_culler.reset();
+    m_voxel_ray_marcher.reset();
+    m_voxel_surface_extractor.reset();
+    m_scene->reset();
+    m_scene.reset();
     for (auto& fence : m_compute_fences)
         fence.reset();
+    for (auto& semaphore : m_voxelization_finished_semaphores)
+        semaphore.reset();
+    for (auto& semaphore : m_grid_consumed_semaphores)
+        semaphore.reset();
+    m_pending_grid_consumed_semaphore.reset();
+    m_grid_semaphores.clear();
     m_graphics_pipeline_main.reset();
     m_pipeline_layout_main.reset();
     m_ds_layout_ubo.reset();
@@ -195,6 +439,7 @@ void VCTRenderer::shutdown()
     m_ubo_voxel_grid.reset();
     m_shadow_map.reset();
     m_voxelizer.reset();
+    Voxelizer::reset_cube_mesh();
     m_debug_draw.shutdown();
 }
 
@@ -215,7 +460,7 @@ dw::AppSettings VCTRenderer::intial_app_settings()
 inline void VCTRenderer::window_resized(int width, int height)
 {
     // Override window resized method to update camera projection.
-    m_main_camera->update_projection(60.0f, 0.1f, m_far, float(m_width) / float(m_height));
+    m_main_camera->update_projection(m_camera_fov, m_camera_near, m_far, float(m_width) / float(m_height));
 }
 
 bool VCTRenderer::create_uniform_buffers()
@@ -315,7 +560,7 @@ void VCTRenderer::write_descriptor_sets()
 	vkUpdateDescriptorSets(m_vk_backend->device(), 1, &write_data, 0, nullptr);
 }
 
-void VCTRenderer::create_main_pipeline_state()
+void VCTRenderer::create_main_pipeline_state(std::shared_ptr<Voxelizer> voxelizer, dw::vk::PipelineLayout::Ptr& pipeline_layout, dw::vk::GraphicsPipeline::Ptr& pipeline)
 {
     // ---------------------------------------------------------------------------
     // Create shader modules
@@ -333,7 +578,7 @@ void VCTRenderer::create_main_pipeline_state()
     // Create vertex input state
     // ---------------------------------------------------------------------------
 
-    pso_desc.set_vertex_input_state(m_meshes[0]->vertex_input_state_desc());
+    pso_desc.set_vertex_input_state(Scene::vertex_input_state_desc());
 
     // ---------------------------------------------------------------------------
     // Create pipeline input assembly state
@@ -422,18 +667,20 @@ void VCTRenderer::create_main_pipeline_state()
 
     dw::vk::PipelineLayout::Desc pl_desc;
 
-    pl_desc.add_descriptor_set_layout(dw::Material::descriptor_set_layout())
+    pl_desc.add_descriptor_set_layout(Scene::get_ds_layout_materials())
         .add_descriptor_set_layout(m_ds_layout_ubo)
         .add_descriptor_set_layout(m_shadow_map->m_ds_layout_sampler)
         .add_descriptor_set_layout(m_ds_layout_ubo)
-        .add_descriptor_set_layout(m_voxelizer->m_ds_layout_voxel_grid_mip_maps)
-        .add_descriptor_set_layout(m_ds_layout_voxel_grid_main);
+        .add_descriptor_set_layout(voxelizer->m_ds_layout_voxel_grid_mip_maps)
+        .add_descriptor_set_layout(m_ds_layout_voxel_grid_main)
+        .add_descriptor_set_layout(Scene::get_ds_layout_instances())
+        .add_descriptor_set_layout(WorkCounters::get().ds_layout());
     pl_desc.add_push_constant_range(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants));
 
-    m_pipeline_layout_main = dw::vk::PipelineLayout::create(m_vk_backend, pl_desc);
-    m_pipeline_layout_main->set_name("Main::pipeline_layout_main");
+    pipeline_layout = dw::vk::PipelineLayout::create(m_vk_backend, pl_desc);
+    pipeline_layout->set_name("Main::pipeline_layout_main");
 
-    pso_desc.set_pipeline_layout(m_pipeline_layout_main);
+    pso_desc.set_pipeline_layout(pipeline_layout);
 
     // ---------------------------------------------------------------------------
     // Create dynamic state
@@ -448,46 +695,21 @@ void VCTRenderer::create_main_pipeline_state()
 
     pso_desc.set_render_pass(m_vk_backend->swapchain_render_pass());
 
-    m_graphics_pipeline_main = dw::vk::GraphicsPipeline::create(m_vk_backend, pso_desc);
-    m_graphics_pipeline_main->set_name("Main::graphics_pipeline_main");
-}
-
-bool VCTRenderer::load_object(std::string filename)
-{
-    m_meshes.push_back(dw::Mesh::load(m_vk_backend, filename));
-    objects.push_back(RenderObject(m_meshes[m_meshes.size() - 1], m_vk_backend));
-    return m_meshes[m_meshes.size() - 1] != nullptr;
+    pipeline = dw::vk::GraphicsPipeline::create(m_vk_backend, pso_desc);
+    pipeline->set_name("Main::graphics_pipeline_main");
 }
 
-enum Model
-{
-    SPONZA, DRAGON, STATUE
-};
-
-bool VCTRenderer::load_objects()
+bool VCTRenderer::load_objects(std::future<std::unique_ptr<Scene>>& scene_read)
 {
-    std::vector<bool> results;
-    Model             model = SPONZA;
-
-    if (model == SPONZA)
-    {
-        results.push_back(load_object("models/sponza/Sponza.gltf"));
-    }
-    else if (model == DRAGON)
-    {
-        results.push_back(load_object("models/dragon.glb"));
-        objects[objects.size() - 1].scale = 10.0f;
-    }
-    else if (model == STATUE)
     {
-        results.push_back(load_object("models/statue.glb"));
-        objects[objects.size() - 1].scale = 10.0f;
+        ScopedStartupPhase phase("Wait for scene read");
+        m_scene = scene_read.get();
     }
 
-    for (bool result : results) {
-        if (!result)
-            return false;
-    }
+    if (!m_scene)
+        return false;
+
+    m_scene->create_gpu_resources(m_vk_backend);
 
     return true;
 }
@@ -495,35 +717,36 @@ bool VCTRenderer::load_objects()
 inline void VCTRenderer::create_camera()
 {
     m_main_camera = std::make_unique<dw::Camera>(
-        60.0f, 0.1f, m_far, float(m_width) / float(m_height), glm::vec3(0.0f, 0.0f, 100.0f), glm::vec3(0.0f, 0.0, -1.0f));
+        m_camera_fov, m_camera_near, m_far, float(m_width) / float(m_height), glm::vec3(0.0f, 0.0f, 100.0f), glm::vec3(0.0f, 0.0, -1.0f));
 }
 
-void VCTRenderer::render_objects(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::PipelineLayout::Ptr pipeline_layout)
+void VCTRenderer::render_objects(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::PipelineLayout::Ptr pipeline_layout, uint32_t instance_set, uint32_t cull_view)
 {
-    VkDeviceSize offset = 0;
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout->handle(), 0, 1, &m_scene->m_ds_materials->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), pipeline_layout->handle(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &m_mesh_push_constants);
 
-    for (auto object : objects)
+    // Issue every submesh of every mesh with a single indirect draw, using the view's culled list if there is one.
+    if (cull_view != CULL_VIEW_NONE && frustum_culling_available())
+        m_frustum_culler->draw(cmd_buf, m_vk_backend, pipeline_layout, instance_set, cull_view);
+    else
     {
-        m_mesh_push_constants.model = object.get_model();
-        auto mesh = object.mesh;
-
-        vkCmdBindVertexBuffers(cmd_buf->handle(), 0, 1, &mesh->vertex_buffer()->handle(), &offset);
-        vkCmdBindIndexBuffer(cmd_buf->handle(), mesh->index_buffer()->handle(), 0, VK_INDEX_TYPE_UINT32);
-
-        const auto& submeshes = mesh->sub_meshes();
+        vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout->handle(), instance_set, 1, &m_scene->m_ds_instances->handle(), 0, nullptr);
+        m_scene->draw(cmd_buf);
+    }
+}
 
-        for (uint32_t i = 0; i < submeshes.size(); i++)
-        {
-            auto& submesh = submeshes[i];
-            auto& mat     = mesh->material(submesh.mat_idx);
+void VCTRenderer::culling_ui()
+{
+    static const char* view_names[CULL_VIEW_COUNT] = { "Main", "Shadow cascade 0", "Shadow cascade 1", "Shadow cascade 2", "Shadow cascade 3" };
 
-            vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout->handle(), 0, 1, &mat->descriptor_set()->handle(), 0, nullptr);
-            vkCmdPushConstants(cmd_buf->handle(), pipeline_layout->handle(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(MeshPushConstants), &m_mesh_push_constants);
+    if (frustum_culling_available())
+        m_frustum_culler->gui(view_names, CULL_VIEW_SHADOW + m_shadow_map->cascade_count());
+}
 
-            // Issue draw call.
-            vkCmdDrawIndexed(cmd_buf->handle(), submesh.index_count, 1, submesh.base_index, submesh.base_vertex, 0);
-        }
-    }
+bool VCTRenderer::frustum_culling_available()
+{
+    // The culled draw lists are consumed with a single multi-draw indirect call.
+    return m_frustum_culling_enabled && m_scene->multi_draw_indirect();
 }
 
 void VCTRenderer::begin_render_main(dw::vk::CommandBuffer::Ptr cmd_buf)
@@ -576,123 +799,658 @@ void VCTRenderer::begin_render_main(dw::vk::CommandBuffer::Ptr cmd_buf)
 
 void VCTRenderer::revoxelize(int resolution)
 {
-    if (m_voxelizer->m_voxels_per_side != resolution)
+    if (m_voxelization_resolution != resolution)
     {
         m_voxelization_resolution = resolution;
-        vkDeviceWaitIdle(m_vk_backend->device());
-        m_voxelizer.reset();
-        create_voxelizer();
-        m_graphics_pipeline_main.reset();
-        create_main_pipeline_state();
-        
+        request_voxelizer_rebuild();
     }
 }
 
 void VCTRenderer::revoxelize(VoxelizationType type)
 {
-    if (m_voxelizer->m_voxelization_type != type)
+    if (m_voxelization_type != type)
     {
         m_voxelization_type = type;
-        vkDeviceWaitIdle(m_vk_backend->device());
-        m_voxelizer.reset();
-        create_voxelizer();
-        m_graphics_pipeline_main.reset();
-        create_main_pipeline_state();
-        
+        request_voxelizer_rebuild();
     }
 }
 
-void VCTRenderer::render(dw::vk::CommandBuffer::Ptr cmd_buf)
+void VCTRenderer::request_voxelizer_rebuild()
+{
+    // Only one build runs at a time, the latest settings are picked up once it finishes.
+    if (m_voxelizer_build.valid())
+    {
+        m_voxelizer_rebuild_requested = true;
+        return;
+    }
+
+    VoxelizationType type       = m_voxelization_type;
+    uint32_t         resolution = m_voxelization_resolution;
+
+    m_voxelizer_rebuild_requested = false;
+    m_voxelizer_build_start       = std::chrono::high_resolution_clock::now();
+    m_longest_frame_during_switch = 0.0f;
+
+    m_voxelizer_build = std::async(std::launch::async, [this, type, resolution]() {
+        ScopedTraceEvent event("Voxelizer rebuild");
+        m_pending_voxelizer = create_voxelizer(type, resolution);
+        create_main_pipeline_state(m_pending_voxelizer, m_pending_pipeline_layout_main, m_pending_graphics_pipeline_main);
+    });
+}
+
+void VCTRenderer::swap_pending_voxelizer()
 {
-    DW_SCOPED_SAMPLE("render", cmd_buf);
+    uint64_t frame_count = m_frame_count++;
 
-    m_shadow_map->begin_render(cmd_buf, m_vk_backend);
+    // Destroy retired voxelizers once the last frame that could have used them has finished. Their descriptor sets
+    // go back to their own pool, so this is safe while a build is running.
+    bool retired_destroyed = false;
+
+    while (!m_retired_voxelizers.empty() && m_retired_voxelizers.front().last_frame + m_vk_backend->kMaxFramesInFlight <= frame_count)
     {
-        DW_SCOPED_SAMPLE("Shadow map", cmd_buf);
-        render_objects(cmd_buf, m_shadow_map->m_pipeline_layout);
+        m_retired_voxelizers.pop_front();
+        retired_destroyed = true;
     }
-    m_shadow_map->end_render(cmd_buf);
+
+    // Until then their memory shows up as unattributed.
+    if (retired_destroyed && m_retired_voxelizers.empty())
+        update_memory_report();
+
+    if (!m_voxelizer_build.valid() || m_voxelizer_build.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    m_voxelizer_build.get();
+
+    RetiredVoxelizer retired;
+
+    retired.voxelizer              = m_voxelizer;
+    retired.pipeline_layout_main   = m_pipeline_layout_main;
+    retired.graphics_pipeline_main = m_graphics_pipeline_main;
+    retired.last_frame             = frame_count - 1;
+
+    m_retired_voxelizers.push_back(retired);
+
+    m_pending_voxelizer->noTexture = m_voxelizer->noTexture;
+
+    ComputeVoxelizer* old_compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
+    ComputeVoxelizer* new_compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(m_pending_voxelizer.get());
+
+    // A threshold tuned for the new resolution wins over the one set for the old grid.
+    if (!apply_tuned_threshold(m_pending_voxelizer.get()) && old_compute_voxelizer && new_compute_voxelizer)
+        new_compute_voxelizer->m_push_constants.large_triangel_threshold = old_compute_voxelizer->m_push_constants.large_triangel_threshold;
+
+    // The grid of a voxelization still running for the old voxelizer is never sampled, the next graphics submission
+    // only waits on it to complete its ownership transfer.
+    if (m_compute_fence_pending)
+    {
+        m_grid_semaphores.push_back(m_voxelization_finished_semaphores[m_last_compute_frame_idx]);
+        m_compute_fence_pending = false;
+    }
+
+    m_voxelizer              = m_pending_voxelizer;
+    m_pipeline_layout_main   = m_pending_pipeline_layout_main;
+    m_graphics_pipeline_main = m_pending_graphics_pipeline_main;
+
+    m_pending_voxelizer.reset();
+    m_pending_pipeline_layout_main.reset();
+    m_pending_graphics_pipeline_main.reset();
+
+    // The new grids have never been written, so the first voxelization is sampled in the frame it is submitted in.
+    m_force_voxelization = true;
+
+    update_memory_report();
+
+    float build_time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - m_voxelizer_build_start).count();
+    DW_LOG_INFO("(VCTRenderer) Voxelizer switched after " + std::to_string(build_time) + " ms in the background, longest frame during the switch: " + std::to_string(m_longest_frame_during_switch) + " ms");
+
+    if (m_voxelizer_rebuild_requested)
+        request_voxelizer_rebuild();
+}
+
+void VCTRenderer::record_frame_time(double delta)
+{
+    m_frame_times[m_frame_time_idx] = (float)delta;
+    m_frame_time_idx                = (m_frame_time_idx + 1) % m_frame_times.size();
+
+    if (m_voxelizer_build.valid())
+        m_longest_frame_during_switch = std::max(m_longest_frame_during_switch, (float)delta);
+}
+
+void VCTRenderer::update_benchmark(double delta)
+{
+    if (!m_benchmark.enabled() || m_benchmark.finished())
+        return;
+
+    if (!m_benchmark_started)
+    {
+        m_benchmark_started            = true;
+        m_benchmark_shadow_cache_saved = m_shadow_map->m_cache_enabled;
+    }
+
+    // Forced every frame so that toggling the checkbox during the sweep cannot skew the samples.
+    m_shadow_map->m_cache_enabled = false;
+
+    const BenchmarkConfig& config = m_benchmark.config();
+
+    if (m_voxelization_type != config.type || m_voxelization_resolution != config.resolution)
+    {
+        m_voxelization_type       = config.type;
+        m_voxelization_resolution = config.resolution;
+        request_voxelizer_rebuild();
+    }
+
+    // Frames only count once the voxelizer of this configuration is the one in use.
+    bool ready = !m_voxelizer_build.valid() && m_voxelizer->m_voxelization_type == config.type && m_voxelizer->m_voxels_per_side == config.resolution;
+
+    ComputeVoxelizer* compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
+
+    if (ready && compute_voxelizer)
+        compute_voxelizer->m_push_constants.large_triangel_threshold = config.large_triangle_threshold;
+
+    m_mesh_push_constants.ambientOcclusionEnabled = config.ambient_occlusion ? VK_TRUE : VK_FALSE;
+
+    if (m_benchmark.update(delta, ready))
+    {
+        m_shadow_map->m_cache_enabled = m_benchmark_shadow_cache_saved;
+        m_benchmark.write_results();
+        glfwSetWindowShouldClose(m_window, GLFW_TRUE);
+    }
+}
+
+void VCTRenderer::update_threshold_tuner()
+{
+    if (!m_threshold_tuner.running())
+        return;
+
+    ComputeVoxelizer* compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
+
+    // Switching the type or resolution invalidates the search.
+    if (!compute_voxelizer || compute_voxelizer->m_voxels_per_side != m_threshold_tuner.resolution())
+    {
+        m_threshold_tuner.cancel();
+        return;
+    }
+
+    m_threshold_tuner.update(*compute_voxelizer, !m_voxelizer_build.valid());
+}
+
+bool VCTRenderer::apply_tuned_threshold(Voxelizer* voxelizer)
+{
+    ComputeVoxelizer* compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(voxelizer);
+
+    if (!compute_voxelizer)
+        return false;
+
+    int threshold;
+
+    if (!m_threshold_tuner.find(m_scene_path, compute_voxelizer->m_voxels_per_side, threshold))
+        return false;
+
+    compute_voxelizer->m_push_constants.large_triangel_threshold = threshold;
+
+    return true;
+}
+
+void VCTRenderer::export_trace()
+{
+    // Calibrated on every export, the two clocks drift apart over a long session.
+    double gpu_offset_ms = GpuProfiler::get().calibrate();
+    TraceRecorder::get().write_chrome_trace(m_trace_path, gpu_offset_ms);
+}
+
+void VCTRenderer::voxel_grid_comparison_ui()
+{
+    if (!ImGui::CollapsingHeader("Voxel Grid Comparison"))
+        return;
+
+    if (ImGui::Button("Capture Reference"))
+    {
+        read_back_current_grid(m_reference_grid);
+        m_grid_comparisons.clear();
+    }
+
+    if (m_reference_grid.mips.empty())
+    {
+        ImGui::Text("No reference captured");
+        return;
+    }
+
+    ImGui::Text("Reference: %s", m_reference_grid.label.c_str());
+    ImGui::SliderInt("Slice Mip", &m_grid_slice_mip, 0, (int)m_reference_grid.mips.size() - 1);
+
+    if (ImGui::Button("Compare With Reference"))
+        compare_with_reference_grid();
+
+    for (const auto& comparison : m_grid_comparisons)
+        ImGui::Text("Mip %u (%u^3): IoU %.4f, occupied %llu / %llu, color difference %.4f (max %.4f)", comparison.mip, comparison.resolution, comparison.iou, (unsigned long long)comparison.occupied_a, (unsigned long long)comparison.occupied_b, comparison.mean_color_difference, comparison.max_color_difference);
+}
+
+void VCTRenderer::update_memory_report()
+{
+    m_memory_report.begin(m_vk_backend);
+
+    m_voxelizer->report_memory(m_memory_report);
+    m_shadow_map->report_memory(m_memory_report);
+    m_scene->report_memory(m_memory_report);
+    m_frustum_culler->report_memory(m_memory_report);
+    m_voxel_ray_marcher->report_memory(m_memory_report);
+    m_voxel_surface_extractor->report_memory(m_memory_report);
+
+    m_memory_report.add("Renderer", "Main transforms", m_ubo_transforms_main);
+    m_memory_report.add("Renderer", "Lights", m_ubo_lights);
+    m_memory_report.add("Renderer", "Voxel grid uniforms", m_ubo_voxel_grid);
+
+    m_memory_report.end();
+}
+
+void VCTRenderer::memory_report_ui()
+{
+    if (!ImGui::CollapsingHeader("GPU Memory"))
+        return;
+
+    if (ImGui::Button("Refresh"))
+        update_memory_report();
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Write JSON"))
+        m_memory_report.write_json(m_memory_report_path);
+
+    m_memory_report.gui();
+}
+
+bool VCTRenderer::read_back_current_grid(VoxelGrid& grid)
+{
+    // Every submitted frame acquired the grid it voxelized, so once they finish the graphics queue owns it.
+    vkDeviceWaitIdle(m_vk_backend->device());
+
+    if (!read_back_voxel_grid(m_vk_backend, *m_voxelizer, grid))
+        return false;
+
+    grid.label = (m_voxelizer->m_voxelization_type == GEOMETRY_SHADER_VOXELIZATION ? "geometry " : "compute ") + std::to_string(grid.resolution) + "^3";
+
+    ComputeVoxelizer* compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
+
+    if (compute_voxelizer)
+        grid.label += ", threshold " + std::to_string(compute_voxelizer->m_push_constants.large_triangel_threshold);
+
+    return true;
+}
+
+void VCTRenderer::compare_with_reference_grid()
+{
+    VoxelGrid grid;
+
+    if (!read_back_current_grid(grid))
+        return;
+
+    if (grid.resolution != m_reference_grid.resolution)
+    {
+        DW_LOG_ERROR("(VCTRenderer) Cannot compare a " + grid.label + " grid with the " + m_reference_grid.label + " reference, the resolutions differ");
+        return;
+    }
+
+    m_grid_comparisons = compare_voxel_grids(m_reference_grid, grid);
+
+    DW_LOG_INFO("(VCTRenderer) Comparing " + grid.label + " against reference " + m_reference_grid.label);
+
+    for (const auto& comparison : m_grid_comparisons)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "(VCTRenderer) Mip %u (%u^3): IoU %.4f, occupied %llu reference / %llu current / %llu both, color difference %.4f (max %.4f)", comparison.mip, comparison.resolution, comparison.iou, (unsigned long long)comparison.occupied_a, (unsigned long long)comparison.occupied_b, (unsigned long long)comparison.occupied_both, comparison.mean_color_difference, comparison.max_color_difference);
+        DW_LOG_INFO(line);
+    }
+
+    if (write_voxel_grid_slices(m_reference_grid, grid, m_grid_slice_mip, "grid_compare"))
+        DW_LOG_INFO("(VCTRenderer) Wrote center slices of mip " + std::to_string(m_grid_slice_mip) + " to grid_compare_x/y/z.ppm");
+}
+
+void VCTRenderer::render(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    VCT_SCOPED_SAMPLE("render", cmd_buf);
+
+    render_shadow_map(cmd_buf);
 
     //if (m_voxelizer->first_time)
     if (true)
     {
-        m_voxelizer->transition_voxel_grid(cmd_buf);
-        m_voxelizer->reset_voxel_grid(cmd_buf);
-        //m_voxelizer->reset_voxelization_image_memory_barrier_voxel_grid(cmd_buf);
-        m_voxelizer->debug_barrier(cmd_buf);
+        // The graphics queue voxelizes the sampled grid in place.
+        voxelize(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        m_voxelizer->first_time = false;
+        m_force_voxelization    = false;
+    }
 
-        m_voxelizer->begin_voxelization(cmd_buf, m_vk_backend);
+    render_main(cmd_buf, true);
+}
 
-        if (m_voxelizer->m_voxelization_type == GEOMETRY_SHADER_VOXELIZATION)
-        {
-            DW_SCOPED_SAMPLE("Geometry voxelizer", cmd_buf);
-            GeometryVoxelizer* voxelization_ptr = dynamic_cast<GeometryVoxelizer*>(m_voxelizer.get());
-            render_objects(cmd_buf, voxelization_ptr->m_pipeline_layout);
-        }
-        else if (m_voxelizer->m_voxelization_type == COMPUTE_SHADER_VOXELIZATION)
-        {
-            ComputeVoxelizer* voxelization_ptr = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
-            voxelization_ptr->voxelize(cmd_buf, m_vk_backend, objects);
-        }
+void VCTRenderer::render_shadow_map(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    VCT_SCOPED_SAMPLE("Shadow map", cmd_buf);
 
-        m_voxelizer->end_voxelization(cmd_buf);
-        //m_voxelizer->voxelization_visualization_image_memory_barrier_voxel_grid(cmd_buf);
-        m_voxelizer->debug_barrier(cmd_buf);
+    m_shadow_map->update_cascades(m_main_camera->m_view, m_camera_fov, float(m_width) / float(m_height), m_camera_near, m_far);
 
+    // The scene is static, so light and camera changes are all caught by needs_render comparing transforms.
+    for (uint32_t i = 0; i < m_shadow_map->cascade_count(); i++)
+    {
+        if (!m_shadow_map->needs_render(i))
+            continue;
 
-        m_voxelizer->reset_instance_buffer(cmd_buf);
-        //m_voxelizer->reset_voxelization_buffer_memory_barrier_indirect(cmd_buf);
-        m_voxelizer->debug_barrier(cmd_buf);
+        if (frustum_culling_available())
+            m_frustum_culler->cull(cmd_buf, m_vk_backend, CULL_VIEW_SHADOW + i, m_shadow_map->cascade_view_projection(i));
+
+        m_shadow_map->begin_render(cmd_buf, m_vk_backend, i);
+        render_objects(cmd_buf, m_shadow_map->m_pipeline_layout, 2, CULL_VIEW_SHADOW + i);
+        m_shadow_map->end_render(cmd_buf);
+    }
+}
+
+void VCTRenderer::voxelize(dw::vk::CommandBuffer::Ptr cmd_buf, VkPipelineStageFlags grid_stage_mask)
+{
+    // Writes the grid selected on the voxelizer.
+    ComputeVoxelizer* compute_voxelizer = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
+
+    m_grid_thresholds[m_voxelizer->current_grid()] = compute_voxelizer ? compute_voxelizer->m_push_constants.large_triangel_threshold : 0;
+
+    m_voxelizer->transition_voxel_grid(cmd_buf, grid_stage_mask);
+    m_voxelizer->reset_voxel_grid(cmd_buf);
+    //m_voxelizer->reset_voxelization_image_memory_barrier_voxel_grid(cmd_buf);
+    m_voxelizer->debug_barrier(cmd_buf);
+
+    m_voxelizer->begin_voxelization(cmd_buf, m_vk_backend);
+
+    if (m_voxelizer->m_voxelization_type == GEOMETRY_SHADER_VOXELIZATION)
+    {
+        VCT_SCOPED_SAMPLE("Geometry voxelizer", cmd_buf);
+        ScopedPassStatistics statistics("Geometry voxelizer", cmd_buf);
+        GeometryVoxelizer* voxelization_ptr = dynamic_cast<GeometryVoxelizer*>(m_voxelizer.get());
+        render_objects(cmd_buf, voxelization_ptr->m_pipeline_layout, 3, CULL_VIEW_NONE);
+    }
+    else if (m_voxelizer->m_voxelization_type == COMPUTE_SHADER_VOXELIZATION)
+    {
+        ComputeVoxelizer* voxelization_ptr = dynamic_cast<ComputeVoxelizer*>(m_voxelizer.get());
+        voxelization_ptr->voxelize(cmd_buf, m_vk_backend, *m_scene);
+    }
+
+    m_voxelizer->end_voxelization(cmd_buf);
+    //m_voxelizer->voxelization_visualization_image_memory_barrier_voxel_grid(cmd_buf);
+    m_voxelizer->debug_barrier(cmd_buf);
+
+    //m_voxelizer->pre_mip_map_image_memory_barrier(cmd_buf);
+    m_voxelizer->generate_mip_maps(cmd_buf);
+
+    m_voxelizer->debug_barrier(cmd_buf);
+}
+
+void VCTRenderer::render_main(dw::vk::CommandBuffer::Ptr cmd_buf, bool grid_voxelized)
+{
+    // The grid is complete and owned by the graphics queue here in both voxelization paths.
+    m_grid_exporter.record(cmd_buf, m_vk_backend, *m_voxelizer, m_frame_count - 1);
 
-        //m_voxelizer->pre_mip_map_image_memory_barrier(cmd_buf);
-        m_voxelizer->generate_mip_maps(cmd_buf);
+    int visualization_mode = m_voxelization_visualization_enabled ? m_voxel_visualization_mode : -1;
 
+    // The instance buffer is only allocated and filled while the voxels are being visualized as cubes.
+    if (visualization_mode == VOXEL_VISUALIZATION_RAY_MARCH)
+    {
+        // The mip count changes with the resolution.
+        m_voxel_ray_march_mip = std::min(std::max(m_voxel_ray_march_mip, 0), int(m_voxelizer->m_mip_level_count) - 1);
+
+        m_voxel_ray_marcher->no_texture = m_mesh_push_constants.noTexture;
+        m_voxel_ray_marcher->march(cmd_buf, m_vk_backend, *m_voxelizer, m_voxel_ray_march_mip, m_main_camera->m_projection * m_main_camera->m_view, m_main_camera->m_position, m_width, m_height);
+    }
+    else if (visualization_mode == VOXEL_VISUALIZATION_SURFACE)
+    {
+        // The grid only changes with the voxelizer and the large triangle threshold the sampled grid was voxelized with.
+        int threshold = m_grid_thresholds[m_voxelizer->current_grid()];
+
+        if (m_voxel_surface_voxelizer.lock() != m_voxelizer || threshold != m_voxel_surface_threshold)
+        {
+            m_voxel_surface_voxelizer = m_voxelizer;
+            m_voxel_surface_threshold = threshold;
+            m_voxel_surface_extractor->invalidate();
+        }
+
+        m_voxel_surface_extractor->no_texture = m_mesh_push_constants.noTexture;
+        m_voxel_surface_extractor->update(cmd_buf, m_vk_backend, *m_voxelizer, grid_voxelized);
+    }
+    else if (visualization_mode == VOXEL_VISUALIZATION_CUBES)
+    {
+        m_voxelizer->reset_instance_buffer(cmd_buf);
+        //m_voxelizer->reset_voxelization_buffer_memory_barrier_indirect(cmd_buf);
         m_voxelizer->debug_barrier(cmd_buf);
 
         m_voxelizer->dispatch_visualization_compute_shader(m_vk_backend, cmd_buf);
         //m_voxelizer->visualization_main_buffer_memory_barrier(cmd_buf);
         m_voxelizer->debug_barrier(cmd_buf);
-
-        m_voxelizer->first_time = false;
     }
 
     uint32_t lights_dynamic_offset = m_ubo_size_lights * m_vk_backend->current_frame_idx();
     uint32_t voxel_grid_dynamic_offset = m_ubo_size_voxel_grid * m_vk_backend->current_frame_idx();
     update_uniforms(cmd_buf);
 
-    if (m_voxelization_visualization_enabled)
+    if (visualization_mode == VOXEL_VISUALIZATION_RAY_MARCH)
+    {
+        begin_render_main(cmd_buf);
+        m_voxel_ray_marcher->present(cmd_buf, m_vk_backend);
+    }
+    else if (visualization_mode == VOXEL_VISUALIZATION_SURFACE)
+    {
+        begin_render_main(cmd_buf);
+        VCT_SCOPED_SAMPLE("Visualization", cmd_buf);
+        m_voxel_surface_extractor->draw(cmd_buf, m_vk_backend, m_main_camera->m_projection * m_main_camera->m_view, m_width, m_height);
+    }
+    else if (visualization_mode == VOXEL_VISUALIZATION_CUBES)
     {
         m_voxelizer->noTexture = m_mesh_push_constants.noTexture;
         m_voxelizer->begin_render_visualizer(cmd_buf, m_vk_backend);
-        DW_SCOPED_SAMPLE("Visualization", cmd_buf);
+        VCT_SCOPED_SAMPLE("Visualization", cmd_buf);
         m_voxelizer->render_voxels(cmd_buf);
     }
     else
     {
         uint32_t dynamic_offset = m_ubo_size_main * m_vk_backend->current_frame_idx();
+
+        if (frustum_culling_available())
+            m_frustum_culler->cull(cmd_buf, m_vk_backend, CULL_VIEW_MAIN, m_main_camera->m_projection * m_main_camera->m_view);
+
+        WorkCounters::get().begin_counters(cmd_buf, WORK_COUNTERS_RENDER, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
         begin_render_main(cmd_buf);
         vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout_main->handle(), 1, 1, &m_ds_transforms_main->handle(), 1, &dynamic_offset);
         vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout_main->handle(), 2, 1, &m_shadow_map->m_ds_shadow_sampler->handle(), 0, nullptr);
         vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout_main->handle(), 3, 1, &m_ds_lights->handle(), 1, &lights_dynamic_offset);
         vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout_main->handle(), 4, 1, &m_voxelizer->m_ds_voxel_grid_mip_maps->handle(), 0, nullptr);
         vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout_main->handle(), 5, 1, &m_ds_voxel_grid_main->handle(), 1, &voxel_grid_dynamic_offset);
-        DW_SCOPED_SAMPLE("Main render", cmd_buf);
-        render_objects(cmd_buf, m_pipeline_layout_main);
+        vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout_main->handle(), 7, 1, &WorkCounters::get().ds()->handle(), 0, nullptr);
+        VCT_SCOPED_SAMPLE("Main render", cmd_buf);
+        ScopedPassStatistics statistics("Main render", cmd_buf);
+        render_objects(cmd_buf, m_pipeline_layout_main, 6, CULL_VIEW_MAIN);
     }
 
 
     render_gui(cmd_buf);
     vkCmdEndRenderPass(cmd_buf->handle());
+
+    if (!m_voxelization_visualization_enabled)
+        WorkCounters::get().end_counters(cmd_buf, WORK_COUNTERS_RENDER, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+bool VCTRenderer::async_voxelization_available()
+{
+    // The geometry shader voxelizer needs the rasterizer, so only the compute path can move off the graphics queue.
+    return m_async_compute_enabled && m_voxelizer->m_voxelization_type == COMPUTE_SHADER_VOXELIZATION;
+}
+
+bool VCTRenderer::submit_async_voxelization(dw::vk::CommandBuffer::Ptr shadow_cmd_buf)
+{
+    uint32_t frame_idx    = m_vk_backend->current_frame_idx();
+    bool     grid_flipped = false;
+
+    // The main pass keeps sampling the last completed grid and never waits on a running voxelization. Its semaphore
+    // has been signaled too by the time the fence has, so waiting on it only completes the ownership transfer.
+    if (m_compute_fence_pending && vkGetFenceStatus(m_vk_backend->device(), m_compute_fences[m_last_compute_frame_idx]->handle()) == VK_SUCCESS)
+    {
+        flip_async_grid(m_last_compute_frame_idx);
+        grid_flipped = true;
+    }
+
+    // The next voxelization is only queued once the previous one has been flipped in.
+    bool voxelize_grid = !m_compute_fence_pending;
+
+    // Shadow map, free to overlap with the voxelization running on the compute queue. It signals once the earlier
+    // frames, which may have sampled the grid the new voxelization writes, are done.
+    std::vector<VkSemaphore>          wait_semaphores;
+    std::vector<VkPipelineStageFlags> wait_stages;
+
+    for (auto& semaphore : m_grid_semaphores)
+    {
+        wait_semaphores.push_back(semaphore->handle());
+        wait_stages.push_back(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    m_grid_semaphores.clear();
+
+    bool signal_grid_consumed = voxelize_grid && !m_pending_grid_consumed_semaphore;
+
+    VkSubmitInfo submit_info;
+    DW_ZERO_MEMORY(submit_info);
+
+    submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.waitSemaphoreCount   = wait_semaphores.size();
+    submit_info.pWaitSemaphores      = wait_semaphores.data();
+    submit_info.pWaitDstStageMask    = wait_stages.data();
+    submit_info.commandBufferCount   = 1;
+    submit_info.pCommandBuffers      = &shadow_cmd_buf->handle();
+    submit_info.signalSemaphoreCount = signal_grid_consumed ? 1 : 0;
+    submit_info.pSignalSemaphores    = &m_grid_consumed_semaphores[frame_idx]->handle();
+
+    vkQueueSubmit(m_vk_backend->graphics_queue(), 1, &submit_info, VK_NULL_HANDLE);
+
+    if (signal_grid_consumed)
+        m_pending_grid_consumed_semaphore = m_grid_consumed_semaphores[frame_idx];
+
+    if (!voxelize_grid)
+        return grid_flipped;
+
+    const auto& queue_infos = m_vk_backend->queue_infos();
+
+    dw::vk::CommandBuffer::Ptr cmd_buf = m_vk_backend->allocate_compute_command_buffer();
+
+    VkCommandBufferBeginInfo begin_info;
+    DW_ZERO_MEMORY(begin_info);
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+    vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
+    GpuProfiler::get().begin_command_buffer(cmd_buf, GPU_QUEUE_COMPUTE);
+    WorkCounters::get().begin_command_buffer(cmd_buf, GPU_QUEUE_COMPUTE);
+
+    {
+        VCT_SCOPED_SAMPLE("Async voxelization", cmd_buf);
+        m_voxelizer->use_write_grid();
+        voxelize(cmd_buf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        m_voxelizer->release_voxel_grid(cmd_buf, queue_infos.compute_queue_index, queue_infos.graphics_queue_index);
+        m_voxelizer->use_read_grid();
+        m_voxelizer->first_time = false;
+    }
+
+    vkEndCommandBuffer(cmd_buf->handle());
+
+    VkSemaphore          wait_semaphore = m_pending_grid_consumed_semaphore ? m_pending_grid_consumed_semaphore->handle() : VK_NULL_HANDLE;
+    VkPipelineStageFlags wait_stage     = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    DW_ZERO_MEMORY(submit_info);
+
+    submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.waitSemaphoreCount   = m_pending_grid_consumed_semaphore ? 1 : 0;
+    submit_info.pWaitSemaphores      = &wait_semaphore;
+    submit_info.pWaitDstStageMask    = &wait_stage;
+    submit_info.commandBufferCount   = 1;
+    submit_info.pCommandBuffers      = &cmd_buf->handle();
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores    = &m_voxelization_finished_semaphores[frame_idx]->handle();
+
+    // Only a voxelization whose grid was sampled without checking its fence, the first one of a voxelizer or one
+    // left behind by a voxelizer switch, can still be running here.
+    vkWaitForFences(m_vk_backend->device(), 1, &m_compute_fences[frame_idx]->handle(), VK_TRUE, UINT64_MAX);
+    vkResetFences(m_vk_backend->device(), 1, &m_compute_fences[frame_idx]->handle());
+
+    if (vkQueueSubmit(m_vk_backend->compute_queue(), 1, &submit_info, m_compute_fences[frame_idx]->handle()) != VK_SUCCESS)
+    {
+        DW_LOG_ERROR("(Vulkan) Failed to submit async voxelization command buffer!");
+        return grid_flipped;
+    }
+
+    m_pending_grid_consumed_semaphore.reset();
+    m_compute_fence_pending  = true;
+    m_last_compute_frame_idx = frame_idx;
+
+    // The grids of a new voxelizer have never been written, so this frame waits for the first one.
+    if (m_force_voxelization)
+    {
+        flip_async_grid(frame_idx);
+        m_force_voxelization = false;
+        grid_flipped         = true;
+    }
+
+    return grid_flipped;
+}
+
+void VCTRenderer::flip_async_grid(uint32_t compute_frame_idx)
+{
+    // The acquire half of the ownership transfer is recorded by the caller into the next graphics command buffer.
+    m_voxelizer->flip_grids();
+    m_grid_semaphores.push_back(m_voxelization_finished_semaphores[compute_frame_idx]);
+    m_compute_fence_pending = false;
+}
+
+void VCTRenderer::drain_async_voxelization(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    if (!m_compute_fence_pending)
+        return;
+
+    // The graphics queue takes over the grid of the last async voxelization instead of waiting for the compute
+    // queue to go idle. This frame's submission waits on its semaphore, the grid is then voxelized in place.
+    const auto& queue_infos = m_vk_backend->queue_infos();
+
+    flip_async_grid(m_last_compute_frame_idx);
+    m_voxelizer->acquire_voxel_grid(cmd_buf, queue_infos.compute_queue_index, queue_infos.graphics_queue_index);
+}
+
+void VCTRenderer::submit_and_present_main(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    uint32_t frame_idx = m_vk_backend->current_frame_idx();
+
+    // Also waits on the voxelizations whose grid this frame acquires and that no earlier submission waited on.
+    std::vector<dw::vk::Semaphore::Ptr> wait_semaphores   = { m_image_available_semaphores[frame_idx] };
+    std::vector<VkPipelineStageFlags>   wait_stages       = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    std::vector<dw::vk::Semaphore::Ptr> signal_semaphores = { m_render_finished_semaphores[frame_idx] };
+
+    for (auto& semaphore : m_grid_semaphores)
+    {
+        wait_semaphores.push_back(semaphore);
+        wait_stages.push_back(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
+
+    m_grid_semaphores.clear();
+
+    m_vk_backend->submit_graphics({ cmd_buf }, wait_semaphores, wait_stages, signal_semaphores);
+    m_vk_backend->present({ m_render_finished_semaphores[frame_idx] });
 }
 
 void VCTRenderer::update_uniforms(dw::vk::CommandBuffer::Ptr cmd_buf)
 {
-    DW_SCOPED_SAMPLE("update_uniforms", cmd_buf);
+    VCT_SCOPED_SAMPLE("update_uniforms", cmd_buf);
 
     m_transforms_main.view             = m_main_camera->m_view;
     m_transforms_main.projection       = m_main_camera->m_projection;
-    m_transforms_main.lightSpaceMatrix = m_shadow_map->projection() * m_shadow_map->view();
     m_transforms_main.camera_pos       = glm::vec4(m_main_camera->m_position, 1.0f);
+    m_transforms_main.cascade_count    = m_shadow_map->cascade_count();
+
+    for (uint32_t i = 0; i < m_shadow_map->cascade_count(); i++)
+    {
+        m_transforms_main.lightSpaceMatrix[i] = m_shadow_map->cascade_view_projection(i);
+        m_transforms_main.cascade_splits[i]   = m_shadow_map->cascade_split(i);
+    }
+
     uint8_t* ptr                       = (uint8_t*)m_ubo_transforms_main->mapped_ptr();
     memcpy(ptr + m_ubo_size_main * m_vk_backend->current_frame_idx(), &m_transforms_main, sizeof(TransformsMain));
 
@@ -712,6 +1470,7 @@ void VCTRenderer::update_uniforms(dw::vk::CommandBuffer::Ptr cmd_buf)
     m_voxelizer->m_visualizer_transforms.view = m_transforms_main.view;
     m_voxelizer->m_visualizer_transforms.projection = m_transforms_main.projection;
     m_voxelizer->m_visualizer_transforms.model      = m_voxelizer->m_cube.get_model();
+    m_voxelizer->m_visualizer_transforms.grid       = glm::vec4(aabb.min, m_voxelizer->m_voxel_width);
     ptr = (uint8_t*)m_voxelizer->m_visualizer_ubo_data->mapped_ptr();
     memcpy(ptr + m_voxelizer->m_visualizer_ubo_size * m_vk_backend->current_frame_idx(), &m_voxelizer->m_visualizer_transforms, sizeof(VisualizerUBO));
 
@@ -0,0 +1,412 @@
+#include "VoxelGridExporter.h"
+#include "VoxelGridReadback.h"
+#include "ThreadPool.h"
+#include <imgui.h>
+#include <logger.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+static const uint32_t kBrickSize   = 8;
+static const uint32_t kLeafDim     = 8;
+static const uint32_t kInternalDim = 16;
+
+static void write_u32(std::ofstream& file, uint32_t value)
+{
+    file.write((const char*)&value, sizeof(uint32_t));
+}
+
+// Flushes the file and reports a failed write, e.g. on a full disk, that the stream has only recorded in its state.
+static bool finish_file(std::ofstream& file, const std::string& path)
+{
+    file.flush();
+
+    if (!file.good())
+    {
+        DW_LOG_ERROR("(VoxelGridExporter) Write error in " + path);
+        return false;
+    }
+
+    return true;
+}
+
+static void write_vox_chunk(std::ofstream& file, const char* id, uint32_t content_size, uint32_t children_size)
+{
+    file.write(id, 4);
+    write_u32(file, content_size);
+    write_u32(file, children_size);
+}
+
+// 6 x 7 x 6 color cube, index 0 is empty in .vox so the cube starts at 1.
+static uint8_t vox_palette_index(const uint8_t* color)
+{
+    // Mips above 0 average the coverage into alpha along with the color, divide it out like voxel_vis.comp.
+    uint32_t alpha = color[3];
+    uint32_t red   = alpha == 255 ? color[0] : std::min((color[0] * 255 + alpha / 2) / alpha, 255u);
+    uint32_t green = alpha == 255 ? color[1] : std::min((color[1] * 255 + alpha / 2) / alpha, 255u);
+    uint32_t blue  = alpha == 255 ? color[2] : std::min((color[2] * 255 + alpha / 2) / alpha, 255u);
+
+    uint32_t r = (red * 5 + 127) / 255;
+    uint32_t g = (green * 6 + 127) / 255;
+    uint32_t b = (blue * 5 + 127) / 255;
+
+    return 1 + r * 42 + g * 6 + b;
+}
+
+static bool write_vox(const uint8_t* voxels, uint32_t resolution, const std::string& path)
+{
+    std::vector<uint8_t> xyzi;
+
+    // .vox is z up, the grid is y up.
+    for (uint32_t z = 0; z < resolution; z++)
+    {
+        for (uint32_t y = 0; y < resolution; y++)
+        {
+            for (uint32_t x = 0; x < resolution; x++)
+            {
+                const uint8_t* voxel = voxels + ((size_t(z) * resolution + y) * resolution + x) * 4;
+
+                if (!voxel[3])
+                    continue;
+
+                xyzi.push_back(x);
+                xyzi.push_back(z);
+                xyzi.push_back(y);
+                xyzi.push_back(vox_palette_index(voxel));
+            }
+        }
+    }
+
+    // Palette entry i is used by color index i + 1.
+    uint8_t palette[256 * 4];
+    memset(palette, 0, sizeof(palette));
+
+    for (uint32_t i = 0; i < 6 * 7 * 6; i++)
+    {
+        palette[i * 4 + 0] = (i / 42) * 51;
+        palette[i * 4 + 1] = ((i % 42) / 6) * 255 / 6;
+        palette[i * 4 + 2] = (i % 6) * 51;
+        palette[i * 4 + 3] = 255;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file)
+        return false;
+
+    uint32_t size_chunk    = 12 + 12;
+    uint32_t xyzi_chunk    = 12 + 4 + xyzi.size();
+    uint32_t palette_chunk = 12 + sizeof(palette);
+
+    file.write("VOX ", 4);
+    write_u32(file, 150);
+
+    write_vox_chunk(file, "MAIN", 0, size_chunk + xyzi_chunk + palette_chunk);
+
+    write_vox_chunk(file, "SIZE", 12, 0);
+    write_u32(file, resolution);
+    write_u32(file, resolution);
+    write_u32(file, resolution);
+
+    write_vox_chunk(file, "XYZI", 4 + xyzi.size(), 0);
+    write_u32(file, xyzi.size() / 4);
+    file.write((const char*)xyzi.data(), xyzi.size());
+
+    write_vox_chunk(file, "RGBA", sizeof(palette), 0);
+    file.write((const char*)palette, sizeof(palette));
+
+    return finish_file(file, path);
+}
+
+static bool write_bricks(const uint8_t* voxels, uint32_t resolution, const AABB& aabb, const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file)
+        return false;
+
+    VoxelBricksHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, "VCTB", 4);
+    header.version     = 1;
+    header.resolution  = resolution;
+    header.brick_size  = kBrickSize;
+    header.aabb_min[0] = aabb.min.x;
+    header.aabb_min[1] = aabb.min.y;
+    header.aabb_min[2] = aabb.min.z;
+    header.aabb_max[0] = aabb.max.x;
+    header.aabb_max[1] = aabb.max.y;
+    header.aabb_max[2] = aabb.max.z;
+
+    // The brick count is patched in once every brick has been visited.
+    file.write((const char*)&header, sizeof(header));
+
+    uint32_t             bricks_per_side = (resolution + kBrickSize - 1) / kBrickSize;
+    std::vector<uint8_t> brick(kBrickSize * kBrickSize * kBrickSize * 4);
+
+    for (uint32_t bz = 0; bz < bricks_per_side; bz++)
+    {
+        for (uint32_t by = 0; by < bricks_per_side; by++)
+        {
+            for (uint32_t bx = 0; bx < bricks_per_side; bx++)
+            {
+                bool occupied = false;
+
+                std::fill(brick.begin(), brick.end(), 0);
+
+                for (uint32_t z = 0; z < kBrickSize && bz * kBrickSize + z < resolution; z++)
+                {
+                    for (uint32_t y = 0; y < kBrickSize && by * kBrickSize + y < resolution; y++)
+                    {
+                        for (uint32_t x = 0; x < kBrickSize && bx * kBrickSize + x < resolution; x++)
+                        {
+                            const uint8_t* voxel = voxels + ((size_t(bz * kBrickSize + z) * resolution + by * kBrickSize + y) * resolution + bx * kBrickSize + x) * 4;
+
+                            memcpy(&brick[((z * kBrickSize + y) * kBrickSize + x) * 4], voxel, 4);
+                            occupied |= voxel[3] != 0;
+                        }
+                    }
+                }
+
+                if (!occupied)
+                    continue;
+
+                write_u32(file, bx);
+                write_u32(file, by);
+                write_u32(file, bz);
+                write_u32(file, 0);
+                file.write((const char*)brick.data(), brick.size());
+
+                header.brick_count++;
+            }
+        }
+    }
+
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+
+    return finish_file(file, path);
+}
+
+static bool write_sparse(const uint8_t* voxels, uint32_t resolution, const AABB& aabb, const std::string& path)
+{
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file)
+        return false;
+
+    VoxelSparseHeader header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, "VCTS", 4);
+    header.version      = 1;
+    header.resolution   = resolution;
+    header.leaf_dim     = kLeafDim;
+    header.internal_dim = kInternalDim;
+    header.aabb_min[0]  = aabb.min.x;
+    header.aabb_min[1]  = aabb.min.y;
+    header.aabb_min[2]  = aabb.min.z;
+    header.aabb_max[0]  = aabb.max.x;
+    header.aabb_max[1]  = aabb.max.y;
+    header.aabb_max[2]  = aabb.max.z;
+
+    // The internal node count is patched in once every node has been visited.
+    file.write((const char*)&header, sizeof(header));
+
+    uint32_t internal_span     = kLeafDim * kInternalDim;
+    uint32_t internal_per_side = (resolution + internal_span - 1) / internal_span;
+
+    std::vector<uint8_t> leaves;
+    std::vector<uint8_t> values;
+
+    for (uint32_t nz = 0; nz < internal_per_side; nz++)
+    {
+        for (uint32_t ny = 0; ny < internal_per_side; ny++)
+        {
+            for (uint32_t nx = 0; nx < internal_per_side; nx++)
+            {
+                uint64_t child_mask[kInternalDim * kInternalDim * kInternalDim / 64] = {};
+                uint32_t leaf_count = 0;
+
+                leaves.clear();
+
+                for (uint32_t leaf = 0; leaf < kInternalDim * kInternalDim * kInternalDim; leaf++)
+                {
+                    uint32_t ox = nx * internal_span + (leaf % kInternalDim) * kLeafDim;
+                    uint32_t oy = ny * internal_span + (leaf / kInternalDim % kInternalDim) * kLeafDim;
+                    uint32_t oz = nz * internal_span + (leaf / (kInternalDim * kInternalDim)) * kLeafDim;
+
+                    if (ox >= resolution || oy >= resolution || oz >= resolution)
+                        continue;
+
+                    uint64_t value_mask[kLeafDim * kLeafDim * kLeafDim / 64] = {};
+
+                    values.clear();
+
+                    for (uint32_t i = 0; i < kLeafDim * kLeafDim * kLeafDim; i++)
+                    {
+                        uint32_t x = ox + i % kLeafDim;
+                        uint32_t y = oy + i / kLeafDim % kLeafDim;
+                        uint32_t z = oz + i / (kLeafDim * kLeafDim);
+
+                        if (x >= resolution || y >= resolution || z >= resolution)
+                            continue;
+
+                        const uint8_t* voxel = voxels + ((size_t(z) * resolution + y) * resolution + x) * 4;
+
+                        if (!voxel[3])
+                            continue;
+
+                        value_mask[i / 64] |= uint64_t(1) << (i % 64);
+                        values.insert(values.end(), voxel, voxel + 4);
+                    }
+
+                    if (values.empty())
+                        continue;
+
+                    child_mask[leaf / 64] |= uint64_t(1) << (leaf % 64);
+                    leaf_count++;
+
+                    leaves.insert(leaves.end(), (const uint8_t*)value_mask, (const uint8_t*)value_mask + sizeof(value_mask));
+                    leaves.insert(leaves.end(), values.begin(), values.end());
+                }
+
+                if (leaf_count == 0)
+                    continue;
+
+                write_u32(file, nx * internal_span);
+                write_u32(file, ny * internal_span);
+                write_u32(file, nz * internal_span);
+                write_u32(file, leaf_count);
+                file.write((const char*)child_mask, sizeof(child_mask));
+                file.write((const char*)leaves.data(), leaves.size());
+
+                header.internal_count++;
+            }
+        }
+    }
+
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+
+    return finish_file(file, path);
+}
+
+void VoxelGridExporter::request(uint32_t formats, const std::string& prefix)
+{
+    if (busy() || formats == 0)
+        return;
+
+    m_formats   = formats;
+    m_prefix    = prefix;
+    m_requested = true;
+}
+
+void VoxelGridExporter::record(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, const Voxelizer& voxelizer, uint64_t frame)
+{
+    if (!m_requested)
+        return;
+
+    m_requested = false;
+
+    VkDeviceSize size = voxel_grid_copy_regions(voxelizer, m_regions);
+
+    m_staging = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, VMA_MEMORY_USAGE_GPU_TO_CPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+    if (!m_staging)
+    {
+        DW_LOG_ERROR("(VoxelGridExporter) Failed to allocate a " + std::to_string(size) + " byte staging buffer");
+        return;
+    }
+
+    m_staging->set_name("VoxelGridExporter::m_staging");
+
+    record_voxel_grid_copy(cmd_buf, voxelizer, m_staging, m_regions);
+
+    m_resolution = voxelizer.m_voxels_per_side;
+    m_aabb       = voxelizer.get_AABB();
+    m_copy_frame = frame;
+}
+
+void VoxelGridExporter::update(uint64_t frame)
+{
+    if (!m_staging)
+        return;
+
+    if (m_write.valid())
+    {
+        if (m_write.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+
+        m_write.get();
+        m_staging.reset();
+        return;
+    }
+
+    // The framework waits on a frame's fence before its slot is reused.
+    if (frame < m_copy_frame + dw::vk::Backend::kMaxFramesInFlight)
+        return;
+
+    const uint8_t*                 data       = (const uint8_t*)m_staging->mapped_ptr();
+    std::vector<VkBufferImageCopy> regions    = m_regions;
+    uint32_t                       resolution = m_resolution;
+    AABB                           aabb       = m_aabb;
+    uint32_t                       formats    = m_formats;
+    std::string                    prefix     = m_prefix;
+
+    m_write = ThreadPool::global().submit([=]() {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        if (formats & VOXEL_GRID_EXPORT_VOX)
+        {
+            // MagicaVoxel stores coordinates in bytes.
+            uint32_t mip = 0;
+
+            while ((resolution >> mip) > 256)
+                mip++;
+
+            if (!write_vox(data + regions[mip].bufferOffset, resolution >> mip, prefix + ".vox"))
+                DW_LOG_ERROR("(VoxelGridExporter) Failed to write " + prefix + ".vox");
+        }
+
+        if ((formats & VOXEL_GRID_EXPORT_BRICKS) && !write_bricks(data, resolution, aabb, prefix + ".bricks"))
+            DW_LOG_ERROR("(VoxelGridExporter) Failed to write " + prefix + ".bricks");
+
+        if ((formats & VOXEL_GRID_EXPORT_SPARSE) && !write_sparse(data, resolution, aabb, prefix + ".sparse"))
+            DW_LOG_ERROR("(VoxelGridExporter) Failed to write " + prefix + ".sparse");
+
+        float time = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        DW_LOG_INFO("(VoxelGridExporter) Exported the " + std::to_string(resolution) + "^3 grid to " + prefix + " in " + std::to_string(time) + " ms");
+    });
+}
+
+void VoxelGridExporter::shutdown()
+{
+    if (m_write.valid())
+        m_write.wait();
+
+    m_write = std::future<void>();
+    m_staging.reset();
+    m_requested = false;
+}
+
+void VoxelGridExporter::gui()
+{
+    if (!ImGui::CollapsingHeader("Voxel Grid Export"))
+        return;
+
+    if (busy())
+    {
+        ImGui::Text("Exporting to %s...", m_prefix.c_str());
+        return;
+    }
+
+    ImGui::CheckboxFlags("MagicaVoxel (.vox)", &m_formats, VOXEL_GRID_EXPORT_VOX);
+    ImGui::CheckboxFlags("Raw bricks (.bricks)", &m_formats, VOXEL_GRID_EXPORT_BRICKS);
+    ImGui::CheckboxFlags("Sparse tree (.sparse)", &m_formats, VOXEL_GRID_EXPORT_SPARSE);
+
+    if (ImGui::Button("Export Grid"))
+        request(m_formats, m_prefix);
+}
@@ -0,0 +1,273 @@
+#include "VoxelGridReadback.h"
+#include "ThreadPool.h"
+#include <macros.h>
+#include <logger.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+VkDeviceSize voxel_grid_copy_regions(const Voxelizer& voxelizer, std::vector<VkBufferImageCopy>& regions)
+{
+    VkDeviceSize size = 0;
+
+    regions.resize(voxelizer.m_mip_level_count);
+
+    for (uint32_t i = 0; i < voxelizer.m_mip_level_count; i++)
+    {
+        uint32_t resolution = std::max(voxelizer.m_voxels_per_side >> i, 1u);
+
+        DW_ZERO_MEMORY(regions[i]);
+        regions[i].bufferOffset                = size;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel   = i;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageExtent                 = { resolution, resolution, resolution };
+
+        size += VkDeviceSize(resolution) * resolution * resolution * 4;
+    }
+
+    return size;
+}
+
+void record_voxel_grid_copy(dw::vk::CommandBuffer::Ptr cmd_buf, const Voxelizer& voxelizer, dw::vk::Buffer::Ptr buffer, const std::vector<VkBufferImageCopy>& regions)
+{
+    // The grid stays in the general layout, only the shader writes have to be made visible to the copy.
+    VkImageMemoryBarrier image_barrier;
+    DW_ZERO_MEMORY(image_barrier);
+
+    image_barrier.sType                       = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_barrier.srcAccessMask               = VK_ACCESS_SHADER_WRITE_BIT;
+    image_barrier.dstAccessMask               = VK_ACCESS_TRANSFER_READ_BIT;
+    image_barrier.oldLayout                   = VK_IMAGE_LAYOUT_GENERAL;
+    image_barrier.newLayout                   = VK_IMAGE_LAYOUT_GENERAL;
+    image_barrier.srcQueueFamilyIndex         = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex         = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.image                       = voxelizer.m_image->handle();
+    image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_barrier.subresourceRange.levelCount = voxelizer.m_mip_level_count;
+    image_barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_barrier);
+
+    vkCmdCopyImageToBuffer(cmd_buf->handle(), voxelizer.m_image->handle(), VK_IMAGE_LAYOUT_GENERAL, buffer->handle(), regions.size(), regions.data());
+
+    // Later passes of the frame sample the grid and the next voxelization overwrites it, both after the copy.
+    image_barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    image_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    VkBufferMemoryBarrier buffer_barrier;
+    DW_ZERO_MEMORY(buffer_barrier);
+
+    buffer_barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    buffer_barrier.srcAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_barrier.dstAccessMask       = VK_ACCESS_HOST_READ_BIT;
+    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.buffer              = buffer->handle();
+    buffer_barrier.size                = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &buffer_barrier, 1, &image_barrier);
+}
+
+bool read_back_voxel_grid(dw::vk::Backend::Ptr backend, const Voxelizer& voxelizer, VoxelGrid& grid)
+{
+    std::vector<VkBufferImageCopy> regions;
+    VkDeviceSize                   size = voxel_grid_copy_regions(voxelizer, regions);
+
+    dw::vk::Buffer::Ptr staging = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, VMA_MEMORY_USAGE_GPU_TO_CPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+    if (!staging)
+    {
+        DW_LOG_ERROR("(VoxelGridReadback) Failed to allocate a " + std::to_string(size) + " byte staging buffer");
+        return false;
+    }
+
+    dw::vk::CommandBuffer::Ptr cmd_buf = backend->allocate_graphics_command_buffer();
+
+    VkCommandBufferBeginInfo begin_info;
+    DW_ZERO_MEMORY(begin_info);
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(cmd_buf->handle(), &begin_info);
+    record_voxel_grid_copy(cmd_buf, voxelizer, staging, regions);
+    vkEndCommandBuffer(cmd_buf->handle());
+
+    VkSubmitInfo submit_info;
+    DW_ZERO_MEMORY(submit_info);
+
+    submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers    = &cmd_buf->handle();
+
+    vkQueueSubmit(backend->graphics_queue(), 1, &submit_info, VK_NULL_HANDLE);
+    vkQueueWaitIdle(backend->graphics_queue());
+
+    const uint8_t* ptr = (const uint8_t*)staging->mapped_ptr();
+
+    grid.resolution = voxelizer.m_voxels_per_side;
+    grid.mips.resize(regions.size());
+
+    for (uint32_t i = 0; i < regions.size(); i++)
+    {
+        uint32_t resolution = grid.mip_resolution(i);
+        size_t   mip_size   = size_t(resolution) * resolution * resolution * 4;
+
+        grid.mips[i].assign(ptr + regions[i].bufferOffset, ptr + regions[i].bufferOffset + mip_size);
+    }
+
+    return true;
+}
+
+static uint32_t color_difference(const uint8_t* a, const uint8_t* b)
+{
+    return abs(int(a[0]) - int(b[0])) + abs(int(a[1]) - int(b[1])) + abs(int(a[2]) - int(b[2]));
+}
+
+std::vector<VoxelGridMipComparison> compare_voxel_grids(const VoxelGrid& a, const VoxelGrid& b)
+{
+    std::vector<VoxelGridMipComparison> comparisons;
+
+    if (a.resolution != b.resolution)
+        return comparisons;
+
+    for (uint32_t mip = 0; mip < std::min(a.mips.size(), b.mips.size()); mip++)
+    {
+        struct SliceCounts
+        {
+            uint64_t occupied_a;
+            uint64_t occupied_b;
+            uint64_t occupied_both;
+            uint64_t difference_sum;
+            uint32_t difference_max;
+        };
+
+        uint32_t                 resolution = a.mip_resolution(mip);
+        std::vector<SliceCounts> slices(resolution);
+
+        // Every z slice is counted by its own job and summed afterwards.
+        ThreadPool::global().parallel_for(resolution, [&](uint32_t z) {
+            SliceCounts& counts = slices[z];
+            memset(&counts, 0, sizeof(SliceCounts));
+
+            const uint8_t* voxel_a = a.mips[mip].data() + size_t(z) * resolution * resolution * 4;
+            const uint8_t* voxel_b = b.mips[mip].data() + size_t(z) * resolution * resolution * 4;
+
+            for (uint32_t i = 0; i < resolution * resolution; i++, voxel_a += 4, voxel_b += 4)
+            {
+                bool in_a = voxel_a[3] != 0;
+                bool in_b = voxel_b[3] != 0;
+
+                counts.occupied_a += in_a;
+                counts.occupied_b += in_b;
+
+                if (in_a && in_b)
+                {
+                    uint32_t difference = color_difference(voxel_a, voxel_b);
+
+                    counts.occupied_both++;
+                    counts.difference_sum += difference;
+                    counts.difference_max = std::max(counts.difference_max, difference);
+                }
+            }
+        });
+
+        VoxelGridMipComparison comparison;
+        uint64_t               difference_sum = 0;
+        uint32_t               difference_max = 0;
+
+        comparison.mip           = mip;
+        comparison.resolution    = resolution;
+        comparison.occupied_a    = 0;
+        comparison.occupied_b    = 0;
+        comparison.occupied_both = 0;
+
+        for (const auto& counts : slices)
+        {
+            comparison.occupied_a += counts.occupied_a;
+            comparison.occupied_b += counts.occupied_b;
+            comparison.occupied_both += counts.occupied_both;
+            difference_sum += counts.difference_sum;
+            difference_max = std::max(difference_max, counts.difference_max);
+        }
+
+        uint64_t occupied_either = comparison.occupied_a + comparison.occupied_b - comparison.occupied_both;
+
+        comparison.iou                   = occupied_either > 0 ? double(comparison.occupied_both) / double(occupied_either) : 1.0;
+        comparison.mean_color_difference = comparison.occupied_both > 0 ? double(difference_sum) / (double(comparison.occupied_both) * 3.0 * 255.0) : 0.0;
+        comparison.max_color_difference  = double(difference_max) / (3.0 * 255.0);
+
+        comparisons.push_back(comparison);
+    }
+
+    return comparisons;
+}
+
+bool write_voxel_grid_slices(const VoxelGrid& a, const VoxelGrid& b, uint32_t mip, const std::string& prefix)
+{
+    if (a.resolution != b.resolution || mip >= a.mips.size() || mip >= b.mips.size())
+        return false;
+
+    static const char* axis_names[3] = { "x", "y", "z" };
+
+    uint32_t resolution = a.mip_resolution(mip);
+    uint32_t width      = resolution * 3;
+
+    std::vector<uint8_t> pixels(size_t(width) * resolution * 3);
+
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        for (uint32_t row = 0; row < resolution; row++)
+        {
+            for (uint32_t column = 0; column < resolution; column++)
+            {
+                // Slice plane spanned by the two other axes, flipped so that up is up in the image.
+                uint32_t coords[3];
+
+                coords[axis]           = resolution / 2;
+                coords[(axis + 1) % 3] = column;
+                coords[(axis + 2) % 3] = resolution - 1 - row;
+
+                size_t         offset  = ((size_t(coords[2]) * resolution + coords[1]) * resolution + coords[0]) * 4;
+                const uint8_t* voxel_a = &a.mips[mip][offset];
+                const uint8_t* voxel_b = &b.mips[mip][offset];
+                uint8_t*       pixel   = &pixels[(size_t(row) * width + column) * 3];
+
+                memset(pixel, 0, 3);
+                memset(pixel + resolution * 3, 0, 3);
+                memset(pixel + resolution * 6, 0, 3);
+
+                if (voxel_a[3])
+                    memcpy(pixel, voxel_a, 3);
+
+                if (voxel_b[3])
+                    memcpy(pixel + resolution * 3, voxel_b, 3);
+
+                uint8_t* difference = pixel + resolution * 6;
+
+                if (voxel_a[3] && voxel_b[3])
+                    memset(difference, std::min(color_difference(voxel_a, voxel_b) * 4 / 3, 255u), 3);
+                else if (voxel_a[3])
+                    difference[0] = 255;
+                else if (voxel_b[3])
+                    difference[1] = 255;
+            }
+        }
+
+        std::string   path = prefix + "_" + axis_names[axis] + ".ppm";
+        std::ofstream file(path, std::ios::binary);
+
+        if (!file)
+        {
+            DW_LOG_ERROR("(VoxelGridReadback) Failed to open " + path + " for writing");
+            return false;
+        }
+
+        file << "P6\n" << width << " " << resolution << "\n255\n";
+        file.write((const char*)pixels.data(), pixels.size());
+    }
+
+    return true;
+}
@@ -0,0 +1,320 @@
+#include "VoxelRayMarcher.h"
+#include "GpuProfiler.h"
+#include <macros.h>
+#include <logger.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+
+VoxelRayMarcher::VoxelRayMarcher(dw::vk::Backend::Ptr backend)
+{
+    create_descriptor_sets(backend);
+}
+
+void VoxelRayMarcher::create_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    create_compute_pipeline_state(backend);
+    create_present_pipeline_state(backend);
+}
+
+void VoxelRayMarcher::create_descriptor_sets(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::DescriptorSetLayout::Desc desc;
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    m_ds_layout = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout->set_name("VoxelRayMarcher::m_ds_layout");
+
+    for (uint32_t i = 0; i < dw::vk::Backend::kMaxFramesInFlight; i++)
+    {
+        m_ds.push_back(backend->allocate_descriptor_set(m_ds_layout));
+        m_ds.back()->set_name("VoxelRayMarcher::m_ds");
+    }
+}
+
+void VoxelRayMarcher::create_compute_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::ShaderModule::Ptr     cs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_ray_march.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc;
+    pso_desc.set_shader_stage(cs, "main");
+
+    dw::vk::PipelineLayout::Desc pl_desc;
+    pl_desc.add_descriptor_set_layout(m_ds_layout);
+    pl_desc.add_push_constant_range(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(VoxelRayMarchPushConstants));
+    m_compute_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+    m_compute_pipeline_layout->set_name("VoxelRayMarcher::m_compute_pipeline_layout");
+
+    pso_desc.set_pipeline_layout(m_compute_pipeline_layout);
+    m_compute_pipeline = dw::vk::ComputePipeline::create(backend, pso_desc);
+}
+
+void VoxelRayMarcher::create_present_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    // ---------------------------------------------------------------------------
+    // Create shader modules
+    // ---------------------------------------------------------------------------
+
+    dw::vk::ShaderModule::Ptr vs = dw::vk::ShaderModule::create_from_file(backend, "shaders/fullscreen_triangle.vert.spv");
+    dw::vk::ShaderModule::Ptr fs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_ray_march.frag.spv");
+
+    dw::vk::GraphicsPipeline::Desc pso_desc;
+
+    pso_desc.add_shader_stage(VK_SHADER_STAGE_VERTEX_BIT, vs, "main")
+        .add_shader_stage(VK_SHADER_STAGE_FRAGMENT_BIT, fs, "main");
+
+    // ---------------------------------------------------------------------------
+    // Create vertex input state
+    // ---------------------------------------------------------------------------
+
+    // The triangle is generated from gl_VertexIndex.
+    dw::vk::VertexInputStateDesc vertex_input_state_desc;
+
+    pso_desc.set_vertex_input_state(vertex_input_state_desc);
+
+    // ---------------------------------------------------------------------------
+    // Create pipeline input assembly state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::InputAssemblyStateDesc input_assembly_state_desc;
+
+    input_assembly_state_desc.set_primitive_restart_enable(false)
+        .set_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+    pso_desc.set_input_assembly_state(input_assembly_state_desc);
+
+    // ---------------------------------------------------------------------------
+    // Create viewport state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::ViewportStateDesc vp_desc;
+
+    vp_desc.add_viewport(0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f)
+        .add_scissor(0, 0, 1, 1);
+
+    pso_desc.set_viewport_state(vp_desc);
+
+    // ---------------------------------------------------------------------------
+    // Create rasterization state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::RasterizationStateDesc rs_state;
+
+    rs_state.set_depth_clamp(VK_FALSE)
+        .set_rasterizer_discard_enable(VK_FALSE)
+        .set_polygon_mode(VK_POLYGON_MODE_FILL)
+        .set_line_width(1.0f)
+        .set_cull_mode(VK_CULL_MODE_NONE)
+        .set_front_face(VK_FRONT_FACE_COUNTER_CLOCKWISE)
+        .set_depth_bias(VK_FALSE);
+
+    pso_desc.set_rasterization_state(rs_state);
+
+    // ---------------------------------------------------------------------------
+    // Create multisample state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::MultisampleStateDesc ms_state;
+
+    ms_state.set_sample_shading_enable(VK_FALSE)
+        .set_rasterization_samples(VK_SAMPLE_COUNT_1_BIT);
+
+    pso_desc.set_multisample_state(ms_state);
+
+    // ---------------------------------------------------------------------------
+    // Create depth stencil state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::DepthStencilStateDesc ds_state;
+
+    ds_state.set_depth_test_enable(VK_FALSE)
+        .set_depth_write_enable(VK_FALSE)
+        .set_depth_compare_op(VK_COMPARE_OP_ALWAYS)
+        .set_depth_bounds_test_enable(VK_FALSE)
+        .set_stencil_test_enable(VK_FALSE);
+
+    pso_desc.set_depth_stencil_state(ds_state);
+
+    // ---------------------------------------------------------------------------
+    // Create color blend state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::ColorBlendAttachmentStateDesc blend_att_desc;
+
+    blend_att_desc.set_color_write_mask(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT)
+        .set_blend_enable(VK_FALSE);
+
+    dw::vk::ColorBlendStateDesc blend_state;
+
+    blend_state.set_logic_op_enable(VK_FALSE)
+        .set_logic_op(VK_LOGIC_OP_COPY)
+        .set_blend_constants(0.0f, 0.0f, 0.0f, 0.0f)
+        .add_attachment(blend_att_desc);
+
+    pso_desc.set_color_blend_state(blend_state);
+
+    // ---------------------------------------------------------------------------
+    // Create pipeline layout
+    // ---------------------------------------------------------------------------
+
+    dw::vk::PipelineLayout::Desc pl_desc;
+
+    pl_desc.add_descriptor_set_layout(m_ds_layout);
+
+    m_present_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+    m_present_pipeline_layout->set_name("VoxelRayMarcher::m_present_pipeline_layout");
+
+    pso_desc.set_pipeline_layout(m_present_pipeline_layout);
+
+    // ---------------------------------------------------------------------------
+    // Create dynamic state
+    // ---------------------------------------------------------------------------
+
+    pso_desc.add_dynamic_state(VK_DYNAMIC_STATE_VIEWPORT)
+        .add_dynamic_state(VK_DYNAMIC_STATE_SCISSOR);
+
+    // ---------------------------------------------------------------------------
+    // Create pipeline
+    // ---------------------------------------------------------------------------
+
+    pso_desc.set_render_pass(backend->swapchain_render_pass());
+
+    m_present_pipeline = dw::vk::GraphicsPipeline::create(backend, pso_desc);
+}
+
+void VoxelRayMarcher::create_image(dw::vk::Backend::Ptr backend, uint32_t width, uint32_t height)
+{
+    if (m_image)
+        m_retired_images.push_back({ m_image, m_image_view, uint32_t(dw::vk::Backend::kMaxFramesInFlight) });
+
+    m_width  = width;
+    m_height = height;
+
+    m_image = dw::vk::Image::create(backend, VK_IMAGE_TYPE_2D, width, height, 1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_STORAGE_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+    m_image->set_name("VoxelRayMarcher::m_image");
+
+    m_image_view = dw::vk::ImageView::create(backend, m_image, VK_IMAGE_VIEW_TYPE_2D, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1);
+    m_image_view->set_name("VoxelRayMarcher::m_image_view");
+
+    DW_LOG_INFO("(VoxelRayMarcher) Output image resized to " + std::to_string(width) + "x" + std::to_string(height));
+}
+
+void VoxelRayMarcher::write_descriptor_set(dw::vk::Backend::Ptr backend, Voxelizer& voxelizer, uint32_t mip_level)
+{
+    VkDescriptorImageInfo image_infos[2];
+    VkWriteDescriptorSet  write_datas[2];
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        DW_ZERO_MEMORY(image_infos[i]);
+        DW_ZERO_MEMORY(write_datas[i]);
+
+        image_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_infos[i].imageView   = i == 0 ? voxelizer.m_image_views_mip_levels[mip_level]->handle() : m_image_view->handle();
+        image_infos[i].sampler     = nullptr;
+
+        write_datas[i].sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_datas[i].descriptorCount = 1;
+        write_datas[i].descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        write_datas[i].pImageInfo      = &image_infos[i];
+        write_datas[i].dstBinding      = i;
+        write_datas[i].dstSet          = m_ds[backend->current_frame_idx()]->handle();
+    }
+
+    vkUpdateDescriptorSets(backend->device(), 2, write_datas, 0, nullptr);
+}
+
+void VoxelRayMarcher::march(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Voxelizer& voxelizer, uint32_t mip_level, const glm::mat4& view_projection, const glm::vec3& camera_pos, uint32_t width, uint32_t height)
+{
+    VCT_SCOPED_SAMPLE("Voxel ray march", cmd_buf);
+
+    // Every call is a later frame, so a retired image is unused after as many calls as there are frames in flight.
+    for (auto& retired : m_retired_images)
+        retired.frames_left--;
+
+    m_retired_images.erase(std::remove_if(m_retired_images.begin(), m_retired_images.end(), [](const RetiredImage& retired) { return retired.frames_left == 0; }), m_retired_images.end());
+
+    if (width != m_width || height != m_height)
+        create_image(backend, width, height);
+
+    mip_level = std::min(mip_level, voxelizer.m_mip_level_count - 1);
+
+    // This frame slot's previous use has finished, so its set can be rewritten.
+    write_descriptor_set(backend, voxelizer, mip_level);
+
+    // Every pixel is written, so the previous contents are discarded once the last present has read them.
+    VkImageMemoryBarrier barrier;
+    DW_ZERO_MEMORY(barrier);
+
+    barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask                   = 0;
+    barrier.dstAccessMask                   = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.oldLayout                       = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex             = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image                           = m_image->handle();
+    barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel   = 0;
+    barrier.subresourceRange.levelCount     = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount     = 1;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    AABB aabb = voxelizer.get_AABB();
+
+    VoxelRayMarchPushConstants push_constants;
+
+    push_constants.inv_view_projection = glm::inverse(view_projection);
+    push_constants.camera_pos          = glm::vec4(camera_pos, 1.0f);
+    push_constants.grid                = glm::vec4(aabb.min, voxelizer.m_length);
+    push_constants.no_texture          = no_texture ? VK_TRUE : VK_FALSE;
+
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_compute_pipeline->handle());
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_compute_pipeline_layout->handle(), 0, 1, &m_ds[backend->current_frame_idx()]->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_compute_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(VoxelRayMarchPushConstants), &push_constants);
+
+    const uint32_t local_size = 8;
+    vkCmdDispatch(cmd_buf->handle(), (width + local_size - 1) / local_size, (height + local_size - 1) / local_size, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout     = VK_IMAGE_LAYOUT_GENERAL;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void VoxelRayMarcher::present(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend)
+{
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_present_pipeline->handle());
+
+    VkViewport vp;
+
+    vp.x        = 0.0f;
+    vp.y        = 0.0f;
+    vp.width    = (float)m_width;
+    vp.height   = (float)m_height;
+    vp.minDepth = 0.0f;
+    vp.maxDepth = 1.0f;
+
+    vkCmdSetViewport(cmd_buf->handle(), 0, 1, &vp);
+
+    VkRect2D scissor_rect;
+
+    scissor_rect.extent.width  = m_width;
+    scissor_rect.extent.height = m_height;
+    scissor_rect.offset.x      = 0;
+    scissor_rect.offset.y      = 0;
+
+    vkCmdSetScissor(cmd_buf->handle(), 0, 1, &scissor_rect);
+
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_present_pipeline_layout->handle(), 0, 1, &m_ds[backend->current_frame_idx()]->handle(), 0, nullptr);
+    vkCmdDraw(cmd_buf->handle(), 3, 1, 0, 0);
+}
+
+void VoxelRayMarcher::report_memory(GpuMemoryReport& report) const
+{
+    report.add("Voxel Ray March", "Output image", m_image);
+
+    for (const auto& retired : m_retired_images)
+        report.add("Voxel Ray March", "Retired output image", retired.image);
+}
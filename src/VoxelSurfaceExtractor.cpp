@@ -0,0 +1,435 @@
+#include "VoxelSurfaceExtractor.h"
+#include "GpuProfiler.h"
+#include <macros.h>
+#include <logger.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+#include <cstddef>
+
+const uint32_t VoxelSurfaceExtractor::kMinFaceCapacity;
+
+static void write_storage_buffer(dw::vk::Backend::Ptr backend, dw::vk::DescriptorSet::Ptr ds, uint32_t binding, dw::vk::Buffer::Ptr buffer)
+{
+    VkDescriptorBufferInfo buffer_info;
+    VkWriteDescriptorSet   write_data;
+
+    DW_ZERO_MEMORY(buffer_info);
+    DW_ZERO_MEMORY(write_data);
+
+    buffer_info.buffer = buffer->handle();
+    buffer_info.offset = 0;
+    buffer_info.range  = VK_WHOLE_SIZE;
+
+    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data.descriptorCount = 1;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data.pBufferInfo     = &buffer_info;
+    write_data.dstBinding      = binding;
+    write_data.dstSet          = ds->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+}
+
+VoxelSurfaceExtractor::VoxelSurfaceExtractor(dw::vk::Backend::Ptr backend)
+{
+    create_buffers(backend);
+    create_descriptor_sets(backend);
+}
+
+void VoxelSurfaceExtractor::create_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    create_compute_pipeline_state(backend);
+    create_draw_pipeline_state(backend);
+}
+
+void VoxelSurfaceExtractor::create_buffers(dw::vk::Backend::Ptr backend)
+{
+    // Nothing is drawn until the first extraction.
+    VoxelFaceDraw draw;
+    DW_ZERO_MEMORY(draw);
+
+    m_draw_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(VoxelFaceDraw), VMA_MEMORY_USAGE_GPU_ONLY, 0, &draw);
+    m_draw_buffer->set_name("VoxelSurfaceExtractor::m_draw_buffer");
+
+    m_readback_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(uint32_t) * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_GPU_TO_CPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_readback_buffer->set_name("VoxelSurfaceExtractor::m_readback_buffer");
+
+    m_readback_recorded = std::vector<bool>(dw::vk::Backend::kMaxFramesInFlight, false);
+}
+
+void VoxelSurfaceExtractor::create_descriptor_sets(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::DescriptorSetLayout::Desc desc;
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    desc.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT);
+    desc.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+    m_ds_layout = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout->set_name("VoxelSurfaceExtractor::m_ds_layout");
+
+    for (uint32_t i = 0; i < dw::vk::Backend::kMaxFramesInFlight; i++)
+    {
+        m_ds.push_back(backend->allocate_descriptor_set(m_ds_layout));
+        m_ds.back()->set_name("VoxelSurfaceExtractor::m_ds");
+    }
+}
+
+void VoxelSurfaceExtractor::create_compute_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::ShaderModule::Ptr     cs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_faces.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc;
+    pso_desc.set_shader_stage(cs, "main");
+
+    dw::vk::PipelineLayout::Desc pl_desc;
+    pl_desc.add_descriptor_set_layout(m_ds_layout);
+    pl_desc.add_push_constant_range(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t));
+    m_extract_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+    m_extract_pipeline_layout->set_name("VoxelSurfaceExtractor::m_extract_pipeline_layout");
+
+    pso_desc.set_pipeline_layout(m_extract_pipeline_layout);
+    m_extract_pipeline = dw::vk::ComputePipeline::create(backend, pso_desc);
+
+    cs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_faces_finalize.comp.spv");
+    pso_desc.set_shader_stage(cs, "main");
+
+    m_finalize_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+    m_finalize_pipeline_layout->set_name("VoxelSurfaceExtractor::m_finalize_pipeline_layout");
+
+    pso_desc.set_pipeline_layout(m_finalize_pipeline_layout);
+    m_finalize_pipeline = dw::vk::ComputePipeline::create(backend, pso_desc);
+}
+
+void VoxelSurfaceExtractor::create_draw_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    // ---------------------------------------------------------------------------
+    // Create shader modules
+    // ---------------------------------------------------------------------------
+
+    dw::vk::ShaderModule::Ptr vs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_faces.vert.spv");
+    dw::vk::ShaderModule::Ptr fs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_faces.frag.spv");
+
+    dw::vk::GraphicsPipeline::Desc pso_desc;
+
+    pso_desc.add_shader_stage(VK_SHADER_STAGE_VERTEX_BIT, vs, "main")
+        .add_shader_stage(VK_SHADER_STAGE_FRAGMENT_BIT, fs, "main");
+
+    // ---------------------------------------------------------------------------
+    // Create vertex input state
+    // ---------------------------------------------------------------------------
+
+    // The corners are generated from gl_VertexIndex and the face buffer.
+    dw::vk::VertexInputStateDesc vertex_input_state_desc;
+
+    pso_desc.set_vertex_input_state(vertex_input_state_desc);
+
+    // ---------------------------------------------------------------------------
+    // Create pipeline input assembly state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::InputAssemblyStateDesc input_assembly_state_desc;
+
+    input_assembly_state_desc.set_primitive_restart_enable(false)
+        .set_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+    pso_desc.set_input_assembly_state(input_assembly_state_desc);
+
+    // ---------------------------------------------------------------------------
+    // Create viewport state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::ViewportStateDesc vp_desc;
+
+    vp_desc.add_viewport(0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f)
+        .add_scissor(0, 0, 1, 1);
+
+    pso_desc.set_viewport_state(vp_desc);
+
+    // ---------------------------------------------------------------------------
+    // Create rasterization state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::RasterizationStateDesc rs_state;
+
+    rs_state.set_depth_clamp(VK_FALSE)
+        .set_rasterizer_discard_enable(VK_FALSE)
+        .set_polygon_mode(VK_POLYGON_MODE_FILL)
+        .set_line_width(1.0f)
+        .set_cull_mode(VK_CULL_MODE_NONE)
+        .set_front_face(VK_FRONT_FACE_COUNTER_CLOCKWISE)
+        .set_depth_bias(VK_FALSE);
+
+    pso_desc.set_rasterization_state(rs_state);
+
+    // ---------------------------------------------------------------------------
+    // Create multisample state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::MultisampleStateDesc ms_state;
+
+    ms_state.set_sample_shading_enable(VK_FALSE)
+        .set_rasterization_samples(VK_SAMPLE_COUNT_1_BIT);
+
+    pso_desc.set_multisample_state(ms_state);
+
+    // ---------------------------------------------------------------------------
+    // Create depth stencil state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::DepthStencilStateDesc ds_state;
+
+    ds_state.set_depth_test_enable(VK_TRUE)
+        .set_depth_write_enable(VK_TRUE)
+        .set_depth_compare_op(VK_COMPARE_OP_LESS)
+        .set_depth_bounds_test_enable(VK_FALSE)
+        .set_stencil_test_enable(VK_FALSE);
+
+    pso_desc.set_depth_stencil_state(ds_state);
+
+    // ---------------------------------------------------------------------------
+    // Create color blend state
+    // ---------------------------------------------------------------------------
+
+    dw::vk::ColorBlendAttachmentStateDesc blend_att_desc;
+
+    blend_att_desc.set_color_write_mask(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT)
+        .set_blend_enable(VK_FALSE);
+
+    dw::vk::ColorBlendStateDesc blend_state;
+
+    blend_state.set_logic_op_enable(VK_FALSE)
+        .set_logic_op(VK_LOGIC_OP_COPY)
+        .set_blend_constants(0.0f, 0.0f, 0.0f, 0.0f)
+        .add_attachment(blend_att_desc);
+
+    pso_desc.set_color_blend_state(blend_state);
+
+    // ---------------------------------------------------------------------------
+    // Create pipeline layout
+    // ---------------------------------------------------------------------------
+
+    dw::vk::PipelineLayout::Desc pl_desc;
+
+    pl_desc.add_descriptor_set_layout(m_ds_layout);
+    pl_desc.add_push_constant_range(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VoxelFacePushConstants));
+
+    m_draw_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+    m_draw_pipeline_layout->set_name("VoxelSurfaceExtractor::m_draw_pipeline_layout");
+
+    pso_desc.set_pipeline_layout(m_draw_pipeline_layout);
+
+    // ---------------------------------------------------------------------------
+    // Create dynamic state
+    // ---------------------------------------------------------------------------
+
+    pso_desc.add_dynamic_state(VK_DYNAMIC_STATE_VIEWPORT)
+        .add_dynamic_state(VK_DYNAMIC_STATE_SCISSOR);
+
+    // ---------------------------------------------------------------------------
+    // Create pipeline
+    // ---------------------------------------------------------------------------
+
+    pso_desc.set_render_pass(backend->swapchain_render_pass());
+
+    m_draw_pipeline = dw::vk::GraphicsPipeline::create(backend, pso_desc);
+}
+
+void VoxelSurfaceExtractor::create_face_buffer(dw::vk::Backend::Ptr backend, uint32_t capacity)
+{
+    if (m_face_buffer)
+        m_retired_face_buffers.push_back({ m_face_buffer, uint32_t(dw::vk::Backend::kMaxFramesInFlight) });
+
+    m_face_capacity = capacity;
+    m_face_buffer   = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(VoxelFace) * capacity, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_face_buffer->set_name("VoxelSurfaceExtractor::m_face_buffer");
+
+    DW_LOG_INFO("(VoxelSurfaceExtractor) Face buffer sized for " + std::to_string(capacity) + " faces, " + std::to_string(m_face_count) + " extracted");
+}
+
+void VoxelSurfaceExtractor::write_descriptor_set(dw::vk::Backend::Ptr backend, Voxelizer& voxelizer)
+{
+    dw::vk::DescriptorSet::Ptr ds = m_ds[backend->current_frame_idx()];
+
+    VkDescriptorImageInfo image_info;
+    VkWriteDescriptorSet  write_data;
+
+    DW_ZERO_MEMORY(image_info);
+    DW_ZERO_MEMORY(write_data);
+
+    image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    image_info.imageView   = voxelizer.m_image_views_mip_levels[0]->handle();
+    image_info.sampler     = nullptr;
+
+    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data.descriptorCount = 1;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_data.pImageInfo      = &image_info;
+    write_data.dstBinding      = 0;
+    write_data.dstSet          = ds->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+
+    write_storage_buffer(backend, ds, 1, m_face_buffer);
+    write_storage_buffer(backend, ds, 2, m_draw_buffer);
+}
+
+void VoxelSurfaceExtractor::invalidate()
+{
+    m_invalidated = true;
+}
+
+void VoxelSurfaceExtractor::update(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Voxelizer& voxelizer, bool grid_voxelized)
+{
+    // Every call is a later frame, so a retired buffer is unused after as many calls as there are frames in flight.
+    for (auto& retired : m_retired_face_buffers)
+        retired.frames_left--;
+
+    m_retired_face_buffers.erase(std::remove_if(m_retired_face_buffers.begin(), m_retired_face_buffers.end(), [](const RetiredFaceBuffer& retired) { return retired.frames_left == 0; }), m_retired_face_buffers.end());
+
+    uint32_t frame_idx = backend->current_frame_idx();
+
+    // The framework has waited on this frame slot's fence, so the count of an extraction recorded in it is complete.
+    if (m_readback_recorded[frame_idx])
+    {
+        m_readback_recorded[frame_idx] = false;
+        m_face_count                   = ((const uint32_t*)m_readback_buffer->mapped_ptr())[frame_idx];
+
+        // Faces that did not fit are missing until the extraction into the resized buffer.
+        if (m_face_count > m_face_capacity || (m_face_capacity > kMinFaceCapacity && m_face_count < m_face_capacity / 4))
+        {
+            create_face_buffer(backend, std::max(m_face_count + m_face_count / 2, kMinFaceCapacity));
+            m_extract = true;
+        }
+    }
+
+    if (!m_face_buffer)
+    {
+        // Roughly the merged surface of a scene filling the grid, until the first count has been read back.
+        uint32_t n = voxelizer.m_voxels_per_side;
+        create_face_buffer(backend, std::max(2 * n * n, kMinFaceCapacity));
+    }
+
+    // This frame slot's previous use has finished, so its set can be rewritten.
+    write_descriptor_set(backend, voxelizer);
+
+    // A resized buffer is empty, so it is filled right away even if the grid is still the one of an earlier frame.
+    if (m_extract || (m_invalidated && grid_voxelized))
+    {
+        if (grid_voxelized)
+            m_invalidated = false;
+
+        m_extract = false;
+
+        extract(cmd_buf, backend, voxelizer);
+    }
+}
+
+void VoxelSurfaceExtractor::extract(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, Voxelizer& voxelizer)
+{
+    VCT_SCOPED_SAMPLE("Voxel face extraction", cmd_buf);
+
+    AABB aabb = voxelizer.get_AABB();
+    m_grid    = glm::vec4(aabb.min, voxelizer.m_voxel_width);
+
+    // Earlier frames may still be drawing the faces.
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    vkCmdFillBuffer(cmd_buf->handle(), m_draw_buffer->handle(), 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier barrier;
+    DW_ZERO_MEMORY(barrier);
+    barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    dw::vk::DescriptorSet::Ptr ds = m_ds[backend->current_frame_idx()];
+
+    // x = row within the slice, y = slice, z = face direction.
+    const uint32_t local_size = 64;
+    uint32_t       n          = voxelizer.m_voxels_per_side;
+
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_extract_pipeline->handle());
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_extract_pipeline_layout->handle(), 0, 1, &ds->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_extract_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &m_face_capacity);
+    vkCmdDispatch(cmd_buf->handle(), (n + local_size - 1) / local_size, n, 6);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Turns the face count into the draw's vertex count, clamped to what fit into the buffer.
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_finalize_pipeline->handle());
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_finalize_pipeline_layout->handle(), 0, 1, &ds->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_finalize_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &m_face_capacity);
+    vkCmdDispatch(cmd_buf->handle(), 1, 1, 1);
+
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    uint32_t frame_idx = backend->current_frame_idx();
+
+    VkBufferCopy region;
+    region.srcOffset = offsetof(VoxelFaceDraw, face_count);
+    region.dstOffset = sizeof(uint32_t) * frame_idx;
+    region.size      = sizeof(uint32_t);
+
+    vkCmdCopyBuffer(cmd_buf->handle(), m_draw_buffer->handle(), m_readback_buffer->handle(), 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    m_readback_recorded[frame_idx] = true;
+}
+
+void VoxelSurfaceExtractor::draw(dw::vk::CommandBuffer::Ptr cmd_buf, dw::vk::Backend::Ptr backend, const glm::mat4& view_projection, uint32_t width, uint32_t height)
+{
+    if (!m_face_buffer)
+        return;
+
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_draw_pipeline->handle());
+
+    VkViewport vp;
+
+    vp.x        = 0.0f;
+    vp.y        = (float)height;
+    vp.width    = (float)width;
+    vp.height   = -(float)height;
+    vp.minDepth = 0.0f;
+    vp.maxDepth = 1.0f;
+
+    vkCmdSetViewport(cmd_buf->handle(), 0, 1, &vp);
+
+    VkRect2D scissor_rect;
+
+    scissor_rect.extent.width  = width;
+    scissor_rect.extent.height = height;
+    scissor_rect.offset.x      = 0;
+    scissor_rect.offset.y      = 0;
+
+    vkCmdSetScissor(cmd_buf->handle(), 0, 1, &scissor_rect);
+
+    VoxelFacePushConstants push_constants;
+
+    push_constants.view_projection = view_projection;
+    push_constants.grid            = m_grid;
+    push_constants.no_texture      = no_texture ? VK_TRUE : VK_FALSE;
+
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_draw_pipeline_layout->handle(), 0, 1, &m_ds[backend->current_frame_idx()]->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_draw_pipeline_layout->handle(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VoxelFacePushConstants), &push_constants);
+    vkCmdDrawIndirect(cmd_buf->handle(), m_draw_buffer->handle(), 0, 1, sizeof(VkDrawIndirectCommand));
+}
+
+void VoxelSurfaceExtractor::report_memory(GpuMemoryReport& report) const
+{
+    report.add("Voxel Surface", "Faces (" + std::to_string(m_face_capacity) + ")", m_face_buffer);
+    report.add("Voxel Surface", "Draw command", m_draw_buffer);
+    report.add("Voxel Surface", "Face count readback", m_readback_buffer);
+
+    for (const auto& retired : m_retired_face_buffers)
+        report.add("Voxel Surface", "Retired faces", retired.buffer);
+}
@@ -1,7 +1,32 @@
 #include "Voxelizer.h"
+#include "StartupTimeline.h"
+#include "ThreadPool.h"
+#include "GpuProfiler.h"
+#include <logger.h>
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
 #include <profiler.h>
 
+dw::Mesh::Ptr m_cube_mesh;
+
+const uint32_t Voxelizer::kGridCount;
+const uint32_t Voxelizer::kMinInstanceCapacity;
+
+dw::Mesh::Ptr Voxelizer::load_cube_mesh(dw::vk::Backend::Ptr backend)
+{
+    // Loaded once on the main thread, voxelizers built on a worker thread must not upload through the graphics queue.
+    if (!m_cube_mesh)
+        m_cube_mesh = dw::Mesh::load(backend, "cube.obj");
+
+    return m_cube_mesh;
+}
+
+void Voxelizer::reset_cube_mesh()
+{
+    m_cube_mesh.reset();
+}
+
 Voxelizer::Voxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3 AABB_max, uint32_t voxels_per_side, const dw::vk::VertexInputStateDesc& vertex_input_state, VoxelizationType voxelization_type, uint32_t viewport_width, uint32_t viewport_height) :
     m_AABB_min(AABB_min), 
     m_AABB_max(AABB_max), 
@@ -9,44 +34,45 @@ Voxelizer::Voxelizer(dw::vk::Backend::Ptr backend, glm::vec3 AABB_min, glm::vec3
     m_length(get_length(AABB_min, AABB_max)),
     m_center((AABB_min + AABB_max) / 2.0f),
     m_voxel_width(m_length / m_voxels_per_side),
-    m_cube(RenderObject(dw::Mesh::load(backend, "cube.obj"), backend)),
+    m_cube(RenderObject(load_cube_mesh(backend), backend)),
     m_voxelization_type(voxelization_type),
     m_viewport_width(viewport_width),
     m_viewport_height(viewport_height)
 {
     m_mip_level_count = static_cast<uint32_t>(std::floor(std::log2(m_voxels_per_side))) + 1;
 
-    m_image = dw::vk::Image::create(backend, VK_IMAGE_TYPE_3D, m_voxels_per_side, m_voxels_per_side, m_voxels_per_side, m_mip_level_count, 1, VK_FORMAT_R8G8B8A8_UNORM, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_STORAGE_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
-    m_image->set_name("Voxel grid");
-    m_image_view = dw::vk::ImageView::create(backend, m_image, VK_IMAGE_VIEW_TYPE_3D, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1);
-
-    for (int i = 0; i < m_mip_level_count; i++)
-    {
-        m_image_views_mip_levels.push_back(dw::vk::ImageView::create(backend, m_image, VK_IMAGE_VIEW_TYPE_3D, VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1));
-    }
+    create_descriptor_pool(backend);
+    create_descriptor_sets(backend);
 
-    m_image->set_name("Voxelizer::m_image");
+    for (uint32_t i = 0; i < kGridCount; i++)
+        create_grid(backend, i);
 
-    create_descriptor_sets(backend);
+    use_grid(m_read_grid_idx);
 
-    VkDrawIndexedIndirectCommand indirect_command;
-    indirect_command.instanceCount = 1;
-    indirect_command.firstInstance = 0;
-    indirect_command.indexCount    = 36;
-    indirect_command.firstIndex    = 0;
-    indirect_command.vertexOffset  = 0;
+    VoxelVisualizerIndirect indirect;
+    DW_ZERO_MEMORY(indirect);
+    indirect.command.indexCount = 36;
 
     uint8_t* ptr = (uint8_t*)m_indirect_buffer->mapped_ptr();
-    memcpy(ptr, &indirect_command, sizeof(VkDrawIndexedIndirectCommand));
+    memcpy(ptr, &indirect, sizeof(VoxelVisualizerIndirect));
 
     float cos45  = glm::cos(glm::radians(45.0f));
     m_cube.scale = m_voxel_width;
 
-    create_voxel_reset_compute_pipeline_state(backend);
-    create_reset_instance_compute_pipeline_state(backend);
-    create_visualizer_compute_pipeline_state(backend);
-    create_visualizer_graphics_pipeline_state(backend);
-    create_generate_mip_maps_compute_pipeline_state(backend);
+    // Pipeline creation only reads the layouts created above, so the pipelines are compiled in parallel.
+    ThreadPool::global().parallel_for(6, [&](uint32_t i) {
+        ScopedStartupPhase phase("Voxelizer: pipeline " + std::to_string(i));
+
+        switch (i)
+        {
+            case 0: create_voxel_reset_compute_pipeline_state(backend); break;
+            case 1: create_reset_instance_compute_pipeline_state(backend); break;
+            case 2: create_visualizer_compute_pipeline_state(backend); break;
+            case 3: create_visualizer_graphics_pipeline_state(backend); break;
+            case 4: create_generate_mip_maps_compute_pipeline_state(backend); break;
+            case 5: create_finalize_instance_compute_pipeline_state(backend); break;
+        }
+    });
 }
 
 Voxelizer::~Voxelizer()
@@ -58,6 +84,12 @@ Voxelizer::~Voxelizer()
     m_ubo_data.reset();
     m_ds_data.reset();
     m_ds_image.reset();
+    m_ds_voxel_grid_mip_maps.reset();
+    m_image_views_mip_levels.clear();
+
+    for (auto& grid : m_grids)
+        grid = Grid();
+
     m_ds_layout_image.reset();
     m_ds_layout_ubo_dynamic.reset();
 }
@@ -71,20 +103,39 @@ float Voxelizer::get_length(glm::vec3 AABB_min, glm::vec3 AABB_max) const
     return max(x_length, max(y_length, z_length));
 }
 
-void Voxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend)
+void Voxelizer::create_descriptor_pool(dw::vk::Backend::Ptr backend)
 {
-    m_instance_buffer_size = sizeof(InstanceData) * 3000000;
-    m_instance_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_instance_buffer_size, VMA_MEMORY_USAGE_GPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
-    m_instance_buffer->set_name("Voxelizer::m_instance_buffer");
+    // Sized for the sets of the voxelizer and of ComputeVoxelizer, the largest subclass. Each grid is bound once
+    // whole and once per mip level, together with the mip map counters.
+    const uint32_t instance_sets = dw::vk::Backend::kMaxFramesInFlight + 1;
+
+    dw::vk::DescriptorPool::Desc desc;
+    desc.set_max_sets(8 + 2 * kGridCount + instance_sets)
+        .add_pool_size(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, kGridCount * (m_mip_level_count + 1))
+        .add_pool_size(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6 + kGridCount + instance_sets)
+        .add_pool_size(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1)
+        .add_pool_size(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1)
+        .add_pool_size(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 3)
+        .set_create_flags(VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT);
+
+    m_descriptor_pool = dw::vk::DescriptorPool::create(backend, desc);
+}
 
-    m_instance_color_buffer_size = sizeof(InstanceData) * 2000000;
-    m_instance_color_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_instance_color_buffer_size, VMA_MEMORY_USAGE_GPU_ONLY, VMA_ALLOCATION_CREATE_MAPPED_BIT);
-    m_instance_color_buffer->set_name("Voxelizer::m_instance_color_buffer");
+dw::vk::DescriptorSet::Ptr Voxelizer::allocate_descriptor_set(dw::vk::Backend::Ptr backend, dw::vk::DescriptorSetLayout::Ptr layout)
+{
+    return dw::vk::DescriptorSet::create(backend, layout, m_descriptor_pool);
+}
 
-    m_indirect_buffer_size = backend->aligned_dynamic_ubo_size(sizeof(VkDrawIndirectCommand));
-    m_indirect_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, m_indirect_buffer_size, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+void Voxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend)
+{
+    m_indirect_buffer_size = backend->aligned_dynamic_ubo_size(sizeof(VoxelVisualizerIndirect));
+    m_indirect_buffer      = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_indirect_buffer_size, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
     m_indirect_buffer->set_name("Voxelizer::m_indirect_buffer");
 
+    m_occupancy_readback_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_DST_BIT, sizeof(uint32_t) * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_GPU_TO_CPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_occupancy_readback_buffer->set_name("Voxelizer::m_occupancy_readback_buffer");
+    m_occupancy_recorded = std::vector<bool>(dw::vk::Backend::kMaxFramesInFlight, false);
+
     m_visualizer_ubo_size = backend->aligned_dynamic_ubo_size(sizeof(VoxelizerData));
     m_visualizer_ubo_data = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, m_visualizer_ubo_size * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_CPU_TO_GPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
 
@@ -125,30 +176,23 @@ void Voxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend)
     m_ds_layout_instance_buffer = dw::vk::DescriptorSetLayout::create(backend, desc);
     m_ds_layout_instance_buffer->set_name("Voxelizer::m_ds_layout_instance_buffer");
 
-    DW_ZERO_MEMORY(desc);
-    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-    m_ds_layout_instance_color_buffer = dw::vk::DescriptorSetLayout::create(backend, desc);
-    m_ds_layout_instance_color_buffer->set_name("Voxelizer::m_ds_layout_instance_color_buffer");
-
     DW_ZERO_MEMORY(desc);
     desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT);
     m_ds_layout_indirect_buffer = dw::vk::DescriptorSetLayout::create(backend, desc);
     m_ds_layout_indirect_buffer->set_name("Voxelizer::m_ds_layout_indirect_buffer");
 
-    m_ds_image                 = backend->allocate_descriptor_set(m_ds_layout_image);
-    m_ds_voxel_grid_mip_maps   = backend->allocate_descriptor_set(m_ds_layout_voxel_grid_mip_maps);
-    m_ds_instance_color_buffer = backend->allocate_descriptor_set(m_ds_layout_instance_color_buffer);
-    m_ds_instance_buffer       = backend->allocate_descriptor_set(m_ds_layout_instance_buffer);
-    m_ds_indirect_buffer       = backend->allocate_descriptor_set(m_ds_layout_indirect_buffer);
-    m_ds_visualizer_ubo        = backend->allocate_descriptor_set(m_ds_layout_ubo_dynamic);
-    m_ds_voxel_grid_ubo        = backend->allocate_descriptor_set(m_ds_layout_ubo_static);
-    m_ds_view_proj_ubo         = backend->allocate_descriptor_set(m_ds_layout_ubo_dynamic);
-    m_ds_data                  = backend->allocate_descriptor_set(m_ds_layout_ubo_dynamic);
-
-    m_ds_image->set_name("Voxelizer::m_ds_image");
-    m_ds_voxel_grid_mip_maps->set_name("Voxelizer::m_ds_voxel_grid_mip_maps");
-    m_ds_instance_color_buffer->set_name("Voxelizer::m_ds_instance_color_buffer");
-    m_ds_instance_buffer->set_name("Voxelizer::m_ds_instance_buffer");
+    m_ds_indirect_buffer       = allocate_descriptor_set(backend, m_ds_layout_indirect_buffer);
+    m_ds_visualizer_ubo        = allocate_descriptor_set(backend, m_ds_layout_ubo_dynamic);
+    m_ds_voxel_grid_ubo        = allocate_descriptor_set(backend, m_ds_layout_ubo_static);
+    m_ds_view_proj_ubo         = allocate_descriptor_set(backend, m_ds_layout_ubo_dynamic);
+    m_ds_data                  = allocate_descriptor_set(backend, m_ds_layout_ubo_dynamic);
+
+    for (uint32_t i = 0; i <= uint32_t(dw::vk::Backend::kMaxFramesInFlight); i++)
+    {
+        m_ds_instance_buffers.push_back(allocate_descriptor_set(backend, m_ds_layout_instance_buffer));
+        m_ds_instance_buffers.back()->set_name("Voxelizer::m_ds_instance_buffers[" + std::to_string(i) + "]");
+    }
+
     m_ds_indirect_buffer->set_name("Voxelizer::m_ds_indirect_buffer");
     m_ds_visualizer_ubo->set_name("Voxelizer::m_ds_visualizer_ubo");
     m_ds_voxel_grid_ubo->set_name("Voxelizer::m_ds_voxel_grid_ubo");
@@ -156,66 +200,8 @@ void Voxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend)
     m_ds_data->set_name("Voxelizer::m_ds_data");
 
     VkWriteDescriptorSet  write_data;
-    VkDescriptorImageInfo image_info;
     VkDescriptorBufferInfo buffer_info;
 
-    // Voxel Grid
-    DW_ZERO_MEMORY(write_data);
-    DW_ZERO_MEMORY(image_info);
-
-    image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-    image_info.imageView   = m_image_view->handle();
-    image_info.sampler     = nullptr;
-
-    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data.descriptorCount = 1;
-    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    write_data.pImageInfo      = &image_info;
-    write_data.dstBinding      = 0;
-    write_data.dstSet          = m_ds_image->handle();
-
-    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
-
-    // Voxel Grid Mip Maps
-
-    std::vector<VkDescriptorImageInfo> image_infos;
-    std::vector<VkWriteDescriptorSet>  write_datas;
-
-    for (int i = 0; i < m_mip_level_count; i++)
-    {
-        DW_ZERO_MEMORY(image_info);
-
-        image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        image_info.imageView   = m_image_views_mip_levels[i]->handle();
-        image_info.sampler     = nullptr;
-
-        image_infos.push_back(image_info);
-	}
-    
-    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data.descriptorCount = m_mip_level_count;
-    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    write_data.pImageInfo      = image_infos.data();
-    write_data.dstBinding      = 0;
-    write_data.dstSet          = m_ds_voxel_grid_mip_maps->handle();
-    write_datas.push_back(write_data);
-
-    DW_ZERO_MEMORY(buffer_info);
-    buffer_info.buffer = m_mip_map_atomic_counters_buffer->handle();
-    buffer_info.offset = 0;
-    buffer_info.range  = m_mip_map_atomic_counters_buffer_size;
-
-    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_data.descriptorCount = 1;
-    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_data.pBufferInfo     = &buffer_info;
-    write_data.dstBinding      = 1;
-    write_data.dstSet          = m_ds_voxel_grid_mip_maps->handle();
-
-    write_datas.push_back(write_data);
-
-    vkUpdateDescriptorSets(backend->device(), 2, write_datas.data(), 0, nullptr);
-
     // Visualizer UBO Transforms
     DW_ZERO_MEMORY(buffer_info);
     DW_ZERO_MEMORY(write_data);
@@ -250,76 +236,151 @@ void Voxelizer::create_descriptor_sets(dw::vk::Backend::Ptr backend)
 
     vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
 
-    // SSBO instance buffer
+    // SSBO indirect buffer
     DW_ZERO_MEMORY(buffer_info);
     DW_ZERO_MEMORY(write_data);
 
-    buffer_info.buffer = m_instance_buffer->handle();
+    buffer_info.buffer = m_indirect_buffer->handle();
     buffer_info.offset = 0;
-    buffer_info.range  = m_instance_buffer_size;
+    buffer_info.range  = m_indirect_buffer_size;
 
     write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     write_data.descriptorCount = 1;
     write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     write_data.pBufferInfo     = &buffer_info;
     write_data.dstBinding      = 0;
-    write_data.dstSet          = m_ds_instance_buffer->handle();
+    write_data.dstSet          = m_ds_indirect_buffer->handle();
 
     vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
 
-    // SSBO instance color buffer
+    // UBO Transforms
     DW_ZERO_MEMORY(buffer_info);
     DW_ZERO_MEMORY(write_data);
 
-    buffer_info.buffer = m_instance_color_buffer->handle();
+    buffer_info.buffer = m_ubo_data->handle();
     buffer_info.offset = 0;
-    buffer_info.range  = m_instance_color_buffer_size;
+    buffer_info.range  = sizeof(VoxelizerData);
 
     write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     write_data.descriptorCount = 1;
-    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     write_data.pBufferInfo     = &buffer_info;
     write_data.dstBinding      = 0;
-    write_data.dstSet          = m_ds_instance_color_buffer->handle();
+    write_data.dstSet          = m_ds_data->handle();
 
     vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+}
 
-    // SSBO indirect buffer
-    DW_ZERO_MEMORY(buffer_info);
+void Voxelizer::create_grid(dw::vk::Backend::Ptr backend, uint32_t index)
+{
+    Grid& grid = m_grids[index];
+
+    grid.image = dw::vk::Image::create(backend, VK_IMAGE_TYPE_3D, m_voxels_per_side, m_voxels_per_side, m_voxels_per_side, m_mip_level_count, 1, VK_FORMAT_R8G8B8A8_UNORM, VMA_MEMORY_USAGE_GPU_ONLY, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+    grid.image->set_name("Voxelizer::m_grids[" + std::to_string(index) + "].image");
+    grid.image_view = dw::vk::ImageView::create(backend, grid.image, VK_IMAGE_VIEW_TYPE_3D, VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1);
+
+    for (int i = 0; i < m_mip_level_count; i++)
+    {
+        grid.image_views_mip_levels.push_back(dw::vk::ImageView::create(backend, grid.image, VK_IMAGE_VIEW_TYPE_3D, VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1));
+    }
+
+    grid.ds_image               = allocate_descriptor_set(backend, m_ds_layout_image);
+    grid.ds_voxel_grid_mip_maps = allocate_descriptor_set(backend, m_ds_layout_voxel_grid_mip_maps);
+
+    grid.ds_image->set_name("Voxelizer::m_grids[" + std::to_string(index) + "].ds_image");
+    grid.ds_voxel_grid_mip_maps->set_name("Voxelizer::m_grids[" + std::to_string(index) + "].ds_voxel_grid_mip_maps");
+
+    VkWriteDescriptorSet   write_data;
+    VkDescriptorImageInfo  image_info;
+    VkDescriptorBufferInfo buffer_info;
+
+    // Voxel Grid
     DW_ZERO_MEMORY(write_data);
+    DW_ZERO_MEMORY(image_info);
 
-    buffer_info.buffer = m_indirect_buffer->handle();
-    buffer_info.offset = 0;
-    buffer_info.range  = m_indirect_buffer_size;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    image_info.imageView   = grid.image_view->handle();
+    image_info.sampler     = nullptr;
 
     write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     write_data.descriptorCount = 1;
-    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_data.pBufferInfo     = &buffer_info;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_data.pImageInfo      = &image_info;
     write_data.dstBinding      = 0;
-    write_data.dstSet          = m_ds_indirect_buffer->handle();
+    write_data.dstSet          = grid.ds_image->handle();
 
     vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
 
-    // UBO Transforms
-    DW_ZERO_MEMORY(buffer_info);
-    DW_ZERO_MEMORY(write_data);
+    // Voxel Grid Mip Maps
 
-    buffer_info.buffer = m_ubo_data->handle();
+    std::vector<VkDescriptorImageInfo> image_infos;
+    std::vector<VkWriteDescriptorSet>  write_datas;
+
+    for (int i = 0; i < m_mip_level_count; i++)
+    {
+        DW_ZERO_MEMORY(image_info);
+
+        image_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        image_info.imageView   = grid.image_views_mip_levels[i]->handle();
+        image_info.sampler     = nullptr;
+
+        image_infos.push_back(image_info);
+	}
+    
+    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data.descriptorCount = m_mip_level_count;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_data.pImageInfo      = image_infos.data();
+    write_data.dstBinding      = 0;
+    write_data.dstSet          = grid.ds_voxel_grid_mip_maps->handle();
+    write_datas.push_back(write_data);
+
+    DW_ZERO_MEMORY(buffer_info);
+    buffer_info.buffer = m_mip_map_atomic_counters_buffer->handle();
     buffer_info.offset = 0;
-    buffer_info.range  = sizeof(VoxelizerData);
+    buffer_info.range  = m_mip_map_atomic_counters_buffer_size;
 
     write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     write_data.descriptorCount = 1;
-    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     write_data.pBufferInfo     = &buffer_info;
-    write_data.dstBinding      = 0;
-    write_data.dstSet          = m_ds_data->handle();
+    write_data.dstBinding      = 1;
+    write_data.dstSet          = grid.ds_voxel_grid_mip_maps->handle();
 
-    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+    write_datas.push_back(write_data);
+
+    vkUpdateDescriptorSets(backend->device(), 2, write_datas.data(), 0, nullptr);
+}
+
+void Voxelizer::use_grid(uint32_t index)
+{
+    const Grid& grid = m_grids[index];
+
+    m_grid_idx               = index;
+    m_image                  = grid.image;
+    m_image_view             = grid.image_view;
+    m_image_views_mip_levels = grid.image_views_mip_levels;
+    m_ds_image               = grid.ds_image;
+    m_ds_voxel_grid_mip_maps = grid.ds_voxel_grid_mip_maps;
+}
+
+void Voxelizer::use_read_grid()
+{
+    use_grid(m_read_grid_idx);
+}
+
+void Voxelizer::use_write_grid()
+{
+    use_grid((m_read_grid_idx + 1) % kGridCount);
 }
 
-void Voxelizer::transition_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf)
+void Voxelizer::flip_grids()
+{
+    m_read_grid_idx = (m_read_grid_idx + 1) % kGridCount;
+    use_read_grid();
+}
+
+void Voxelizer::transition_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf, VkPipelineStageFlags dst_stage_mask)
 {
     VkImageMemoryBarrier barrier            = {};
     barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -336,7 +397,53 @@ void Voxelizer::transition_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf)
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount     = 1;
 
-    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage_mask, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Voxelizer::release_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf, uint32_t src_queue_family, uint32_t dst_queue_family)
+{
+    // Release half of the queue family ownership transfer, recorded on the queue that wrote the grid.
+    if (src_queue_family == dst_queue_family)
+        return;
+
+    VkImageMemoryBarrier barrier            = {};
+    barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image                           = m_image->handle();
+    barrier.oldLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask                   = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask                   = 0;
+    barrier.srcQueueFamilyIndex             = src_queue_family;
+    barrier.dstQueueFamilyIndex             = dst_queue_family;
+    barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel   = 0;
+    barrier.subresourceRange.levelCount     = m_mip_level_count;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount     = 1;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Voxelizer::acquire_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf, uint32_t src_queue_family, uint32_t dst_queue_family)
+{
+    // Acquire half of the queue family ownership transfer, recorded on the queue that reads the grid.
+    VkImageMemoryBarrier barrier            = {};
+    barrier.sType                           = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image                           = m_image->handle();
+    barrier.oldLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout                       = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask                   = src_queue_family == dst_queue_family ? VK_ACCESS_SHADER_WRITE_BIT : 0;
+    barrier.dstAccessMask                   = VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex             = src_queue_family == dst_queue_family ? VK_QUEUE_FAMILY_IGNORED : src_queue_family;
+    barrier.dstQueueFamilyIndex             = src_queue_family == dst_queue_family ? VK_QUEUE_FAMILY_IGNORED : dst_queue_family;
+    barrier.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel   = 0;
+    barrier.subresourceRange.levelCount     = m_mip_level_count;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount     = 1;
+
+    // The source stages match the stages the semaphore wait of the voxelization blocks, so the transfer happens after it.
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 void Voxelizer::reset_voxel_grid(dw::vk::CommandBuffer::Ptr cmd_buf)
@@ -486,24 +593,11 @@ void Voxelizer::visualization_main_buffer_memory_barrier(dw::vk::CommandBuffer::
     instance_buffer_barrier.dstAccessMask         = VK_ACCESS_SHADER_READ_BIT;
     instance_buffer_barrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
     instance_buffer_barrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
-    instance_buffer_barrier.size                  = m_instance_buffer_size;
+    instance_buffer_barrier.size                  = VK_WHOLE_SIZE;
     instance_buffer_barrier.offset                = 0;
     instance_buffer_barrier.pNext                 = nullptr;
 
-    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &instance_buffer_barrier, 0, nullptr);
-
-    VkBufferMemoryBarrier color_buffer_barrier = {};
-    color_buffer_barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-    color_buffer_barrier.buffer                = m_instance_color_buffer->handle();
-    color_buffer_barrier.srcAccessMask         = VK_ACCESS_SHADER_WRITE_BIT;
-    color_buffer_barrier.dstAccessMask         = VK_ACCESS_SHADER_READ_BIT;
-    color_buffer_barrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
-    color_buffer_barrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
-    color_buffer_barrier.size                  = m_instance_color_buffer_size;
-    color_buffer_barrier.offset                = 0;
-    color_buffer_barrier.pNext                 = nullptr;
-
-    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &color_buffer_barrier, 0, nullptr);
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_DEPENDENCY_BY_REGION_BIT, 0, nullptr, 1, &instance_buffer_barrier, 0, nullptr);
 }
 
 void Voxelizer::create_voxel_reset_compute_pipeline_state(dw::vk::Backend::Ptr backend)
@@ -535,6 +629,21 @@ void Voxelizer::create_reset_instance_compute_pipeline_state(dw::vk::Backend::Pt
     m_reset_instance_compute_pipeline = dw::vk::ComputePipeline::create(backend, pso_desc);
 }
 
+void Voxelizer::create_finalize_instance_compute_pipeline_state(dw::vk::Backend::Ptr backend)
+{
+    dw::vk::ShaderModule::Ptr     cs = dw::vk::ShaderModule::create_from_file(backend, "shaders/voxel_vis_finalize.comp.spv");
+    dw::vk::ComputePipeline::Desc pso_desc;
+    pso_desc.set_shader_stage(cs, "main");
+
+    dw::vk::PipelineLayout::Desc pl_desc;
+    pl_desc.add_descriptor_set_layout(m_ds_layout_indirect_buffer);
+    pl_desc.add_push_constant_range(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t));
+    m_finalize_instance_compute_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
+
+    pso_desc.set_pipeline_layout(m_finalize_instance_compute_pipeline_layout);
+    m_finalize_instance_compute_pipeline = dw::vk::ComputePipeline::create(backend, pso_desc);
+}
+
 void Voxelizer::create_generate_mip_maps_compute_pipeline_state(dw::vk::Backend::Ptr backend)
 {
     dw::vk::ShaderModule::Ptr     cs = dw::vk::ShaderModule::create_from_file(backend, "shaders/generate_mip_maps.comp.spv");
@@ -558,9 +667,8 @@ void Voxelizer::create_visualizer_compute_pipeline_state(dw::vk::Backend::Ptr ba
     dw::vk::PipelineLayout::Desc pl_desc;
     pl_desc.add_descriptor_set_layout(m_ds_layout_image)
         .add_descriptor_set_layout(m_ds_layout_instance_buffer)
-        .add_descriptor_set_layout(m_ds_layout_indirect_buffer)
-        .add_descriptor_set_layout(m_ds_layout_ubo_dynamic)
-        .add_descriptor_set_layout(m_ds_layout_instance_color_buffer);
+        .add_descriptor_set_layout(m_ds_layout_indirect_buffer);
+    pl_desc.add_push_constant_range(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t));
     m_visualizer_compute_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
     m_visualizer_compute_pipeline_layout->set_name("Voxelizer::m_visualizer_compute_pipeline_layout");
 
@@ -681,8 +789,7 @@ void Voxelizer::create_visualizer_graphics_pipeline_state(dw::vk::Backend::Ptr b
     dw::vk::PipelineLayout::Desc pl_desc;
 
     pl_desc.add_descriptor_set_layout(m_ds_layout_ubo_dynamic)
-        .add_descriptor_set_layout(m_ds_layout_instance_buffer)
-        .add_descriptor_set_layout(m_ds_layout_instance_color_buffer);
+        .add_descriptor_set_layout(m_ds_layout_instance_buffer);
     pl_desc.add_push_constant_range(VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VkBool32));
 
     m_visualizer_graphics_pipeline_layout = dw::vk::PipelineLayout::create(backend, pl_desc);
@@ -754,8 +861,7 @@ void Voxelizer::begin_render_visualizer(dw::vk::CommandBuffer::Ptr cmd_buf, dw::
 
     uint32_t dynamic_offset_main = m_visualizer_ubo_size * backend->current_frame_idx();
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_visualizer_graphics_pipeline_layout->handle(), 0, 1, &m_ds_visualizer_ubo->handle(), 1, &dynamic_offset_main);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_visualizer_graphics_pipeline_layout->handle(), 1, 1, &m_ds_instance_buffer->handle(), 0, nullptr);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_visualizer_graphics_pipeline_layout->handle(), 2, 1, &m_ds_instance_color_buffer->handle(), 0, nullptr);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_GRAPHICS, m_visualizer_graphics_pipeline_layout->handle(), 1, 1, &m_ds_instance_buffers[m_ds_instance_buffer_idx]->handle(), 0, nullptr);
 
     vkCmdPushConstants(cmd_buf->handle(), m_visualizer_graphics_pipeline_layout->handle(), VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(VkBool32), &noTexture);
 }
@@ -782,19 +888,119 @@ void Voxelizer::render_voxels(dw::vk::CommandBuffer::Ptr cmd_buf)
 
 void Voxelizer::dispatch_visualization_compute_shader(dw::vk::Backend::Ptr backend, dw::vk::CommandBuffer::Ptr cmd_buf)
 {
-    uint32_t dynamic_offset = m_ubo_size * backend->current_frame_idx();
+    update_instance_capacity(backend);
+
+    // Compacts the occupied voxels into the instance buffer and counts them.
     vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline->handle());
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline_layout->handle(), 0, 1, &m_ds_image->handle(), 0, nullptr);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline_layout->handle(), 1, 1, &m_ds_instance_buffer->handle(), 0, nullptr);
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline_layout->handle(), 1, 1, &m_ds_instance_buffers[m_ds_instance_buffer_idx]->handle(), 0, nullptr);
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline_layout->handle(), 2, 1, &m_ds_indirect_buffer->handle(), 0, nullptr);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline_layout->handle(), 3, 1, &m_ds_data->handle(), 1, &dynamic_offset);
-    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_visualizer_compute_pipeline_layout->handle(), 4, 1, &m_ds_instance_color_buffer->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_visualizer_compute_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &m_instance_capacity);
     vkCmdDispatch(cmd_buf->handle(), get_work_groups_dim(), get_work_groups_dim(), get_work_groups_dim());
+
+    VkMemoryBarrier memory_barrier = {};
+    memory_barrier.sType           = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask   = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask   = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    // Clamps the draw's instance count to what fit into the buffer.
+    vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_finalize_instance_compute_pipeline->handle());
+    vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_finalize_instance_compute_pipeline_layout->handle(), 0, 1, &m_ds_indirect_buffer->handle(), 0, nullptr);
+    vkCmdPushConstants(cmd_buf->handle(), m_finalize_instance_compute_pipeline_layout->handle(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &m_instance_capacity);
+    vkCmdDispatch(cmd_buf->handle(), 1, 1, 1);
+
+    // The count is read back once this frame slot comes around again.
+    uint32_t frame_idx = backend->current_frame_idx();
+
+    VkBufferCopy region;
+    region.srcOffset = offsetof(VoxelVisualizerIndirect, occupied);
+    region.dstOffset = sizeof(uint32_t) * frame_idx;
+    region.size      = sizeof(uint32_t);
+
+    vkCmdCopyBuffer(cmd_buf->handle(), m_indirect_buffer->handle(), m_occupancy_readback_buffer->handle(), 1, &region);
+
+    memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+
+    m_occupancy_recorded[frame_idx] = true;
+}
+
+void Voxelizer::update_instance_capacity(dw::vk::Backend::Ptr backend)
+{
+    // Every call is a later frame, so a retired buffer is unused after as many calls as there are frames in flight.
+    for (auto& retired : m_retired_instance_buffers)
+        retired.frames_left--;
+
+    m_retired_instance_buffers.erase(std::remove_if(m_retired_instance_buffers.begin(), m_retired_instance_buffers.end(), [](const RetiredInstanceBuffer& retired) { return retired.frames_left == 0; }), m_retired_instance_buffers.end());
+
+    uint64_t voxel_count = uint64_t(m_voxels_per_side) * m_voxels_per_side * m_voxels_per_side;
+
+    if (m_instance_capacity == 0)
+    {
+        // Roughly the surface of a scene filling the grid, until the first count has been read back.
+        uint64_t estimate = std::min<uint64_t>(uint64_t(4) * m_voxels_per_side * m_voxels_per_side, voxel_count);
+        create_instance_buffer(backend, uint32_t(std::max<uint64_t>(estimate, kMinInstanceCapacity)));
+        return;
+    }
+
+    uint32_t frame_idx = backend->current_frame_idx();
+
+    if (!m_occupancy_recorded[frame_idx])
+        return;
+
+    // The framework has waited on this frame slot's fence, so its count is complete.
+    m_occupied_voxels = ((const uint32_t*)m_occupancy_readback_buffer->mapped_ptr())[frame_idx];
+
+    // Grow with headroom, and only shrink once most of the buffer is unused so that small changes do not reallocate.
+    if (m_occupied_voxels > m_instance_capacity || (m_instance_capacity > kMinInstanceCapacity && m_occupied_voxels < m_instance_capacity / 4))
+    {
+        uint64_t capacity = std::min<uint64_t>(uint64_t(m_occupied_voxels) + m_occupied_voxels / 2, voxel_count);
+        create_instance_buffer(backend, uint32_t(std::max<uint64_t>(capacity, kMinInstanceCapacity)));
+    }
+}
+
+void Voxelizer::create_instance_buffer(dw::vk::Backend::Ptr backend, uint32_t capacity)
+{
+    // The old descriptor set may still be referenced by frames in flight, so the new buffer goes into the next one.
+    if (m_instance_buffer)
+    {
+        m_retired_instance_buffers.push_back({ m_instance_buffer, uint32_t(dw::vk::Backend::kMaxFramesInFlight) });
+        m_ds_instance_buffer_idx = (m_ds_instance_buffer_idx + 1) % m_ds_instance_buffers.size();
+    }
+
+    m_instance_capacity = capacity;
+    m_instance_buffer   = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(VoxelInstance) * capacity, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_instance_buffer->set_name("Voxelizer::m_instance_buffer");
+
+    VkDescriptorBufferInfo buffer_info;
+    DW_ZERO_MEMORY(buffer_info);
+
+    buffer_info.buffer = m_instance_buffer->handle();
+    buffer_info.offset = 0;
+    buffer_info.range  = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write_data;
+    DW_ZERO_MEMORY(write_data);
+
+    write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_data.descriptorCount = 1;
+    write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_data.pBufferInfo     = &buffer_info;
+    write_data.dstBinding      = 0;
+    write_data.dstSet          = m_ds_instance_buffers[m_ds_instance_buffer_idx]->handle();
+
+    vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+
+    DW_LOG_INFO("(Voxelizer) Visualization instance buffer sized for " + std::to_string(capacity) + " voxels, " + std::to_string(m_occupied_voxels) + " occupied");
 }
 
 void Voxelizer::generate_mip_maps(dw::vk::CommandBuffer::Ptr cmd_buf)
 {
-    DW_SCOPED_SAMPLE("Generate Mip Maps", cmd_buf);
+    VCT_SCOPED_SAMPLE("Generate Mip Maps", cmd_buf);
     vkCmdBindPipeline(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_generate_mip_maps_compute_pipeline->handle());
     vkCmdBindDescriptorSets(cmd_buf->handle(), VK_PIPELINE_BIND_POINT_COMPUTE, m_generate_mip_maps_pipeline_layout->handle(), 0, 1, &m_ds_voxel_grid_mip_maps->handle(), 0, nullptr);
     vkCmdDispatch(cmd_buf->handle(), m_voxels_per_side / 8, m_voxels_per_side / 8, m_voxels_per_side / 8);
@@ -805,4 +1011,17 @@ AABB Voxelizer::get_AABB() const
     glm::vec3 min = m_center - glm::vec3(m_length / 2, m_length / 2, m_length / 2);
     glm::vec3 max = m_center + glm::vec3(m_length / 2, m_length / 2, m_length / 2);
     return AABB { min, max };
+}
+
+void Voxelizer::report_memory(GpuMemoryReport& report) const
+{
+    for (uint32_t i = 0; i < kGridCount; i++)
+        report.add("Voxelizer", "Voxel grid " + std::to_string(i) + " (" + std::to_string(m_voxels_per_side) + "^3, " + std::to_string(m_mip_level_count) + " mips)", m_grids[i].image);
+    report.add("Voxelizer", "Visualization instances (" + std::to_string(m_instance_capacity) + ")", m_instance_buffer);
+    report.add("Voxelizer", "Occupancy readback", m_occupancy_readback_buffer);
+    report.add("Voxelizer", "Indirect buffer", m_indirect_buffer);
+    report.add("Voxelizer", "Mip map counters", m_mip_map_atomic_counters_buffer);
+    report.add("Voxelizer", "Visualizer uniforms", m_visualizer_ubo_data);
+    report.add("Voxelizer", "View projection uniforms", m_view_proj_ubo_data);
+    report.add("Voxelizer", "Voxelizer uniforms", m_ubo_data);
 }
\ No newline at end of file
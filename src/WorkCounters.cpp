@@ -0,0 +1,392 @@
+#include "WorkCounters.h"
+#include <imgui.h>
+#include <macros.h>
+#include <vk_mem_alloc.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+const uint32_t    WorkCounters::kMaxPasses;
+const char* const WorkCounters::kStatisticNames[PIPELINE_STATISTIC_COUNT] = { "Input primitives", "Vertex shader invocations", "Geometry shader invocations", "Clipping primitives", "Fragment shader invocations", "Compute shader invocations" };
+
+static const VkDeviceSize kGroupOffsets[WORK_COUNTER_GROUP_COUNT] = { offsetof(WorkCounterValues, voxelizer_enabled), offsetof(WorkCounterValues, render_enabled) };
+static const VkDeviceSize kGroupSize                              = offsetof(WorkCounterValues, render_enabled);
+
+// Statistics written per query on each queue, graphics queries report every PipelineStatistic.
+static const uint32_t kQueueStatisticCounts[GPU_QUEUE_COUNT] = { PIPELINE_STATISTIC_COUNT, 1 };
+
+WorkCounters& WorkCounters::get()
+{
+    static WorkCounters counters;
+    return counters;
+}
+
+void WorkCounters::initialize(dw::vk::Backend::Ptr backend)
+{
+    m_backend = backend;
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(backend->physical_device(), &features);
+
+    m_statistics_supported = features.pipelineStatisticsQuery == VK_TRUE;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(backend->physical_device(), &properties);
+
+    VkDeviceSize alignment = std::max(properties.limits.minStorageBufferOffsetAlignment, VkDeviceSize(1));
+
+    m_stride = (sizeof(WorkCounterValues) + alignment - 1) / alignment * alignment;
+
+    // The shaders increment device local counters, each group is copied to the host once its passes are done.
+    m_counter_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_stride * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_GPU_ONLY, 0);
+    m_counter_buffer->set_name("WorkCounters::m_counter_buffer");
+
+    m_readback_buffer = dw::vk::Buffer::create(backend, VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_stride * dw::vk::Backend::kMaxFramesInFlight, VMA_MEMORY_USAGE_GPU_TO_CPU, VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    m_readback_buffer->set_name("WorkCounters::m_readback_buffer");
+
+    dw::vk::DescriptorSetLayout::Desc desc;
+    desc.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+
+    m_ds_layout = dw::vk::DescriptorSetLayout::create(backend, desc);
+    m_ds_layout->set_name("WorkCounters::m_ds_layout");
+
+    VkQueryPoolCreateInfo pool_infos[GPU_QUEUE_COUNT];
+
+    for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+    {
+        DW_ZERO_MEMORY(pool_infos[i]);
+
+        pool_infos[i].sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        pool_infos[i].queryType  = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        pool_infos[i].queryCount = kMaxPasses;
+    }
+
+    // Graphics statistics may only be queried from command buffers of a graphics capable pool.
+    pool_infos[GPU_QUEUE_GRAPHICS].pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_GEOMETRY_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+    pool_infos[GPU_QUEUE_COMPUTE].pipelineStatistics  = VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+    m_frames.resize(dw::vk::Backend::kMaxFramesInFlight);
+
+    for (uint32_t i = 0; i < m_frames.size(); i++)
+    {
+        Frame& frame = m_frames[i];
+
+        for (uint32_t j = 0; j < GPU_QUEUE_COUNT; j++)
+        {
+            frame.query_pools[j] = VK_NULL_HANDLE;
+
+            if (m_statistics_supported)
+                vkCreateQueryPool(backend->device(), &pool_infos[j], nullptr, &frame.query_pools[j]);
+
+            frame.query_counts[j] = 0;
+            frame.reset[j]        = false;
+        }
+
+        for (uint32_t j = 0; j < WORK_COUNTER_GROUP_COUNT; j++)
+            frame.counters_recorded[j] = false;
+
+        frame.ds = backend->allocate_descriptor_set(m_ds_layout);
+        frame.ds->set_name("WorkCounters::m_frames[" + std::to_string(i) + "].ds");
+
+        VkDescriptorBufferInfo buffer_info;
+        buffer_info.buffer = m_counter_buffer->handle();
+        buffer_info.offset = m_stride * i;
+        buffer_info.range  = sizeof(WorkCounterValues);
+
+        VkWriteDescriptorSet write_data;
+        DW_ZERO_MEMORY(write_data);
+        write_data.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write_data.descriptorCount = 1;
+        write_data.descriptorType  = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write_data.pBufferInfo     = &buffer_info;
+        write_data.dstBinding      = 0;
+        write_data.dstSet          = frame.ds->handle();
+
+        vkUpdateDescriptorSets(backend->device(), 1, &write_data, 0, nullptr);
+    }
+
+    DW_ZERO_MEMORY(m_counters);
+}
+
+void WorkCounters::shutdown()
+{
+    for (auto& frame : m_frames)
+    {
+        for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+        {
+            if (frame.query_pools[i] != VK_NULL_HANDLE)
+                vkDestroyQueryPool(m_backend->device(), frame.query_pools[i], nullptr);
+        }
+    }
+
+    m_frames.clear();
+    m_passes.clear();
+    m_counter_buffer.reset();
+    m_readback_buffer.reset();
+    m_ds_layout.reset();
+    m_backend.reset();
+}
+
+void WorkCounters::set_enabled(bool enabled)
+{
+    if (enabled && !m_enabled)
+    {
+        for (uint32_t i = 0; i < WORK_COUNTER_GROUP_COUNT; i++)
+            m_counters_valid[i] = false;
+
+        m_passes.clear();
+    }
+
+    m_enabled = enabled;
+}
+
+void WorkCounters::begin_frame()
+{
+    m_frame_idx = m_backend->current_frame_idx();
+
+    Frame& frame = m_frames[m_frame_idx];
+
+    // Graphics work of this slot is known to be done. A voxelization on the compute queue is too, the main pass of
+    // the same frame waited for it, but availability is checked all the same.
+    std::vector<uint64_t> results[GPU_QUEUE_COUNT];
+
+    for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+    {
+        if (frame.query_counts[i] == 0)
+            continue;
+
+        uint32_t stride = kQueueStatisticCounts[i] + 1;
+
+        results[i].resize(frame.query_counts[i] * stride);
+        vkGetQueryPoolResults(m_backend->device(), frame.query_pools[i], 0, frame.query_counts[i], sizeof(uint64_t) * results[i].size(), results[i].data(), sizeof(uint64_t) * stride, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    }
+
+    // Passes keep their last result, the voxelizer does not run every frame.
+    std::vector<std::string> frame_passes;
+
+    for (const auto& pending : frame.pending)
+    {
+        uint32_t        count  = kQueueStatisticCounts[pending.queue];
+        const uint64_t* result = &results[pending.queue][pending.query * (count + 1)];
+
+        if (!result[count])
+            continue;
+
+        PassStatistics pass;
+
+        pass.name  = pending.name;
+        pass.queue = pending.queue;
+
+        memset(pass.values, 0, sizeof(pass.values));
+
+        if (pending.queue == GPU_QUEUE_GRAPHICS)
+            memcpy(pass.values, result, sizeof(uint64_t) * count);
+        else
+            pass.values[PIPELINE_STATISTIC_COMPUTE_INVOCATIONS] = result[0];
+
+        auto it = std::find_if(m_passes.begin(), m_passes.end(), [&](const PassStatistics& other) { return other.name == pass.name; });
+
+        if (it == m_passes.end())
+            m_passes.push_back(pass);
+        else if (std::find(frame_passes.begin(), frame_passes.end(), pass.name) == frame_passes.end())
+            *it = pass;
+        else
+        {
+            // Recorded more than once in this frame, e.g. once per batch of the compute voxelizer.
+            for (uint32_t i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+                it->values[i] += pass.values[i];
+        }
+
+        frame_passes.push_back(pass.name);
+    }
+
+    const uint8_t* readback = (const uint8_t*)m_readback_buffer->mapped_ptr() + m_stride * m_frame_idx;
+
+    for (uint32_t i = 0; i < WORK_COUNTER_GROUP_COUNT; i++)
+    {
+        if (!frame.counters_recorded[i])
+            continue;
+
+        memcpy((uint8_t*)&m_counters + kGroupOffsets[i], readback + kGroupOffsets[i], kGroupSize);
+
+        m_counters_valid[i]        = true;
+        frame.counters_recorded[i] = false;
+    }
+
+    for (uint32_t i = 0; i < GPU_QUEUE_COUNT; i++)
+    {
+        frame.query_counts[i] = 0;
+        frame.reset[i]        = false;
+    }
+
+    frame.pending.clear();
+    m_open_pass    = -1;
+    m_pass_depth   = 0;
+    m_active_queue = GPU_QUEUE_COUNT;
+}
+
+void WorkCounters::begin_command_buffer(dw::vk::CommandBuffer::Ptr cmd_buf, GpuQueue queue)
+{
+    Frame& frame = m_frames[m_frame_idx];
+
+    if (m_statistics_supported && !frame.reset[queue])
+    {
+        vkCmdResetQueryPool(cmd_buf->handle(), frame.query_pools[queue], 0, kMaxPasses);
+        frame.reset[queue] = true;
+    }
+
+    m_active_queue = queue;
+}
+
+void WorkCounters::begin_pass(const std::string& name, dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    Frame& frame = m_frames[m_frame_idx];
+
+    // Only one pipeline statistics query can be active at a time, nested passes are folded into the outer one.
+    if (m_pass_depth++ > 0 || !m_enabled || !m_statistics_supported || m_active_queue == GPU_QUEUE_COUNT || frame.query_counts[m_active_queue] >= kMaxPasses)
+        return;
+
+    PendingPass pending;
+
+    pending.name  = name;
+    pending.queue = m_active_queue;
+    pending.query = frame.query_counts[m_active_queue]++;
+
+    vkCmdBeginQuery(cmd_buf->handle(), frame.query_pools[pending.queue], pending.query, 0);
+
+    m_open_pass = frame.pending.size();
+    frame.pending.push_back(pending);
+}
+
+void WorkCounters::end_pass(dw::vk::CommandBuffer::Ptr cmd_buf)
+{
+    if (m_pass_depth == 0 || --m_pass_depth > 0 || m_open_pass < 0)
+        return;
+
+    Frame&             frame   = m_frames[m_frame_idx];
+    const PendingPass& pending = frame.pending[m_open_pass];
+
+    vkCmdEndQuery(cmd_buf->handle(), frame.query_pools[pending.queue], pending.query);
+
+    m_open_pass = -1;
+}
+
+void WorkCounters::begin_counters(dw::vk::CommandBuffer::Ptr cmd_buf, WorkCounterGroup group, VkPipelineStageFlags dst_stage_mask)
+{
+    // Written even while disabled, the shaders skip their atomics when the first word is zero.
+    uint32_t data[kGroupSize / sizeof(uint32_t)] = {};
+    data[0]                                      = m_enabled ? 1 : 0;
+
+    VkDeviceSize offset = m_stride * m_frame_idx + kGroupOffsets[group];
+
+    vkCmdUpdateBuffer(cmd_buf->handle(), m_counter_buffer->handle(), offset, kGroupSize, data);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer                = m_counter_buffer->handle();
+    barrier.srcAccessMask         = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask         = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.offset                = offset;
+    barrier.size                  = kGroupSize;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage_mask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void WorkCounters::end_counters(dw::vk::CommandBuffer::Ptr cmd_buf, WorkCounterGroup group, VkPipelineStageFlags src_stage_mask)
+{
+    if (!m_enabled)
+        return;
+
+    VkDeviceSize offset = m_stride * m_frame_idx + kGroupOffsets[group];
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType                 = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer                = m_counter_buffer->handle();
+    barrier.srcAccessMask         = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask         = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.srcQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex   = VK_QUEUE_FAMILY_IGNORED;
+    barrier.offset                = offset;
+    barrier.size                  = kGroupSize;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), src_stage_mask, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    VkBufferCopy region;
+    region.srcOffset = offset;
+    region.dstOffset = offset;
+    region.size      = kGroupSize;
+
+    vkCmdCopyBuffer(cmd_buf->handle(), m_counter_buffer->handle(), m_readback_buffer->handle(), 1, &region);
+
+    barrier.buffer        = m_readback_buffer->handle();
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd_buf->handle(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    m_frames[m_frame_idx].counters_recorded[group] = true;
+}
+
+const PassStatistics* WorkCounters::find_pass(const std::string& name) const
+{
+    for (const auto& pass : m_passes)
+    {
+        if (pass.name == name)
+            return &pass;
+    }
+
+    return nullptr;
+}
+
+void WorkCounters::gui()
+{
+    if (!ImGui::CollapsingHeader("Work Counters"))
+        return;
+
+    bool enabled = m_enabled;
+
+    if (ImGui::Checkbox("Enable Work Counters", &enabled))
+        set_enabled(enabled);
+
+    if (!m_enabled)
+        return;
+
+    if (!m_statistics_supported)
+        ImGui::Text("Pipeline statistics queries are not supported");
+
+    for (const auto& pass : m_passes)
+    {
+        ImGui::Text("%s (%s queue)", pass.name.c_str(), pass.queue == GPU_QUEUE_GRAPHICS ? "graphics" : "compute");
+
+        for (uint32_t i = 0; i < PIPELINE_STATISTIC_COUNT; i++)
+        {
+            if (pass.values[i] > 0)
+                ImGui::BulletText("%s: %llu", kStatisticNames[i], (unsigned long long)pass.values[i]);
+        }
+    }
+
+    ImGui::Separator();
+
+    if (m_counters_valid[WORK_COUNTERS_VOXELIZER])
+    {
+        ImGui::Text("Compute voxelizer");
+        ImGui::BulletText("Triangles: %u", m_counters.triangles);
+        ImGui::BulletText("SAT tests: %u", m_counters.sat_tests);
+        ImGui::BulletText("Voxels written: %u", m_counters.voxels_written);
+        ImGui::BulletText("Large triangle records: %u", m_counters.large_triangle_records);
+    }
+    else
+        ImGui::Text("Compute voxelizer: no voxelization counted yet");
+
+    if (m_counters_valid[WORK_COUNTERS_RENDER])
+    {
+        ImGui::Text("Main render");
+        ImGui::BulletText("Cone steps: %u", m_counters.cone_steps);
+        ImGui::BulletText("Cone tracing fragments: %u", m_counters.cone_fragments);
+        ImGui::BulletText("Cone steps per fragment: %.2f", m_counters.cone_fragments > 0 ? double(m_counters.cone_steps) / m_counters.cone_fragments : 0.0);
+    }
+    else
+        ImGui::Text("Main render: no cone tracing counted yet");
+}
@@ -1,10 +1,28 @@
-struct Vertex
+// Position is unorm16 relative to the bounds of the mesh, texcoord is half precision.
+struct VoxelVertex
 {
-    vec4 position;
-    vec4 texcoord;
-    vec4 normal;
-    vec4 tangent;
-    vec4 bitangent;
+    uint position_xy;
+    uint position_z;
+    uint texcoord;
+};
+
+struct MeshQuantization
+{
+    vec4 offset;
+    vec4 scale;
+};
+
+#define MESHLET_TRIANGLES 64
+
+// Consecutive triangles of one draw with their object space bounds, see SceneMeshlet.
+struct Meshlet
+{
+    uint first_triangle;
+    uint triangle_count;
+    uint mesh;
+    uint material;
+    vec4 min;
+    vec4 max;
 };
 
 layout(set = 0, binding = 0, rgba8) uniform image3D voxelTexture;
@@ -25,25 +43,40 @@ layout(set = 2, binding = 0) uniform ViewProjUBO
 }
 view_proj;
 
-layout(set = 3, binding = 0) buffer VertexBuffer
+layout(set = 3, binding = 0) readonly buffer VoxelVertexBuffer
 {
-    Vertex vertices[];
+    VoxelVertex vertices[];
 };
 
-layout(set = 3, binding = 1) buffer IndexBuffer
+layout(set = 3, binding = 1) readonly buffer IndexBuffer
 {
     uint indices[];
 };
 
+layout(set = 3, binding = 2) readonly buffer MeshQuantizationBuffer
+{
+    MeshQuantization mesh_quantization[];
+};
+
+layout(set = 3, binding = 3) readonly buffer MeshletBuffer
+{
+    Meshlet meshlets[];
+};
+
+// Scene material table, indexed with Meshlet::material.
 layout(set = 4, binding = 0) uniform sampler2D s_Diffuse_unbound[];
-layout(set = 4, binding = 1) uniform sampler2D s_Normal_unbound[];
-layout(set = 4, binding = 2) uniform sampler2D s_Metallic_unbound[];
-layout(set = 4, binding = 3) uniform sampler2D s_Roughness_unbound[];
-layout(set = 4, binding = 4) uniform sampler2D s_Emissive_unbound[];
 
-layout(set = 5, binding = 0) buffer TriangleMap
+// A meshlet of one instance that survived culling, one setup and small triangle workgroup each. The clusters are
+// voxelized in batches of as many clusters as the triangle record buffer holds, starting at pc.first_cluster.
+struct Cluster
+{
+    uint meshlet;
+    uint instance;
+};
+
+layout(set = 5, binding = 0) buffer ClusterArray
 {
-    uint triangle_map[];
+    Cluster clusters[];
 };
 
 struct VkDispatchIndirectCommand
@@ -53,11 +86,20 @@ struct VkDispatchIndirectCommand
     uint z;
 };
 
+// command dispatches the large triangle pass of the current batch in rows of MAX_WORKGROUP_COUNT workgroups,
+// cluster_command the setup and small triangle passes of the current batch.
 layout(std140, set = 6, binding = 0) buffer IndirectBuffer
 {
     VkDispatchIndirectCommand command;
+    VkDispatchIndirectCommand cluster_command;
+    uint                      cluster_count;        // Clusters appended by the culling pass, including dropped ones
+    uint                      large_triangle_count; // Large triangle workgroups of the current batch
 };
 
+// Smallest maxComputeWorkGroupCount the spec allows.
+#define MAX_WORKGROUP_COUNT 65535u
+
+// One workgroup of the large triangle pass, triangle_index addresses the triangle records of the current batch.
 struct LargeTriangle
 {
 	uint triangle_index;
@@ -69,14 +111,77 @@ layout(set = 7, binding = 0) buffer LargeTriangleArray
         LargeTriangle large_triangles[];
 };
 
-layout(push_constant) uniform constants
+// A triangle of one instance transformed by the setup pass. The plane gives the voxel space coordinate along the
+// dominant axis z as plane.x * x + plane.y * y + plane.z, voxel bounds are inclusive.
+struct TriangleRecord
+{
+    vec4  positions[3]; // world space
+    vec4  plane;
+    ivec4 voxel_min;    // w: axes, x | y << 2 | z << 4
+    ivec4 voxel_max;    // w: material
+    uvec4 texcoords;    // half2 texcoord of each vertex
+};
+
+layout(set = 7, binding = 1) buffer TriangleRecordArray
+{
+    TriangleRecord triangles[];
+};
+
+struct Instance
 {
     mat4 model;
-    int  triangle_count;
+};
+
+// The instances and the work counters share the cluster set, so that the layout fits in the 8 sets every
+// device supports.
+layout(set = 5, binding = 1) readonly buffer InstanceBuffer
+{
+    Instance instances[];
+};
+
+#define WORK_COUNTERS_SET 5
+#define WORK_COUNTERS_BINDING 2
+#include "work_counters.h"
+
+layout(push_constant) uniform constants
+{
+    uint first_instance;
+    uint first_meshlet;
+    uint meshlet_count;
     int  large_triangle_threshold;
+    uint first_cluster;
 }
 pc;
 
+// Large triangle workgroup of the current invocation, the dispatch is split into rows.
+uint large_triangle_workgroup()
+{
+    return gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+}
+
+vec4 vertex_position(VoxelVertex vertex, uint mesh)
+{
+    vec3 normalized = vec3(unpackUnorm2x16(vertex.position_xy), unpackUnorm2x16(vertex.position_z).x);
+    return vec4(mesh_quantization[mesh].offset.xyz + normalized * mesh_quantization[mesh].scale.xyz, 1.0);
+}
+
+vec2 vertex_texcoord(VoxelVertex vertex)
+{
+    return unpackHalf2x16(vertex.texcoord);
+}
+
+// Dominant axes of a triangle record: z has the smallest extent, y the largest.
+uvec3 triangle_axes(TriangleRecord triangle)
+{
+    uint axes = uint(triangle.voxel_min.w);
+    return uvec3(axes & 3, (axes >> 2) & 3, (axes >> 4) & 3);
+}
+
+vec2 triangle_texcoord(TriangleRecord triangle, vec3 barycentric)
+{
+    return barycentric.x * unpackHalf2x16(triangle.texcoords.x) + barycentric.y * unpackHalf2x16(triangle.texcoords.y) + barycentric.z * unpackHalf2x16(triangle.texcoords.z);
+}
+
 bool test_axis(vec3 axis, vec3 u0, vec3 u1, vec3 u2, float extent)
 {
     vec3 A0 = vec3(1.0, 0.0, 0.0);
@@ -0,0 +1,9 @@
+#version 450
+
+// Covers the screen with one triangle, draw 3 vertices without a vertex buffer.
+void main()
+{
+	vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+
+	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
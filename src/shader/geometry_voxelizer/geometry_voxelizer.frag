@@ -1,13 +1,12 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout (location = 0) in vec3 FS_IN_FragPos;
 layout (location = 1) in vec2 FS_IN_Texcoord;
 layout (location = 2) in vec3 FS_IN_Normal;
+layout (location = 3) flat in uint FS_IN_Material;
 
-layout (set = 0, binding = 0) uniform sampler2D s_Diffuse;
-layout (set = 0, binding = 1) uniform sampler2D s_Normal;
-layout (set = 0, binding = 2) uniform sampler2D s_Metallic;
-layout (set = 0, binding = 3) uniform sampler2D s_Roughness;
+layout (set = 0, binding = 0) uniform sampler2D s_Diffuse[];
 
 layout (set = 1, binding = 0) uniform PerFrameUBO 
 {	
@@ -32,7 +31,7 @@ void main()
 	float voxel_width = (_max.x - _min.x) / float(voxels_per_side);
 	ivec3 voxel_coordinate = ivec3((FS_IN_FragPos - _min) / voxel_width);
 
-	vec3 diffuse = texture(s_Diffuse, FS_IN_Texcoord).xyz;
+	vec3 diffuse = texture(s_Diffuse[nonuniformEXT(FS_IN_Material)], FS_IN_Texcoord).xyz;
 	const vec4 current_voxel_value = imageLoad(voxelTexture, voxel_coordinate);
 	const vec4 voxel_value = vec4(diffuse, 1.0);
 	// const vec4 voxel_value = vec4(current_voxel_value.xyz + diffuse, current_voxel_value.w + 1.0);
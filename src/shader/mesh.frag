@@ -7,22 +7,25 @@
 layout (location = 0) in vec4 FS_IN_FragPos;
 layout (location = 1) in vec2 FS_IN_Texcoord;
 layout (location = 2) in vec3 FS_IN_Normal;
+layout (location = 3) flat in uint FS_IN_Material;
 
 layout (location = 0) out vec3 FS_OUT_Color;
 
-layout (set = 0, binding = 0) uniform sampler2D s_Diffuse;
-layout (set = 0, binding = 1) uniform sampler2D s_Normal;
-layout (set = 0, binding = 2) uniform sampler2D s_Metallic;
-layout (set = 0, binding = 3) uniform sampler2D s_Roughness;
+layout (set = 0, binding = 0) uniform sampler2D s_Diffuse[];
 
-layout (set = 2, binding = 0) uniform sampler2D shadow_map;
+#define MAX_SHADOW_CASCADES 4
+
+// One layer per cascade.
+layout (set = 2, binding = 0) uniform sampler2DArray shadow_map;
 
 layout (set = 1, binding = 0) uniform PerFrameUBO 
 {	
 	mat4 view;
 	mat4 projection;
-	mat4 lightSpaceMatrix;
+	mat4 lightSpaceMatrix[MAX_SHADOW_CASCADES];
 	vec4 camera_pos;
+	vec4 cascadeSplits;
+	uint cascadeCount;
 } ubo;
 
 layout (set = 3, binding = 0) uniform LightsUBO 
@@ -44,6 +47,9 @@ layout(set = 5, binding = 0) uniform voxelGridUBO
     vec4 aabb_max;
 } voxelGrid;
 
+#define WORK_COUNTERS_SET 7
+#include "work_counters.h"
+
 layout( push_constant ) uniform constants{
 	mat4 model;
 	uint textureIndex;
@@ -56,13 +62,14 @@ layout( push_constant ) uniform constants{
 } pc;
 
 float ambient = 0.03;
+uint coneSteps = 0;
 
-float textureProj(vec4 shadowCoord, vec2 off)
+float textureProj(vec4 shadowCoord, vec2 off, uint cascade)
 {
 	float shadow = 1.0;
 	if ( shadowCoord.z > -1.0 && shadowCoord.z < 1.0 ) 
 	{
-		float dist = texture( shadow_map, shadowCoord.st + off ).r;
+		float dist = texture( shadow_map, vec3(shadowCoord.st + off, cascade) ).r;
 		if ( shadowCoord.w > 0.0 && dist < shadowCoord.z ) 
 		{
 			shadow = ambient;
@@ -71,9 +78,9 @@ float textureProj(vec4 shadowCoord, vec2 off)
 	return shadow;
 }
 
-float filterPCF(vec4 sc)
+float filterPCF(vec4 sc, uint cascade)
 {
-	ivec2 texDim = textureSize(shadow_map, 0);
+	ivec2 texDim = textureSize(shadow_map, 0).xy;
 	float scale = 1.5;
 	float dx = scale * 1.0 / float(texDim.x);
 	float dy = scale * 1.0 / float(texDim.y);
@@ -86,7 +93,7 @@ float filterPCF(vec4 sc)
 	{
 		for (int y = -range; y <= range; y++)
 		{
-			shadowFactor += textureProj(sc, vec2(dx*x, dy*y));
+			shadowFactor += textureProj(sc, vec2(dx*x, dy*y), cascade);
 			count++;
 		}
 	
@@ -237,6 +244,7 @@ float calculateAmbientOcclusion(){
 			sampleLocation += directions[i] * voxelWidth;
 			sampleLength = length(sampleLocation - position);
 			radius = sampleLength * tan(radians(CONE_HALF_ANGLE)) * 2;
+			coneSteps++;
 
 		}
 
@@ -256,22 +264,30 @@ void main()
 
 	vec3 diffuse;
 	if(!pc.noTexture)
-		diffuse = texture(s_Diffuse, FS_IN_Texcoord).xyz;
+		diffuse = texture(s_Diffuse[nonuniformEXT(FS_IN_Material)], FS_IN_Texcoord).xyz;
 	else
 		diffuse = vec3(1.0);
 
 	vec3 ambient = diffuse * ambient;
 
-	vec4 FragPosLightSpace = ubo.lightSpaceMatrix * FS_IN_FragPos;
+	// Pick the first cascade whose split lies beyond the fragment's view space depth.
+	float viewDepth = -(ubo.view * FS_IN_FragPos).z;
+	uint cascade = 0;
+
+	for (uint i = 0; i < ubo.cascadeCount - 1; i++)
+	{
+		if (viewDepth > ubo.cascadeSplits[i])
+			cascade = i + 1;
+	}
+
+	vec4 FragPosLightSpace = ubo.lightSpaceMatrix[cascade] * FS_IN_FragPos;
 
 	vec4 fragNDCCoords = FragPosLightSpace / FragPosLightSpace.w;
 
 	fragNDCCoords.xy = fragNDCCoords.xy * 0.5 + 0.5;
 
-	float closestDepth = texture(shadow_map, fragNDCCoords.xy).r;
-	float currentDepth = fragNDCCoords.z;
 	//float shadowValue = currentDepth > closestDepth ? 1.0 : 0.0;
-	float shadowValue = filterPCF(fragNDCCoords);
+	float shadowValue = filterPCF(fragNDCCoords, cascade);
 
 	vec3 color;
 
@@ -279,6 +295,12 @@ void main()
 	{
 		float ambientOcclusion = calculateAmbientOcclusion();
 
+		if (work_counters.render_enabled != 0)
+		{
+			atomicAdd(work_counters.cone_steps, coneSteps);
+			atomicAdd(work_counters.cone_fragments, 1);
+		}
+
 		if(pc.visualizeOcclusion)
 		{
 			color = vec3(1.0 - ambientOcclusion);
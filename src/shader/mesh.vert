@@ -9,6 +9,7 @@ layout(location = 4) in vec4 VS_IN_Bitangent;
 layout (location = 0) out vec4 FS_IN_FragPos;
 layout (location = 1) out vec2 FS_IN_Texcoord;
 layout (location = 2) out vec3 FS_IN_Normal;
+layout (location = 3) flat out uint FS_IN_Material;
 
 layout( push_constant ) uniform constants{
 	mat4 model;
@@ -21,6 +22,27 @@ layout( push_constant ) uniform constants{
 	bool noTexture;
 } pc;
 
+struct Instance
+{
+	mat4 model;
+};
+
+struct DrawInstance
+{
+	uint instance;
+	uint material;
+};
+
+layout (set = 6, binding = 0) readonly buffer InstanceBuffer
+{
+	Instance instances[];
+};
+
+layout (set = 6, binding = 1) readonly buffer DrawInstanceBuffer
+{
+	DrawInstance draw_instances[];
+};
+
 layout (set = 1, binding = 0) uniform PerFrameUBO 
 {
 	mat4 view;
@@ -30,8 +52,13 @@ layout (set = 1, binding = 0) uniform PerFrameUBO
 
 void main() 
 {
+    DrawInstance draw_instance = draw_instances[gl_InstanceIndex];
+    mat4         model         = instances[draw_instance.instance].model;
+
+    FS_IN_Material = draw_instance.material;
+
     // Transform position into world space
-	vec4 world_pos = pc.model * vec4(VS_IN_Position.xyz, 1.0);
+	vec4 world_pos = model * vec4(VS_IN_Position.xyz, 1.0);
 
     // Pass world position into Fragment shader
     FS_IN_FragPos = world_pos;
@@ -42,7 +69,7 @@ void main()
 	gl_Position = ubo.projection * ubo.view * world_pos;
 	
     // Transform vertex normal into world space
-    mat3 normal_mat = mat3(pc.model);
+    mat3 normal_mat = mat3(model);
 
 	FS_IN_Normal = normal_mat * VS_IN_Normal.xyz;
 }
\ No newline at end of file
@@ -15,6 +15,27 @@ layout( push_constant ) uniform constants
 	mat4 model;
 } pc;
 
+struct Instance
+{
+	mat4 model;
+};
+
+struct DrawInstance
+{
+	uint instance;
+	uint material;
+};
+
+layout (set = 2, binding = 0) readonly buffer InstanceBuffer
+{
+	Instance instances[];
+};
+
+layout (set = 2, binding = 1) readonly buffer DrawInstanceBuffer
+{
+	DrawInstance draw_instances[];
+};
+
 layout (set = 1, binding = 0) uniform PerFrameUBO 
 {
 	mat4 view;
@@ -28,8 +49,10 @@ out gl_PerVertex
 
 void main() 
 {
+    mat4 model = instances[draw_instances[gl_InstanceIndex].instance].model;
+
     // Transform position into world space
-	vec4 world_pos = pc.model * vec4(VS_IN_Position.xyz, 1.0);
+	vec4 world_pos = model * vec4(VS_IN_Position.xyz, 1.0);
 
     // Pass world position into Fragment shader
     FS_IN_FragPos = world_pos.xyz;
@@ -40,7 +63,7 @@ void main()
 	gl_Position = ubo.projection * ubo.view * world_pos;
 	
     // Transform vertex normal into world space
-    mat3 normal_mat = mat3(pc.model);
+    mat3 normal_mat = mat3(model);
 
 	FS_IN_Normal = normal_mat * VS_IN_Normal.xyz;
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 450
+
+layout (location = 0) out vec3 FS_OUT_Color;
+
+layout( push_constant ) uniform constants{
+	mat4 viewProjection;
+	vec4 grid;
+	bool noTexture;
+} pc;
+
+layout (location = 0) flat in vec3 faceColor;
+layout (location = 1) flat in int faceAxis;
+
+// Faces are shaded by their axis so that neighbouring voxels of the same color stay distinguishable.
+const vec3 faceShade = vec3(0.8, 1.0, 0.6);
+
+void main()
+{
+	vec3 albedo = pc.noTexture ? vec3(1.0) : faceColor;
+
+	FS_OUT_Color = albedo * faceShade[faceAxis];
+}
@@ -0,0 +1,49 @@
+#version 450
+
+struct VoxelFace {
+    uint coordinate;       // First voxel of the face, 10 bits per axis
+    uint sizeAndDirection; // Width - 1 and height - 1 in 10 bits each, then the direction
+    uint color;            // RGBA8
+};
+
+layout(std430, set=0, binding = 1) readonly buffer FaceBuffer {
+   VoxelFace faces[];
+};
+
+layout( push_constant ) uniform constants{
+	mat4 viewProjection;
+	vec4 grid; // xyz: minimum corner of the grid, w: voxel width
+	bool noTexture;
+} pc;
+
+layout (location = 0) flat out vec3 faceColor;
+layout (location = 1) flat out int faceAxis;
+
+// Corners of the two triangles in the face's (u, v) plane.
+const vec2 corners[6] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+void main()
+{
+    VoxelFace face = faces[gl_VertexIndex / 6];
+
+    vec3 coordinate = vec3(face.coordinate & 0x3FF, (face.coordinate >> 10) & 0x3FF, (face.coordinate >> 20) & 0x3FF);
+    vec2 size       = vec2((face.sizeAndDirection & 0x3FF) + 1, ((face.sizeAndDirection >> 10) & 0x3FF) + 1);
+    uint direction  = face.sizeAndDirection >> 20;
+
+    int axis  = int(direction >> 1);
+    int uAxis = (axis + 1) % 3;
+    int vAxis = (axis + 2) % 3;
+
+    vec2 corner = corners[gl_VertexIndex % 6] * size;
+
+    // Faces towards +axis lie on the far side of their voxels.
+    vec3 position = coordinate;
+    position[axis]  += (direction & 1u) == 0u ? 1.0 : 0.0;
+    position[uAxis] += corner.x;
+    position[vAxis] += corner.y;
+
+	gl_Position = pc.viewProjection * vec4(pc.grid.xyz + position * pc.grid.w, 1.0);
+
+	faceColor = unpackUnorm4x8(face.color).xyz;
+	faceAxis  = axis;
+}
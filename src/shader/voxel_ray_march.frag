@@ -0,0 +1,10 @@
+#version 450
+
+layout (location = 0) out vec3 FS_OUT_Color;
+
+layout(set = 0, binding = 1, rgba8) uniform readonly image2D rayMarchImage;
+
+void main()
+{
+	FS_OUT_Color = imageLoad(rayMarchImage, ivec2(gl_FragCoord.xy)).xyz;
+}
@@ -13,22 +13,27 @@ layout (set = 0, binding = 0) uniform PerFrameUBO
 	mat4 model;
 	mat4 view;
 	mat4 projection;
+	vec4 grid; // xyz: minimum corner of the grid, w: voxel width
 } ubo;
 
-layout(std140, set=1, binding = 0) readonly buffer InstanceBuffer {
-   vec4 positions[];
+// x: coordinate packed into 10 bits per axis, y: RGBA8 color
+layout(std430, set=1, binding = 0) readonly buffer InstanceBuffer {
+   uvec2 instances[];
 };
 
-// output instance index to fragment shader as a flat value
-layout (location = 1) flat out int instanceIndex;
+// output the instance color to fragment shader as a flat value
+layout (location = 1) flat out vec3 instanceColor;
 
 void main() 
 {
-    // Transform position into world space
-	vec4 world_pos =  ubo.model * vec4(VS_IN_Position.xyz, 1.0) + vec4(positions[gl_InstanceIndex]);
+    uvec2 instance = instances[gl_InstanceIndex];
+    vec3  voxel_coordinate = vec3(instance.x & 0x3FF, (instance.x >> 10) & 0x3FF, (instance.x >> 20) & 0x3FF);
+
+    // The cube is scaled to a voxel by the model matrix and centered on the voxel
+	vec3 world_pos = 0.5 * (ubo.model * vec4(VS_IN_Position.xyz, 1.0)).xyz + ubo.grid.xyz + (voxel_coordinate + 0.5) * ubo.grid.w;
 
     // Transform world position into clip space
-	gl_Position = ubo.projection * ubo.view * world_pos;
+	gl_Position = ubo.projection * ubo.view * vec4(world_pos, 1.0);
 
-	instanceIndex = gl_InstanceIndex;
-}
\ No newline at end of file
+	instanceColor = unpackUnorm4x8(instance.y).xyz;
+}
@@ -0,0 +1,22 @@
+// Per frame work counters, see WorkCounterValues in WorkCounters.h. Define WORK_COUNTERS_SET before including, and
+// WORK_COUNTERS_BINDING when the counters share a set. A group's enabled word is zero unless the counters are turned
+// on, so the atomics are skipped by default.
+#ifndef WORK_COUNTERS_BINDING
+#define WORK_COUNTERS_BINDING 0
+#endif
+
+layout(set = WORK_COUNTERS_SET, binding = WORK_COUNTERS_BINDING) buffer WorkCounterBuffer
+{
+    uint voxelizer_enabled;
+    uint triangles;
+    uint sat_tests;
+    uint voxels_written;
+    uint large_triangle_records;
+    uint voxelizer_padding[3];
+
+    uint render_enabled;
+    uint cone_steps;
+    uint cone_fragments;
+    uint render_padding[5];
+}
+work_counters;